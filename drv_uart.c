@@ -14,270 +14,2714 @@
  * limitations under the License.
  */
 
-#include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
-#include "drv_uart.h"
+#include "drv_uartCrc.h"
+#include "drv_uartStatic.h"
+#include <string.h>
 #include <sys/attribs.h>
+#include <sys/kmem.h>
 #include <xc.h>
 
-struct drv_uartHandle {
-    uartDevices_t uartDev;              /**<Desired uart device to initialize, only UARTDEV1 is supported atm*/
-    bool blocking : 1;                  /**<Use interrupts? must be on(1) for now*/
-    drv_uartEventHandler_t onReceive;   /**<Function to execute if the receive buffer is full*/
-    QueueHandle_t queueHandle;          /**<UART fifo buffer*/
+#define UART_FIFO_DEPTH     8
+#define UART_DMA_CHANNELS   8
+#define UART_DMA_STRIDE     0xC0    /**<Distance between DMA channel register blocks*/
+
+// DCHxCON, DCHxECON and DCHxINT bits
+#define DMA_CHEN        (1 << 7)
+#define DMA_CHAEN       (1 << 4)
+#define DMA_CHPRI       3
+#define DMA_SIRQEN      (1 << 4)
+#define DMA_CHSIRQ      8
+#define DMA_CHBCIF      (1 << 3)
+#define DMA_CHDHIF      (1 << 4)
+#define DMA_CHDDIF      (1 << 5)
+#define DMA_FLAGS       0xFF
+#define DMA_IE          16
+
+#define UART_TIMERS         4       /**<Timer 2 - 5 can detect an idle line*/
+#define UART_CHAR_BITS      12      /**<Longest character, start, 9 data, parity and 2 stop bits*/
+#define UART_TIMER_MAX      0xFFFF
+#define UART_XON            0x11
+#define UART_XOFF           0x13
+#define UART_RX_QUIET       (8 * 16) /**<Longest gap between bytes the adaptive FIFO averages, in 1/16 characters*/
+
+// UxBRG for a baudrate with the 16x and the 4x (BRGH) clock, rounded. The
+// module runs from the peripheral bus clock
+#define UART_BRG16(baud)        ((PB_CLK_FREQ + 8 * (baud)) / (16 * (baud)) - 1)
+#define UART_BRG4(baud)         ((PB_CLK_FREQ + 2 * (baud)) / (4 * (baud)) - 1)
+#define UART_RATE(brg, div)     (PB_CLK_FREQ / ((div) * ((brg) + 1)))
+#define UART_DIFF(a, b)         ((a) > (b) ? (a) - (b) : (b) - (a))
+#define UART_BRGH_BETTER(baud)  (UART_DIFF(UART_RATE(UART_BRG4(baud), 4), (baud)) < \
+                                 UART_DIFF(UART_RATE(UART_BRG16(baud), 16), (baud)))
+#define UART_BAUD_STD(baud)     {baud, UART_BRGH_BETTER(baud) ? UART_BRG4(baud) : \
+                                 UART_BRG16(baud), UART_BRGH_BETTER(baud)}
+
+// Core timer ticks, at half the system clock, of a number of peripheral clocks
+#if PB_CLK_FREQ == SYS_CLK_FREQ / 2
+#define UART_CORE_TICKS(clocks) (clocks)
+#else
+#define UART_CORE_TICKS(clocks) ((uint32_t)((uint64_t)(clocks) * \
+                                 (SYS_CLK_FREQ / 2) / PB_CLK_FREQ))
+#endif
+
+// Counters, compiled out with DRV_UART_STATS
+#if DRV_UART_STATS
+#define UART_STAT_ADD(handle, counter, n)   ((handle)->stats.counter += (n))
+#define UART_STAT_MAX(handle, counter, n)   uartStatMax(&(handle)->stats.counter, (n))
+#define UART_STAT_LINE(handle, sta)         uartStatLine(handle, sta)
+#define UART_ISR_BEGIN()                    uint32_t isrStart = _CP0_GET_COUNT()
+#define UART_ISR_END(handle)                uartStatIsr(handle, isrStart)
+#define UART_STAT_LATENCY(handle, lane, stamp) uartStatLatency(handle, lane, stamp)
+#else
+#define UART_STAT_ADD(handle, counter, n)   ((void)(n))
+#define UART_STAT_MAX(handle, counter, n)
+#define UART_STAT_LINE(handle, sta)
+#define UART_ISR_BEGIN()
+#define UART_ISR_END(handle)
+#define UART_STAT_LATENCY(handle, lane, stamp)
+#endif
+
+// __ISR priority of a level, expanded first so DRV_UART_IPL can be passed
+#define UART_IPL_(level)    ipl##level##auto
+#define UART_IPL(level)     UART_IPL_(level)
+
+// Register access through a pointer, the host simulator hooks these
+#ifndef SFR_READ
+#define SFR_READ(sfr)           (*(sfr))
+#define SFR_WRITE(sfr, value)   (*(sfr) = (value))
+#define SFR_IFS0                (&IFS0)
+#define SFR_IEC0                (&IEC0)
+#define SFR_IPC0                (&IPC0)
+#endif
+
+// IFSx, IECx and IPCx by index, the registers are one block apart
+#define UART_IFS(n)     ((uartSfr_t *)(SFR_IFS0) + (n))
+#define UART_IEC(n)     ((uartSfr_t *)(SFR_IEC0) + (n))
+#define UART_IPC(n)     ((uartSfr_t *)(SFR_IPC0) + (n))
+
+// A build for a single port resolves every register address at compile time
+#ifdef DRV_UART_PORT
+#define UART_PORT(handle)   ((void)(handle), &uartPorts[DRV_UART_PORT])
+#else
+#define UART_PORT(handle)   ((handle)->port)
+#endif
+#define UART_REGS(handle)   (UART_PORT(handle)->regs)
+
+typedef struct {
+    volatile uint32_t reg;
+    volatile uint32_t clr;
+    volatile uint32_t set;
+    volatile uint32_t inv;
+} uartSfr_t;
+
+typedef struct {
+    uartSfr_t mode;
+    uartSfr_t sta;
+    uartSfr_t txreg;
+    uartSfr_t rxreg;
+    uartSfr_t brg;
+} uartRegs_t;
+
+/**
+ * Registers and interrupt bits of one uart module, the only place that knows
+ * which module is which.
+ */
+struct uartPort {
+    uartRegs_t *regs;       /**<UxMODE to UxBRG*/
+    uint8_t errReg;         /**<IFSx and IECx holding the error interrupt*/
+    uint8_t rxReg;          /**<IFSx and IECx holding the receive interrupt*/
+    uint8_t txReg;          /**<IFSx and IECx holding the transmit interrupt*/
+    uint8_t ipc;            /**<IPCx holding the priority*/
+    uint8_t ipcShift;       /**<Position of the priority in IPCx*/
+    uint8_t rxIrq;          /**<Request that starts a receive DMA cell transfer*/
+    uint8_t txIrq;          /**<Request that starts a transmit DMA cell transfer*/
+    uint32_t errMask;
+    uint32_t rxMask;
+    uint32_t txMask;
+};
+
+struct uartDmaRegs {
+    uartSfr_t con;
+    uartSfr_t econ;
+    uartSfr_t intr;
+    uartSfr_t ssa;
+    uartSfr_t dsa;
+    uartSfr_t ssiz;
+    uartSfr_t dsiz;
+    uartSfr_t sptr;
+    uartSfr_t dptr;
+    uartSfr_t csiz;
+    uartSfr_t cptr;
+    uartSfr_t dat;
 };
 
-drv_uartHandle_t handlers[NUM_UARTS] = {0};
+typedef struct {
+    uartSfr_t con;
+    uartSfr_t tmr;
+    uartSfr_t pr;
+} uartTimerRegs_t;
+
+typedef struct {
+    uint32_t baud;
+    uint16_t brg;
+    bool highSpeed;
+} uartBaudSetting_t;
+
+static const uartPort_t uartPorts[NUM_UARTS] = {
+    [UART_DEV1] = {(uartRegs_t *)_UART1_BASE_ADDRESS, 0, 0, 0, 6, 0,
+            _UART1_RX_IRQ, _UART1_TX_IRQ,
+            _IFS0_U1EIF_MASK, _IFS0_U1RXIF_MASK, _IFS0_U1TXIF_MASK},
+    [UART_DEV2] = {(uartRegs_t *)_UART2_BASE_ADDRESS, 1, 1, 1, 8, 0,
+            _UART2_RX_IRQ, _UART2_TX_IRQ,
+            _IFS1_U2EIF_MASK, _IFS1_U2RXIF_MASK, _IFS1_U2TXIF_MASK},
+    [UART_DEV3] = {(uartRegs_t *)_UART3_BASE_ADDRESS, 0, 1, 1, 7, 24,
+            _UART3_RX_IRQ, _UART3_TX_IRQ,
+            _IFS0_U3EIF_MASK, _IFS1_U3RXIF_MASK, _IFS1_U3TXIF_MASK},
+    [UART_DEV4] = {(uartRegs_t *)_UART4_BASE_ADDRESS, 2, 2, 2, 12, 8,
+            _UART4_RX_IRQ, _UART4_TX_IRQ,
+            _IFS2_U4EIF_MASK, _IFS2_U4RXIF_MASK, _IFS2_U4TXIF_MASK},
+    [UART_DEV5] = {(uartRegs_t *)_UART5_BASE_ADDRESS, 2, 2, 2, 12, 24,
+            _UART5_RX_IRQ, _UART5_TX_IRQ,
+            _IFS2_U5EIF_MASK, _IFS2_U5RXIF_MASK, _IFS2_U5TXIF_MASK},
+    [UART_DEV6] = {(uartRegs_t *)_UART6_BASE_ADDRESS, 2, 2, 2, 12, 16,
+            _UART6_RX_IRQ, _UART6_TX_IRQ,
+            _IFS2_U6EIF_MASK, _IFS2_U6RXIF_MASK, _IFS2_U6TXIF_MASK},
+};
+
+drv_uartHandle_t handlers[NUM_UARTS] = {0};
+static drv_uartHandle_t dmaOwners[UART_DMA_CHANNELS] = {0};
+static drv_uartHandle_t timerOwners[UART_TIMERS] = {0};
+
+// Characters in the receive FIFO that raise the interrupt, per URXISEL
+static const uint8_t uartFifoLevels[] = {
+    1, UART_FIFO_DEPTH / 2, UART_FIFO_DEPTH * 3 / 4, UART_FIFO_DEPTH
+};
+
+// Levels of FIFO_ADAPTIVE, from every byte to the fewest interrupts. FIFO_FULL
+// is left out, it leaves a single character time before an overrun. The
+// average gap between bytes in 1/16 characters that moves a tier up or down,
+// apart so a steady rate does not toggle between two tiers.
+static const uartFifoSizes_t uartFifoTiers[] = {FIFO_CHAR, FIFO_3};
+static const uint16_t uartTierUp[] = {32, 0};
+static const uint16_t uartTierDown[] = {UINT16_MAX, 48};
+
+static const uartBaudSetting_t uartStdBauds[] = {
+    UART_BAUD_STD(BAUD1200), UART_BAUD_STD(BAUD2400),
+    UART_BAUD_STD(BAUD9600), UART_BAUD_STD(BAUD19200),
+    UART_BAUD_STD(BAUD38400), UART_BAUD_STD(BAUD57600),
+    UART_BAUD_STD(BAUD115200), UART_BAUD_STD(BAUD230400),
+    UART_BAUD_STD(BAUD460800), UART_BAUD_STD(BAUD921600),
+    UART_BAUD_STD(BAUD1000000)
+};
+
+/**
+ * Local function to calculate the baudrate according to the datasheet. The
+ * standard rates come from a table resolved at compile time, other rates use
+ * the clock, 16x or 4x (BRGH), that gets closest.
+ * @param baud  Desired baudrate in bit/s
+ * @param setting Set to the UxBRG value and clock to configure.
+ * @return      false if the baudrate is out of range
+ * @see PB_CLK_FREQ
+ */
+static bool calculateBaud(uint32_t baud, uartBaudSetting_t *setting)
+{
+    uint32_t brg16, brg4;
+    bool fits16, fits4;
+    uint8_t i;
+
+    for (i = 0; i < sizeof (uartStdBauds) / sizeof (uartStdBauds[0]); i++) {
+        if (uartStdBauds[i].baud == baud) {
+            *setting = uartStdBauds[i];
+            return true;
+        }
+    }
+    if (baud == 0 || baud > PB_CLK_FREQ / 4)
+        return false;
+    // Out of range values wrap around and fail the checks below
+    brg16 = UART_BRG16(baud);
+    brg4 = UART_BRG4(baud);
+    fits16 = brg16 <= UINT16_MAX;
+    fits4 = brg4 <= UINT16_MAX;
+    if (!fits16 && !fits4)
+        return false;
+    setting->baud = baud;
+    setting->highSpeed = !fits16 || (fits4 &&
+            UART_DIFF(UART_RATE(brg4, 4), baud) <
+            UART_DIFF(UART_RATE(brg16, 16), baud));
+    setting->brg = setting->highSpeed ? brg4 : brg16;
+    return true;
+}
+
+#if DRV_UART_STATS
+static void uartStatMax(uint32_t *counter, uint32_t value)
+{
+    if (value > *counter)
+        *counter = value;
+}
+
+/**
+ * Count the errors of the character at the top of the receive FIFO
+ * @param handle Handle to the uart instance.
+ * @param sta   Value of UxSTA before the character is read.
+ */
+static void uartStatLine(drv_uartHandle_t handle, uint32_t sta)
+{
+    handle->stats.framingErrors += (sta >> U_FERR) & 1;
+    handle->stats.parityErrors += (sta >> U_PERR) & 1;
+}
+
+/**
+ * Account an interrupt and its duration to a uart device
+ * @param handle Handle to the uart instance, NULL if the interrupt had none.
+ * @param start Core timer at the start of the interrupt.
+ */
+static void uartStatIsr(drv_uartHandle_t handle, uint32_t start)
+{
+    uint32_t ticks = _CP0_GET_COUNT() - start;
+
+    if (!handle)
+        return;
+    handle->stats.isrCount++;
+    handle->isrTicks += ticks;
+    if (ticks > handle->isrMaxTicks)
+        handle->isrMaxTicks = ticks;
+}
+
+/**
+ * Account the time a write spent in its transmit lane
+ * @param handle Handle to the uart instance.
+ * @param lane  Lane of the write, see uartTxLanes_t.
+ * @param stamp Core timer count when the write was queued.
+ */
+static void uartStatLatency(drv_uartHandle_t handle, uint8_t lane,
+        uint32_t stamp)
+{
+    uint32_t ticks = _CP0_GET_COUNT() - stamp;
+
+    handle->txLatencyTicks[lane] += ticks;
+    handle->txLatencyCount[lane]++;
+    if (ticks > handle->txLatencyMax[lane])
+        handle->txLatencyMax[lane] = ticks;
+}
+#endif
+
+/**
+ * Function to enable interrupts for a uart device
+ * @param handle    Handle to the uart instance.
+ * @param priority  Interrupt priority
+ */
+static void uartEnableInt(drv_uartHandle_t handle, uint8_t priority)
+{
+    const uartPort_t *port = UART_PORT(handle);
+
+    SFR_WRITE(&UART_IFS(port->errReg)->clr, port->errMask);
+    SFR_WRITE(&UART_IFS(port->rxReg)->clr, port->rxMask);
+    // Priority and subpriority may hold what an earlier owner left
+    SFR_WRITE(&UART_IPC(port->ipc)->clr, 0x1F << port->ipcShift);
+    SFR_WRITE(&UART_IPC(port->ipc)->set, ((priority << 2) | 3) << port->ipcShift);
+    SFR_WRITE(&UART_IEC(port->errReg)->set, port->errMask);
+    // With DMA receive the receive interrupt only marks the start of a burst
+    if (!handle->rxDma || handle->idleTimer)
+        SFR_WRITE(&UART_IEC(port->rxReg)->set, port->rxMask);
+}
+
+/**
+ * Set flags in the mode register for a uart device
+ * @param handle Handle to the uart instance.
+ * @param flags Flags to set in the register.
+ */
+static inline void uartModeSetFlags(drv_uartHandle_t handle, uint32_t flags)
+{
+    SFR_WRITE(&UART_REGS(handle)->mode.set, flags);
+}
+
+/**
+ * Clear flags in the mode register for a uart device
+ * @param handle Handle to the uart instance.
+ * @param flags Flags to clear in the register.
+ */
+static inline void uartModeClrFlags(drv_uartHandle_t handle, uint32_t flags)
+{
+    SFR_WRITE(&UART_REGS(handle)->mode.clr, flags);
+}
+
+/**
+ * Enable the transmit interrupt of a uart device
+ * @param handle Handle to the uart instance.
+ */
+static inline void uartTxIntEnable(drv_uartHandle_t handle)
+{
+    const uartPort_t *port = UART_PORT(handle);
+
+    SFR_WRITE(&UART_IEC(port->txReg)->set, port->txMask);
+}
+
+/**
+ * Disable the transmit interrupt of a uart device
+ * @param handle Handle to the uart instance.
+ */
+static inline void uartTxIntDisable(drv_uartHandle_t handle)
+{
+    const uartPort_t *port = UART_PORT(handle);
+
+    SFR_WRITE(&UART_IEC(port->txReg)->clr, port->txMask);
+}
+
+/**
+ * Check if the hardware transmit FIFO of a uart device is full
+ * @param handle Handle to the uart instance.
+ */
+static inline bool uartTxFull(drv_uartHandle_t handle)
+{
+    return SFR_READ(&UART_REGS(handle)->sta.reg) & (1 << U_UTXBF);
+}
+
+/**
+ * Check if the peer sent XOFF, read by tasks spinning on the FIFO.
+ * @param handle Handle to the uart instance.
+ */
+static inline bool uartTxPaused(drv_uartHandle_t handle)
+{
+    return *(volatile bool *)&handle->txPaused;
+}
+
+/**
+ * Write a char to the hardware transmit FIFO of a uart device
+ * @param handle Handle to the uart instance.
+ * @param data Char to write.
+ */
+static inline void uartTxWrite(drv_uartHandle_t handle, uint8_t data)
+{
+    UART_STAT_ADD(handle, txBytes, 1);
+    if (handle->echo)
+        handle->echoSkip++;
+    SFR_WRITE(&UART_REGS(handle)->txreg.reg, data);
+}
+
+/**
+ * Check if the hardware receive FIFO of a uart device holds a char
+ * @param handle Handle to the uart instance.
+ */
+static inline bool uartRxAvailable(drv_uartHandle_t handle)
+{
+    return SFR_READ(&UART_REGS(handle)->sta.reg) & (1 << U_URXDA);
+}
+
+/**
+ * Read a char from the hardware receive FIFO of a uart device
+ * @param handle Handle to the uart instance.
+ */
+static inline uint8_t uartRxRead(drv_uartHandle_t handle)
+{
+    return SFR_READ(&UART_REGS(handle)->rxreg.reg);
+}
+
+/**
+ * Enable the receive interrupt of a uart device
+ * @param handle Handle to the uart instance.
+ */
+static void uartRxIntEnable(drv_uartHandle_t handle)
+{
+    const uartPort_t *port = UART_PORT(handle);
+
+    SFR_WRITE(&UART_IFS(port->rxReg)->clr, port->rxMask);
+    SFR_WRITE(&UART_IEC(port->rxReg)->set, port->rxMask);
+}
+
+/**
+ * Disable the receive interrupt of a uart device
+ * @param handle Handle to the uart instance.
+ */
+static void uartRxIntDisable(drv_uartHandle_t handle)
+{
+    const uartPort_t *port = UART_PORT(handle);
+
+    SFR_WRITE(&UART_IEC(port->rxReg)->clr, port->rxMask);
+}
+
+/**
+ * Set the receive FIFO level that raises the receive interrupt
+ * @param handle Handle to the uart instance.
+ * @param fifoSize Interrupt level, see uartFifoSizes_t.
+ */
+static void uartRxThreshold(drv_uartHandle_t handle, uartFifoSizes_t fifoSize)
+{
+    uartRegs_t *regs = UART_REGS(handle);
+
+    // Only clear the bits that change so the level never drops in between
+    SFR_WRITE(&regs->sta.clr, (~(uint32_t)fifoSize & 3) << U_URXISEL0);
+    SFR_WRITE(&regs->sta.set, (uint32_t)fifoSize << U_URXISEL0);
+}
+
+/**
+ * Read everything left in the hardware receive FIFO of a uart device
+ * @param handle Handle to the uart instance.
+ * @param data  Buffer of UART_FIFO_DEPTH bytes.
+ * @param errors Set to a bit per byte read with a parity or framing error.
+ * @return Number of bytes read.
+ */
+static uint8_t uartRxDrain(drv_uartHandle_t handle, uint8_t *data,
+        uint8_t *errors)
+{
+    uartRegs_t *regs = UART_REGS(handle);
+    uint32_t sta;
+    uint8_t i = 0;
+
+    *errors = 0;
+    // A full FIFO is what makes the hardware deassert RTS
+    if (handle->rxPaused && handle->flow == UART_FLOW_RTS_CTS)
+        return 0;
+    while (i < UART_FIFO_DEPTH) {
+        sta = SFR_READ(&regs->sta.reg);
+        if (!(sta & (1 << U_URXDA)))
+            break;
+        UART_STAT_LINE(handle, sta);
+        // PERR and FERR describe the character at the top of the FIFO
+        if (sta & ((1 << U_FERR) | (1 << U_PERR)))
+            *errors |= 1 << i;
+        data[i++] = SFR_READ(&regs->rxreg.reg);
+    }
+    return i;
+}
+
+static uartDmaRegs_t *uartDmaRegs(uint8_t channel)
+{
+    return (uartDmaRegs_t *)(_DMAC0_BASE_ADDRESS + channel * UART_DMA_STRIDE);
+}
+
+/**
+ * Claim a DMA channel for a uart device and enable its interrupt
+ * @param handle    Handle to the uart instance.
+ * @param channel   DMA channel.
+ * @param priority  Interrupt priority
+ * @return Registers of the channel.
+ */
+static uartDmaRegs_t *uartDmaClaim(drv_uartHandle_t handle, uint8_t channel,
+        uint8_t priority)
+{
+    uartDmaRegs_t *dma = uartDmaRegs(channel);
+    uint32_t shift = 8 * (channel % 4);
+    uint32_t ipc = ((priority << 2) | 3) << shift;
+
+    dmaOwners[channel] = handle;
+    DMACONSET = _DMACON_ON_MASK;
+    SFR_WRITE(&dma->con.reg, 0);
+    SFR_WRITE(&dma->intr.reg, 0);
+    IFS1CLR = _IFS1_DMA0IF_MASK << channel;
+    if (channel < 4) {
+        IPC9CLR = 0x1F << shift;
+        IPC9SET = ipc;
+    } else {
+        IPC10CLR = 0x1F << shift;
+        IPC10SET = ipc;
+    }
+    IEC1SET = _IEC1_DMA0IE_MASK << channel;
+    return dma;
+}
+
+/**
+ * Release a DMA channel claimed with uartDmaClaim
+ * @param dma   Registers of the channel.
+ */
+static void uartDmaRelease(uartDmaRegs_t *dma)
+{
+    uint8_t channel = ((uintptr_t)dma - _DMAC0_BASE_ADDRESS) / UART_DMA_STRIDE;
+
+    SFR_WRITE(&dma->con.clr, DMA_CHEN);
+    IEC1CLR = _IEC1_DMA0IE_MASK << channel;
+    dmaOwners[channel] = NULL;
+}
+
+/**
+ * Let a DMA channel fill the receive ring. The channel restarts itself at the
+ * end of the ring and interrupts when it passes the middle or the end.
+ * @param handle    Handle to the uart instance.
+ * @param channel   DMA channel.
+ * @param priority  Interrupt priority
+ */
+static void uartRxDmaInit(drv_uartHandle_t handle, uint8_t channel,
+        uint8_t priority)
+{
+    uartDmaRegs_t *dma = uartDmaClaim(handle, channel, priority);
+
+    handle->rxDma = dma;
+    SFR_WRITE(&dma->econ.reg, (UART_PORT(handle)->rxIrq << DMA_CHSIRQ) |
+            DMA_SIRQEN);
+    SFR_WRITE(&dma->ssa.reg, KVA_TO_PA(&UART_REGS(handle)->rxreg.reg));
+    SFR_WRITE(&dma->dsa.reg, KVA_TO_PA(handle->rx.buf));
+    SFR_WRITE(&dma->ssiz.reg, 1);
+    SFR_WRITE(&dma->dsiz.reg, handle->rx.mask + 1);
+    SFR_WRITE(&dma->csiz.reg, 1);
+    SFR_WRITE(&dma->intr.reg, (DMA_CHDHIF | DMA_CHDDIF) << DMA_IE);
+    SFR_WRITE(&dma->con.reg, DMA_CHAEN | DMA_CHEN | DMA_CHPRI);
+}
+
+/**
+ * Prepare a DMA channel to drain the transmit ring, transfers are started by
+ * uartTxDmaNext.
+ * @param handle    Handle to the uart instance.
+ * @param channel   DMA channel.
+ * @param priority  Interrupt priority
+ */
+static void uartTxDmaInit(drv_uartHandle_t handle, uint8_t channel,
+        uint8_t priority)
+{
+    uartDmaRegs_t *dma = uartDmaClaim(handle, channel, priority);
+
+    handle->txDma = dma;
+    SFR_WRITE(&dma->econ.reg, (UART_PORT(handle)->txIrq << DMA_CHSIRQ) |
+            DMA_SIRQEN);
+    SFR_WRITE(&dma->dsa.reg, KVA_TO_PA(&UART_REGS(handle)->txreg.reg));
+    SFR_WRITE(&dma->dsiz.reg, 1);
+    SFR_WRITE(&dma->csiz.reg, 1);
+    SFR_WRITE(&dma->intr.reg, DMA_CHBCIF << DMA_IE);
+    SFR_WRITE(&dma->con.reg, DMA_CHPRI);
+}
+
+static inline uartRing_t *uartTxRing(drv_uartHandle_t handle, uint8_t lane)
+{
+    return lane == UART_LANE_URGENT ? &handle->txUrgent : &handle->tx;
+}
+
+/**
+ * Note where a write ends in its lane and when it was queued. Without room
+ * the newest end moves, the last two writes then count as one. Called with
+ * interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param lane  Lane of the write, see uartTxLanes_t.
+ * @param stamp Core timer count when the write was queued.
+ */
+static void uartTxEndPush(drv_uartHandle_t handle, uint8_t lane, uint32_t stamp)
+{
+    uartTxEnds_t *ends = &handle->txEnds[lane];
+    uint32_t head = uartTxRing(handle, lane)->head;
+
+    if ((uint8_t)(ends->head - ends->tail) == UART_TX_ENDS) {
+        ends->end[(uint8_t)(ends->head - 1) % UART_TX_ENDS] = head;
+        return;
+    }
+    ends->end[ends->head % UART_TX_ENDS] = head;
+    ends->stamp[ends->head % UART_TX_ENDS] = stamp;
+    ends->head++;
+}
+
+/**
+ * Forget the writes of a lane the transmitter has taken completely and
+ * account their latency. Called from the transmit interrupt or with
+ * interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param lane  Lane to update, see uartTxLanes_t.
+ * @return Bytes up to the end of the next write, UINT32_MAX if that end is
+ *         not queued yet.
+ */
+static uint32_t uartTxEndPop(drv_uartHandle_t handle, uint8_t lane)
+{
+    uartTxEnds_t *ends = &handle->txEnds[lane];
+    uint32_t tail = uartTxRing(handle, lane)->tail;
+    int32_t ahead;
+
+    while (ends->head != ends->tail) {
+        ahead = ends->end[ends->tail % UART_TX_ENDS] - tail;
+        if (ahead > 0)
+            return ahead;
+        UART_STAT_LATENCY(handle, lane, ends->stamp[ends->tail % UART_TX_ENDS]);
+        ends->last = ends->end[ends->tail % UART_TX_ENDS];
+        ends->tail++;
+    }
+    return UINT32_MAX;
+}
+
+/**
+ * Pick the lane to transmit from. Urgent frames go first as soon as the bulk
+ * lane sits at the end of a write, a bulk write in progress is finished
+ * first. A non-blocking write ends where a call stopped accepting it. Called
+ * from the transmit interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param limit Set to the most bytes that may be sent from the lane.
+ * @return Lane to send from, see uartTxLanes_t.
+ */
+static uint8_t uartTxLane(drv_uartHandle_t handle, uint32_t *limit)
+{
+    *limit = uartTxEndPop(handle, UART_LANE_BULK);
+    if (uartRingCount(&handle->txUrgent) &&
+            handle->txEnds[UART_LANE_BULK].last == handle->tx.tail) {
+        *limit = UINT32_MAX;
+        return UART_LANE_URGENT;
+    }
+    return UART_LANE_BULK;
+}
+
+/**
+ * Get the next contiguous block the transmitter may send.
+ * @param handle Handle to the uart instance.
+ * @param lane  Set to the lane of the block.
+ * @param data  Set to the start of the block.
+ * @return Length of the block, 0 if nothing can be sent.
+ */
+static uint32_t uartTxBlock(drv_uartHandle_t handle, uint8_t *lane,
+        const uint8_t **data)
+{
+    uint32_t limit;
+    uint32_t len;
+
+    *lane = uartTxLane(handle, &limit);
+    len = uartRingSpan(uartTxRing(handle, *lane), data);
+    return len < limit ? len : limit;
+}
+
+/**
+ * Wake the tasks waiting for room in either transmit lane, called from the
+ * transmit or DMA interrupt.
+ * @param handle Handle to the uart instance.
+ * @param hasWoken Set if a task was woken.
+ */
+static void uartTxWake(drv_uartHandle_t handle, BaseType_t *hasWoken)
+{
+    if (handle->txWaiter) {
+        vTaskNotifyGiveFromISR(handle->txWaiter, hasWoken);
+        handle->txWaiter = NULL;
+    }
+    if (handle->txUrgentWaiter) {
+        vTaskNotifyGiveFromISR(handle->txUrgentWaiter, hasWoken);
+        handle->txUrgentWaiter = NULL;
+    }
+}
+
+/**
+ * Start a DMA transfer of the next contiguous block in the transmit lanes.
+ * Called from the DMA interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ */
+static void uartTxDmaNext(drv_uartHandle_t handle)
+{
+    const uint8_t *data;
+    uint32_t len = uartTxBlock(handle, &handle->txDmaLane, &data);
+
+    if (len > UINT16_MAX)
+        len = UINT16_MAX;
+    handle->txDmaLen = len;
+    if (!len)
+        return;
+    SFR_WRITE(&handle->txDma->ssa.reg, KVA_TO_PA(data));
+    SFR_WRITE(&handle->txDma->ssiz.reg, len);
+    SFR_WRITE(&handle->txDma->con.set, DMA_CHEN);
+}
+
+/**
+ * Get the transmitter going after bytes were added to the transmit ring.
+ * @param handle Handle to the uart instance.
+ */
+static void uartTxStart(drv_uartHandle_t handle)
+{
+    if (!handle->txDma) {
+        uartTxIntEnable(handle);
+        return;
+    }
+    taskENTER_CRITICAL();
+    if (!handle->txDmaLen)
+        uartTxDmaNext(handle);
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * Drive a half-duplex line before the first byte of a burst is written.
+ * Called from the transmit interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ */
+static inline void uartHdxTransmit(drv_uartHandle_t handle)
+{
+    if (!handle->hdxTx && handle->dirLat)
+        SFR_WRITE(&((uartSfr_t *)handle->dirLat)->set, handle->dirMask);
+    handle->hdxTx = true;
+}
+
+/**
+ * Hand a half-duplex line back once the transmitter is done, called from the
+ * transmit interrupt. While bytes are left the interrupt waits for room in
+ * the FIFO, after the last one for TRMT so the stop bit is never cut short.
+ * @param handle Handle to the uart instance.
+ */
+static void uartHdxService(drv_uartHandle_t handle)
+{
+    uartRegs_t *regs = UART_REGS(handle);
+    const uint8_t *data;
+    uint8_t lane;
+
+    if (uartTxBlock(handle, &lane, &data)) {
+        SFR_WRITE(&regs->sta.clr, 3 << U_UTXISEL0);
+        return;
+    }
+    if (!(SFR_READ(&regs->sta.reg) & (1 << U_TRMT))) {
+        SFR_WRITE(&regs->sta.clr, 2 << U_UTXISEL0);
+        SFR_WRITE(&regs->sta.set, 1 << U_UTXISEL0);
+        return;
+    }
+    uartTxIntDisable(handle);
+    SFR_WRITE(&regs->sta.clr, 3 << U_UTXISEL0);
+    if (handle->dirLat)
+        SFR_WRITE(&((uartSfr_t *)handle->dirLat)->clr, handle->dirMask);
+    handle->hdxTx = false;
+}
+
+/**
+ * Copy segments into the transmit ring back to back and start the transmit
+ * interrupt or DMA once they are in, so they leave as one transmission.
+ * @param handle Handle to the uart instance.
+ * @param iov   Segments to queue.
+ * @param count Number of segments.
+ * @param skip  Bytes at the start of the segments that were already queued.
+ * @param block Sleep until the ISR makes room if the ring is full.
+ * @return Number of bytes queued by this call.
+ */
+static uint32_t uartTxQueue(drv_uartHandle_t handle, const drv_uartIovec_t *iov,
+        uint8_t count, uint32_t skip, bool block)
+{
+    uint32_t queued = 0, done;
+    uint32_t stamp = _CP0_GET_COUNT();
+    uint8_t i;
+    bool full;
+
+    // The transmit interrupt fills the ring for a pending asynchronous write,
+    // the ring takes one producer at a time
+    taskENTER_CRITICAL();
+    while (handle->txAsync.data && block) {
+        handle->txWaiter = xTaskGetCurrentTaskHandle();
+        taskEXIT_CRITICAL();
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        taskENTER_CRITICAL();
+    }
+    full = handle->txAsync.data != NULL;
+    handle->txQueuing = !full;
+    taskEXIT_CRITICAL();
+    if (full)
+        return 0;
+    for (i = 0; i < count; i++) {
+        if (skip >= iov[i].len) {
+            skip -= iov[i].len;
+            continue;
+        }
+        done = skip;
+        while (true) {
+            done += uartRingWrite(&handle->tx, iov[i].data + done,
+                    iov[i].len - done);
+            UART_STAT_MAX(handle, txHighWater, uartRingCount(&handle->tx));
+            if (done == iov[i].len || !block)
+                break;
+            taskENTER_CRITICAL();
+            full = uartRingFree(&handle->tx) == 0;
+            if (full)
+                handle->txWaiter = xTaskGetCurrentTaskHandle();
+            uartTxStart(handle);
+            taskEXIT_CRITICAL();
+            if (full)
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+        queued += done - skip;
+        skip = 0;
+        if (done < iov[i].len)
+            break;
+    }
+    // Urgent frames may go in behind what this call queued, a caller may
+    // abandon the rest of a non-blocking write
+    if (handle->txUrgent.buf && queued) {
+        taskENTER_CRITICAL();
+        uartTxEndPush(handle, UART_LANE_BULK, stamp);
+        taskEXIT_CRITICAL();
+    }
+    handle->txQueuing = false;
+    if (queued)
+        uartTxStart(handle);
+    return queued;
+}
+
+/**
+ * Write segments straight into the hardware FIFO, without a transmit ring.
+ * @param handle Handle to the uart instance.
+ * @param iov   Segments to write.
+ * @param count Number of segments.
+ * @param skip  Bytes at the start of the segments that were already written.
+ * @param block Spin while the FIFO is full.
+ * @return Number of bytes written by this call.
+ */
+static uint32_t uartTxFifo(drv_uartHandle_t handle, const drv_uartIovec_t *iov,
+        uint8_t count, uint32_t skip, bool block)
+{
+    uint32_t written = 0, j;
+    uint8_t i;
+    bool full = false;
+
+    for (i = 0; i < count && !full; i++) {
+        for (j = skip; j < iov[i].len; j++) {
+            while ((full = uartTxFull(handle) || uartTxPaused(handle)) &&
+                    block);
+            if (full)
+                break;
+            if (handle->halfDuplex) {
+                // The turnaround in the interrupt must not run in between
+                taskENTER_CRITICAL();
+                uartHdxTransmit(handle);
+                uartTxWrite(handle, iov[i].data[j]);
+                taskEXIT_CRITICAL();
+            } else {
+                uartTxWrite(handle, iov[i].data[j]);
+            }
+            written++;
+        }
+        skip = skip > iov[i].len ? skip - iov[i].len : 0;
+    }
+    // The transmit interrupt hands the line back after the last byte
+    if (written && handle->halfDuplex)
+        uartTxIntEnable(handle);
+    return written;
+}
+
+/**
+ * Send segments through the transmit ring or straight to the FIFO.
+ * @param handle Handle to the uart instance.
+ * @param iov   Segments to send.
+ * @param count Number of segments.
+ * @param skip  Bytes at the start of the segments that were already accepted.
+ * @param block Wait for room instead of returning early.
+ * @return Number of bytes accepted by this call.
+ */
+static uint32_t uartTxSend(drv_uartHandle_t handle, const drv_uartIovec_t *iov,
+        uint8_t count, uint32_t skip, bool block)
+{
+    if (handle->tx.buf)
+        return uartTxQueue(handle, iov, count, skip, block);
+    return uartTxFifo(handle, iov, count, skip, block);
+}
+
+/**
+ * Queue XON or XOFF ahead of the transmit ring, the transmit interrupt sends
+ * it as soon as the FIFO has room. A pending one is replaced, so a pause that
+ * never left is cancelled by the resume. Called from the receive interrupt or
+ * with interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param data  UART_XON or UART_XOFF.
+ */
+static inline void uartFlowSend(drv_uartHandle_t handle, uint8_t data)
+{
+    handle->flowChar = data;
+    uartTxIntEnable(handle);
+}
+
+/**
+ * Stop the peer once the receive ring reached the high watermark. Called from
+ * the receive interrupt.
+ * @param handle Handle to the uart instance.
+ */
+static void uartFlowPause(drv_uartHandle_t handle)
+{
+    handle->rxPaused = true;
+    UART_STAT_ADD(handle, flowPauses, 1);
+    if (handle->flow == UART_FLOW_RTS_CTS)
+        uartRxIntDisable(handle);
+    else
+        uartFlowSend(handle, UART_XOFF);
+}
+
+/**
+ * Let the peer send again, called with interrupts masked.
+ * @param handle Handle to the uart instance.
+ */
+static void uartFlowResume(drv_uartHandle_t handle)
+{
+    const uartPort_t *port = UART_PORT(handle);
+
+    handle->rxPaused = false;
+    if (handle->flow == UART_FLOW_RTS_CTS) {
+        uartRxIntEnable(handle);
+        // The FIFO filled up while the interrupt was off
+        if (uartRxAvailable(handle))
+            SFR_WRITE(&UART_IFS(port->rxReg)->set, port->rxMask);
+    } else {
+        uartFlowSend(handle, UART_XON);
+    }
+}
+
+/**
+ * Resume a paused peer once the reading task brought the receive ring down to
+ * the low watermark.
+ * @param handle Handle to the uart instance.
+ */
+static void uartRxFlow(drv_uartHandle_t handle)
+{
+    if (!handle->rxPaused)
+        return;
+    taskENTER_CRITICAL();
+    if (handle->rxPaused && uartRingCount(&handle->rx) <= handle->rxLow)
+        uartFlowResume(handle);
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * Take XON and XOFF out of the received bytes and pause or resume
+ * transmitting accordingly, called from the receive interrupt.
+ * Corrupted bytes are kept as data.
+ * @param handle Handle to the uart instance.
+ * @param data  Received bytes, filtered in place.
+ * @param len   Number of received bytes.
+ * @param errors Line error bits of the bytes, filtered along.
+ * @return Number of bytes left.
+ */
+static uint8_t uartFlowFilter(drv_uartHandle_t handle, uint8_t *data,
+        uint8_t len, uint8_t *errors)
+{
+    uint8_t i, kept = 0, bad = 0;
+
+    for (i = 0; i < len; i++) {
+        if (*errors & (1 << i)) {
+            bad |= 1 << kept;
+            data[kept++] = data[i];
+        } else if (data[i] == UART_XOFF) {
+            handle->txPaused = true;
+        } else if (data[i] == UART_XON) {
+            handle->txPaused = false;
+        } else {
+            data[kept++] = data[i];
+        }
+    }
+    *errors = bad;
+    if (kept != len && !handle->txPaused &&
+            (uartRingCount(&handle->tx) || uartRingCount(&handle->txUrgent)))
+        uartTxIntEnable(handle);
+    return kept;
+}
+
+/**
+ * Wake a task sleeping on the driver, from an interrupt or from a task with
+ * interrupts masked. A task calls this with hasWoken NULL, the waiter is then
+ * always another task.
+ * @param waiter    Task sleeping on a queue or in drv_uartWaitAny, cleared.
+ * @param hasWoken  Set if the task was woken, NULL when called by a task.
+ */
+static void uartWake(TaskHandle_t *waiter, BaseType_t *hasWoken)
+{
+    if (!*waiter)
+        return;
+    if (hasWoken)
+        vTaskNotifyGiveFromISR(*waiter, hasWoken);
+    else
+        xTaskNotifyGive(*waiter);
+    *waiter = NULL;
+}
+
+/**
+ * Complete an asynchronous request, called from an interrupt or with
+ * interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param async The request.
+ * @param event UART_EVENT_READ or UART_EVENT_WRITE.
+ * @param hasWoken Set if drv_uartWaitAny was woken, NULL when called by a task.
+ */
+static void uartAsyncDone(drv_uartHandle_t handle, uartAsync_t *async,
+        uint8_t event, BaseType_t *hasWoken)
+{
+    drv_uartAsyncHandler_t onDone = async->onDone;
+
+    async->data = NULL;
+    handle->events |= event;
+    uartWake(&handle->eventWaiter, hasWoken);
+    if (onDone)
+        onDone(async->context, async->done);
+}
+
+/**
+ * Refill the transmit ring from a pending asynchronous write, called from the
+ * transmit or DMA interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param hasWoken Set if drv_uartWaitAny was woken, NULL when called by a task.
+ */
+static void uartTxAsync(drv_uartHandle_t handle, BaseType_t *hasWoken)
+{
+    uartAsync_t *async = &handle->txAsync;
+
+    if (!async->data)
+        return;
+    async->done += uartRingWrite(&handle->tx, async->data + async->done,
+            async->len - async->done);
+    UART_STAT_MAX(handle, txHighWater, uartRingCount(&handle->tx));
+    if (async->done < async->len)
+        return;
+    if (handle->txUrgent.buf)
+        uartTxEndPush(handle, UART_LANE_BULK, async->stamp);
+    uartAsyncDone(handle, async, UART_EVENT_WRITE, hasWoken);
+}
+
+/**
+ * Move buffered bytes into a pending asynchronous read, called from the
+ * receive, DMA or idle timer interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param idle  The line is idle, fewer bytes complete the read.
+ * @param hasWoken Set if drv_uartWaitAny was woken, NULL when called by a task.
+ */
+static void uartRxAsync(drv_uartHandle_t handle, bool idle,
+        BaseType_t *hasWoken)
+{
+    uartAsync_t *async = &handle->rxAsync;
+
+    if (!async->data)
+        return;
+    async->done += uartRingRead(&handle->rx, async->data + async->done,
+            async->len - async->done);
+    if (async->done == async->len || (idle && async->done))
+        uartAsyncDone(handle, async, UART_EVENT_READ, hasWoken);
+}
+
+/**
+ * Move bytes from the transmit ring into the hardware FIFO, called from the
+ * transmit interrupt.
+ * @param handle Handle to the uart instance.
+ * @param hasWoken Set if a task waiting for room was woken.
+ */
+static void uartTxService(drv_uartHandle_t handle, BaseType_t *hasWoken)
+{
+    const uint8_t *data;
+    uint32_t len, i;
+    uint8_t lane;
+
+    if (handle->flowChar && !uartTxFull(handle)) {
+        uartTxWrite(handle, handle->flowChar);
+        handle->flowChar = 0;
+    }
+    if (handle->halfDuplex && uartTxBlock(handle, &lane, &data))
+        uartHdxTransmit(handle);
+    while (!handle->txPaused && !uartTxFull(handle)) {
+        len = uartTxBlock(handle, &lane, &data);
+        if (!len)
+            break;
+        for (i = 0; i < len && !uartTxFull(handle); i++)
+            uartTxWrite(handle, data[i]);
+        uartRingSkip(uartTxRing(handle, lane), i);
+        if (lane == UART_LANE_URGENT)
+            uartTxEndPop(handle, lane);
+    }
+    uartTxAsync(handle, hasWoken);
+    if (handle->halfDuplex) {
+        uartHdxService(handle);
+    } else if (handle->flowChar) {
+        // Keep the interrupt until XON or XOFF is out
+    } else if (handle->txPaused || !uartTxBlock(handle, &lane, &data)) {
+        // Urgent frames behind a bulk write still being queued wait too
+        uartTxIntDisable(handle);
+        // A task may have queued more after the check above
+        if (!handle->txPaused && uartTxBlock(handle, &lane, &data))
+            uartTxIntEnable(handle);
+    }
+    uartTxWake(handle, hasWoken);
+}
+
+/**
+ * Get the bytes in front of each queued frame, its length and with
+ * timestamps the core timer count when it completed.
+ * @param handle Handle to the uart instance.
+ */
+static inline uint8_t uartFrameHead(drv_uartHandle_t handle)
+{
+    return handle->stamps ? 1 + sizeof (uint32_t) : 1;
+}
+
+/**
+ * Queue a complete frame behind its length and timestamp. Called from the
+ * receive interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param frames Queue with room for the frame.
+ * @param frame Decoder holding the frame.
+ */
+static void uartFrameQueue(drv_uartHandle_t handle, uartRing_t *frames,
+        const uartFrame_t *frame)
+{
+    uint8_t size = frame->len;
+
+    uartRingWrite(frames, &size, 1);
+    if (handle->stamps)
+        uartRingWrite(frames, (const uint8_t *)&handle->rxStamp,
+                sizeof (handle->rxStamp));
+    uartRingWrite(frames, frame->buf, size);
+}
+
+/**
+ * Deliver a complete frame to the first route that matches it. Called from
+ * the receive interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param frame Decoder holding the frame.
+ * @param hasWoken Set if the reader of the route was woken, NULL when called
+ *                 by a task.
+ * @return False if no route took the frame.
+ */
+static bool uartRouteFrame(drv_uartHandle_t handle, const uartFrame_t *frame,
+        BaseType_t *hasWoken)
+{
+    drv_uartRoute_t *route;
+    uint32_t size = frame->len + uartFrameHead(handle);
+    uint8_t len;
+
+    for (route = handle->routes; route; route = route->next) {
+        if (frame->len > route->offset &&
+                (frame->buf[route->offset] & route->mask) == route->value)
+            break;
+    }
+    if (!route)
+        return false;
+    if (route->policy == UART_ROUTE_DROP_OLDEST) {
+        // Readers take frames with interrupts masked, moving the tail is safe
+        while (uartRingFree(&route->frames) < size) {
+            len = route->frames.buf[route->frames.tail & route->frames.mask];
+            uartRingSkip(&route->frames, len + uartFrameHead(handle));
+            route->dropped++;
+        }
+    }
+    if (uartRingFree(&route->frames) < size) {
+        if (route->policy == UART_ROUTE_PASS)
+            return false;
+        route->dropped++;
+        return true;
+    }
+    uartFrameQueue(handle, &route->frames, frame);
+    uartWake(&route->waiter, hasWoken);
+    return true;
+}
+
+/**
+ * Decode received bytes and hand every complete frame to its route, the
+ * receive callback or the frame queue. Frames that do not fit the queue are
+ * dropped.
+ * @param handle Handle to the uart instance.
+ * @param data  Received bytes.
+ * @param len   Number of received bytes.
+ * @param hasWoken Set if a task waiting for a frame was woken, NULL when
+ *                 called by the reading task itself.
+ */
+static void uartRxFrames(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len, BaseType_t *hasWoken)
+{
+    uartFrame_t *frame = &handle->frame;
+    uint32_t used;
+    bool complete;
+
+    while (len) {
+        used = uartFrameFeed(frame, data, len, &complete);
+        data += used;
+        len -= used;
+        if (!complete || uartRouteFrame(handle, frame, hasWoken))
+            continue;
+        if (handle->onReceive) {
+            handle->onReceive(frame->buf, frame->len);
+            continue;
+        }
+        if (uartRingFree(&handle->frames) <
+                frame->len + uartFrameHead(handle)) {
+            frame->dropped++;
+            continue;
+        }
+        uartFrameQueue(handle, &handle->frames, frame);
+        uartWake(&handle->rxWaiter, hasWoken);
+    }
+}
+
+/**
+ * Check if the task sleeping on the receive ring can continue.
+ * @param handle Handle to the uart instance.
+ * @return True if the ring holds the bytes the reader waits for.
+ */
+static inline bool uartRxReady(drv_uartHandle_t handle)
+{
+    uint32_t want = handle->rxWant ? handle->rxWant : handle->rxTrigger;
+
+    // The peer stops at the high watermark, more than that never arrives
+    if (handle->flow && want > handle->rxHigh)
+        want = handle->rxHigh;
+    return uartRingCount(&handle->rx) >= want;
+}
+
+/**
+ * Let every character raise the receive interrupt once the bytes a sleeping
+ * reader still needs, echoes included, would stay below the FIFO level.
+ * Idle detection flushes them otherwise. Called from the receive interrupt
+ * or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ */
+static inline void uartRxLevel(drv_uartHandle_t handle)
+{
+    uint32_t count = uartRingCount(&handle->rx);
+
+    if (handle->rxWant > count && !handle->rxDma && !handle->idleTimer &&
+            handle->rxWant - count + handle->echoSkip <
+            uartFifoLevels[handle->rxFifoSize])
+        uartRxThreshold(handle, FIFO_CHAR);
+}
+
+/**
+ * Average the gap between received bytes and move the adaptive receive
+ * interrupt level a tier towards it, called from the receive and idle timer
+ * interrupts.
+ * @param handle Handle to the uart instance.
+ * @param len   Bytes the interrupt read from the FIFO.
+ */
+static void uartRxAdapt(drv_uartHandle_t handle, uint32_t len)
+{
+    uint32_t now = _CP0_GET_COUNT();
+    // Core timer ticks of len characters in 1/16
+    uint32_t span = (UART_CORE_TICKS(len * UART_CHAR_BITS *
+            handle->bitClocks) / 16) | 1;
+    uint32_t elapsed = now - handle->rxLastIsr;
+    uint32_t gap = UART_RX_QUIET;
+    uint8_t tier = handle->rxTier;
+
+    // Error interrupts without data say nothing about the rate
+    if (!len)
+        return;
+    handle->rxLastIsr = now;
+    if (elapsed / span < gap)
+        gap = elapsed / span;
+    handle->rxRate = (3 * handle->rxRate + gap) / 4;
+    if (handle->rxRate < uartTierUp[tier])
+        tier++;
+    else if (handle->rxRate > uartTierDown[tier])
+        tier--;
+    if (tier == handle->rxTier)
+        return;
+    if (tier > handle->rxTier)
+        UART_STAT_ADD(handle, rxLevelRaises, 1);
+    else
+        UART_STAT_ADD(handle, rxLevelDrops, 1);
+    handle->rxTier = tier;
+    handle->rxFifoSize = uartFifoTiers[tier];
+    // An idle line waits for the first character, the level applies after it
+    if (!handle->idleTimer || handle->rxActive)
+        uartRxThreshold(handle, handle->rxFifoSize);
+}
+
+/**
+ * Set or clear the line status bits of bytes just stored in the receive ring,
+ * called from the receive interrupt.
+ * @param handle Handle to the uart instance.
+ * @param head  Ring index of the first byte.
+ * @param len   Number of bytes.
+ * @param errors A bit per byte with a line error.
+ */
+static void uartRxMark(drv_uartHandle_t handle, uint32_t head, uint32_t len,
+        uint8_t errors)
+{
+    uint32_t i, pos;
+
+    for (i = 0; i < len; i++, errors >>= 1) {
+        pos = (head + i) & handle->rx.mask;
+        if (errors & 1)
+            handle->rxStatus[pos >> 3] |= 1 << (pos & 7);
+        else
+            handle->rxStatus[pos >> 3] &= ~(1 << (pos & 7));
+    }
+}
+
+/**
+ * Forget the batch marks of bytes already read, only the oldest batch still
+ * in the receive ring is kept. Called from the receive interrupt or with
+ * interrupts masked.
+ * @param handle Handle to the uart instance.
+ */
+static void uartRxStampTrim(drv_uartHandle_t handle)
+{
+    uartRxStamps_t *marks = &handle->rxStamps;
+    uint8_t next;
+
+    while ((uint8_t)(marks->head - marks->tail) > 1) {
+        next = (marks->tail + 1) & (UART_RX_STAMPS - 1);
+        if ((int32_t)(marks->start[next] - handle->rx.tail) > 0)
+            break;
+        marks->tail++;
+    }
+}
+
+/**
+ * Mark where the bytes of this receive interrupt start in the receive ring,
+ * called from the receive interrupt. With every mark in use the bytes join
+ * the batch before them.
+ * @param handle Handle to the uart instance.
+ * @param head  Ring index of the first byte.
+ * @param empty The ring held no bytes before these.
+ */
+static void uartRxStampPush(drv_uartHandle_t handle, uint32_t head, bool empty)
+{
+    uartRxStamps_t *marks = &handle->rxStamps;
+    uint8_t i;
+
+    if (empty)
+        marks->tail = marks->head;
+    else
+        uartRxStampTrim(handle);
+    if ((uint8_t)(marks->head - marks->tail) >= UART_RX_STAMPS)
+        return;
+    i = marks->head & (UART_RX_STAMPS - 1);
+    marks->start[i] = head;
+    marks->stamp[i] = handle->rxStamp;
+    marks->head++;
+}
+
+/**
+ * Store the bytes drained from the receive FIFO in one go, called from the
+ * receive interrupt. A waiting task is notified once per interrupt and only
+ * when the trigger level or the length it reads is reached.
+ * @param handle Handle to the uart instance.
+ * @param data  Bytes read from the FIFO.
+ * @param len   Number of bytes read.
+ * @param errors A bit per byte read with a parity or framing error.
+ * @param hasWoken Set if the waiting task was woken.
+ */
+static void uartRxService(drv_uartHandle_t handle, uint8_t *data, uint8_t len,
+        uint8_t errors, BaseType_t *hasWoken)
+{
+    uint32_t stored, echo, head, i, start = 0;
+    bool empty;
+
+    // On a half-duplex line the first bytes are our own
+    if (handle->echoSkip) {
+        echo = len < handle->echoSkip ? len : handle->echoSkip;
+        handle->echoSkip -= echo;
+        data += echo;
+        len -= echo;
+        errors >>= echo;
+    }
+    if (!handle->lineStatus)
+        errors = 0;
+    if (handle->flow == UART_FLOW_XON_XOFF)
+        len = uartFlowFilter(handle, data, len, &errors);
+    if (handle->lineStatus && handle->rxGap && len) {
+        errors |= 1;
+        handle->rxGap = false;
+    }
+    UART_STAT_ADD(handle, rxBytes, len);
+    if (handle->frame.mode != UART_FRAME_NONE) {
+        // A bad byte takes its whole frame with it
+        for (i = 0; errors; i++, errors >>= 1) {
+            if (!(errors & 1))
+                continue;
+            uartRxFrames(handle, data + start, i - start, hasWoken);
+            uartFrameDiscard(&handle->frame);
+            start = i + 1;
+        }
+        uartRxFrames(handle, data + start, len - start, hasWoken);
+        return;
+    }
+    head = handle->rx.head;
+    empty = !uartRingCount(&handle->rx);
+    stored = uartRingWrite(&handle->rx, data, len);
+    if (handle->rxStatus)
+        uartRxMark(handle, head, stored, errors);
+    if (handle->stamps && stored)
+        uartRxStampPush(handle, head, empty);
+    if (stored < len)
+        handle->rxGap = true;
+    UART_STAT_ADD(handle, rxDropped, len - stored);
+    UART_STAT_MAX(handle, rxHighWater, uartRingCount(&handle->rx));
+    uartRxAsync(handle, false, hasWoken);
+    if (handle->flow && !handle->rxPaused &&
+            uartRingCount(&handle->rx) >= handle->rxHigh)
+        uartFlowPause(handle);
+    if (handle->rxWaiter && uartRxReady(handle)) {
+        vTaskNotifyGiveFromISR(handle->rxWaiter, hasWoken);
+        handle->rxWaiter = NULL;
+    } else if (handle->rxWaiter) {
+        uartRxLevel(handle);
+    }
+    if (handle->onReceive)
+        handle->onReceive(data, len);
+}
+
+/**
+ * Advance the head of the receive ring to the byte the DMA channel writes
+ * next. Called from the DMA interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ */
+static void uartRxDmaSync(drv_uartHandle_t handle)
+{
+    uint32_t offset = SFR_READ(&handle->rxDma->dptr.reg);
+    uint32_t len = (offset - handle->rx.head) & handle->rx.mask;
+
+    handle->rx.head += len;
+    UART_STAT_ADD(handle, rxBytes, len);
+    UART_STAT_MAX(handle, rxHighWater, uartRingCount(&handle->rx));
+}
+
+/**
+ * Decode everything the receive DMA channel wrote into the ring, the decoder
+ * is the only reader of the ring when framing is used. Called from the DMA
+ * interrupt or with interrupts masked.
+ * @param handle Handle to the uart instance.
+ * @param hasWoken Set if a task waiting for a frame was woken.
+ */
+static void uartRxDmaFrames(drv_uartHandle_t handle, BaseType_t *hasWoken)
+{
+    const uint8_t *data[2];
+    uint32_t len[2];
+    uint32_t total;
+
+    if (uartRingCount(&handle->rx) > handle->rx.mask + 1) {
+        // Lapped by the channel, the frame in progress is lost
+        UART_STAT_ADD(handle, rxDropped,
+                uartRingCount(&handle->rx) - (handle->rx.mask + 1));
+        handle->rx.tail = handle->rx.head - (handle->rx.mask + 1);
+        uartFrameReset(&handle->frame);
+        handle->frame.dropped++;
+    }
+    total = uartRingSpans(&handle->rx, data, len);
+    uartRxFrames(handle, data[0], len[0], hasWoken);
+    uartRxFrames(handle, data[1], len[1], hasWoken);
+    uartRingSkip(&handle->rx, total);
+}
+
+/**
+ * Pick up bytes the receive DMA channel wrote since the last interrupt, called
+ * by the reading task before it looks at the receive ring.
+ * @param handle Handle to the uart instance.
+ */
+static void uartRxPoll(drv_uartHandle_t handle)
+{
+    const uartPort_t *port = UART_PORT(handle);
+
+    if (!handle->rxDma) {
+        // Without idle detection the end of a burst waits below the adaptive
+        // level, a reader finding nothing has the interrupt read it
+        if (handle->rxTier && !handle->idleTimer &&
+                !uartRingCount(&handle->rx) &&
+                (SFR_READ(&port->regs->sta.reg) & (1 << U_URXDA)))
+            SFR_WRITE(&UART_IFS(port->rxReg)->set, port->rxMask);
+        return;
+    }
+    taskENTER_CRITICAL();
+    uartRxDmaSync(handle);
+    if (handle->frames.buf)
+        uartRxDmaFrames(handle, NULL);
+    // The channel overwrites unread bytes if the reader falls a lap behind
+    if (uartRingCount(&handle->rx) > handle->rx.mask + 1) {
+        UART_STAT_ADD(handle, rxDropped,
+                uartRingCount(&handle->rx) - (handle->rx.mask + 1));
+        handle->rx.tail = handle->rx.head - (handle->rx.mask + 1);
+    }
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * Hand the bytes the receive DMA channel wrote to waiting tasks and the
+ * receive callback, called from the DMA interrupt or when the line went idle.
+ * @param handle Handle to the uart instance.
+ * @param idle  The line went idle, wake the task below the trigger level.
+ * @param hasWoken Set if the waiting task was woken.
+ */
+static void uartRxDmaService(drv_uartHandle_t handle, bool idle,
+        BaseType_t *hasWoken)
+{
+    uint32_t head = handle->rx.head;
+    uint32_t offset = head & handle->rx.mask;
+    uint32_t len, first;
+
+    uartRxDmaSync(handle);
+    if (handle->frame.mode != UART_FRAME_NONE) {
+        uartRxDmaFrames(handle, hasWoken);
+        return;
+    }
+    uartRxAsync(handle, idle, hasWoken);
+    if (handle->rxWaiter && (uartRxReady(handle) ||
+            (idle && uartRingCount(&handle->rx)))) {
+        vTaskNotifyGiveFromISR(handle->rxWaiter, hasWoken);
+        handle->rxWaiter = NULL;
+    }
+    if (!handle->onReceive)
+        return;
+    len = handle->rx.head - head;
+    first = handle->rx.mask + 1 - offset;
+    if (first > len)
+        first = len;
+    if (first)
+        handle->onReceive(handle->rx.buf + offset, first);
+    if (len > first)
+        handle->onReceive(handle->rx.buf, len - first);
+}
+
+/**
+ * Finish a transmit DMA transfer and start the next block, called from the
+ * DMA interrupt.
+ * @param handle Handle to the uart instance.
+ * @param hasWoken Set if a task waiting for room was woken.
+ */
+static void uartTxDmaService(drv_uartHandle_t handle, BaseType_t *hasWoken)
+{
+    uartRingSkip(uartTxRing(handle, handle->txDmaLane), handle->txDmaLen);
+    UART_STAT_ADD(handle, txBytes, handle->txDmaLen);
+    if (handle->txDmaLane == UART_LANE_URGENT)
+        uartTxEndPop(handle, UART_LANE_URGENT);
+    uartTxAsync(handle, hasWoken);
+    uartTxDmaNext(handle);
+    uartTxWake(handle, hasWoken);
+}
+
+static void uartDmaService(uint8_t channel)
+{
+    drv_uartHandle_t handle = dmaOwners[channel];
+    uartDmaRegs_t *dma = uartDmaRegs(channel);
+    BaseType_t hasWoken = pdFALSE;
+    UART_ISR_BEGIN();
+
+    SFR_WRITE(&dma->intr.clr, DMA_FLAGS);
+    IFS1CLR = _IFS1_DMA0IF_MASK << channel;
+    if (handle && dma == handle->rxDma)
+        uartRxDmaService(handle, false, &hasWoken);
+    else if (handle && dma == handle->txDma)
+        uartTxDmaService(handle, &hasWoken);
+    UART_ISR_END(handle);
+    portYIELD_FROM_ISR(hasWoken);
+}
+
+void __ISR(_DMA_0_VECTOR, UART_IPL(DRV_UART_IPL)) dma0Handler(void)
+{
+    uartDmaService(0);
+}
+
+void __ISR(_DMA_1_VECTOR, UART_IPL(DRV_UART_IPL)) dma1Handler(void)
+{
+    uartDmaService(1);
+}
+
+void __ISR(_DMA_2_VECTOR, UART_IPL(DRV_UART_IPL)) dma2Handler(void)
+{
+    uartDmaService(2);
+}
+
+void __ISR(_DMA_3_VECTOR, UART_IPL(DRV_UART_IPL)) dma3Handler(void)
+{
+    uartDmaService(3);
+}
+
+void __ISR(_DMA_4_VECTOR, UART_IPL(DRV_UART_IPL)) dma4Handler(void)
+{
+    uartDmaService(4);
+}
+
+void __ISR(_DMA_5_VECTOR, UART_IPL(DRV_UART_IPL)) dma5Handler(void)
+{
+    uartDmaService(5);
+}
+
+void __ISR(_DMA_6_VECTOR, UART_IPL(DRV_UART_IPL)) dma6Handler(void)
+{
+    uartDmaService(6);
+}
+
+void __ISR(_DMA_7_VECTOR, UART_IPL(DRV_UART_IPL)) dma7Handler(void)
+{
+    uartDmaService(7);
+}
+
+/**
+ * Get the registers of a timer used for idle detection
+ * @param timer Timer 2 - 5.
+ */
+static uartTimerRegs_t *uartTimerRegs(uint8_t timer)
+{
+    switch (timer) {
+        case 2:
+            return (uartTimerRegs_t *)_TMR2_BASE_ADDRESS;
+        case 3:
+            return (uartTimerRegs_t *)_TMR3_BASE_ADDRESS;
+        case 4:
+            return (uartTimerRegs_t *)_TMR4_BASE_ADDRESS;
+        default:
+            return (uartTimerRegs_t *)_TMR5_BASE_ADDRESS;
+    }
+}
+
+/**
+ * Set the idle timer period to the configured number of character times at
+ * the current baudrate, with the smallest prescaler the period fits in.
+ * @param handle Handle to the uart instance.
+ */
+static void uartIdleSetPeriod(drv_uartHandle_t handle)
+{
+    uartTimerRegs_t *timer = uartTimerRegs(handle->idleTimer);
+    uint32_t clocks = handle->idleChars * UART_CHAR_BITS * handle->bitClocks;
+    uint32_t tckps = 0;
+    uint32_t shift = 0;
+
+    // Prescalers are 1, 2, 4 ... 64 and 256
+    while (tckps < 7 && (clocks >> shift) > UART_TIMER_MAX + 1) {
+        tckps++;
+        shift = tckps == 7 ? 8 : tckps;
+    }
+    clocks >>= shift;
+    if (clocks > UART_TIMER_MAX + 1)
+        clocks = UART_TIMER_MAX + 1;
+    SFR_WRITE(&timer->con.clr, _T2CON_TCKPS_MASK);
+    SFR_WRITE(&timer->con.set, tckps << _T2CON_TCKPS_POSITION);
+    SFR_WRITE(&timer->pr.reg, clocks ? clocks - 1 : 0);
+}
+
+static void uartIdleStart(drv_uartHandle_t handle)
+{
+    uartTimerRegs_t *timer = uartTimerRegs(handle->idleTimer);
 
-/**
- * Local function to calculate the baudrate according to the datasheet
- * @param baud  Desired baudrate, see BAUDRATE enum
- * @param highSpeed Enable high speed mode
- * @return      int value to configure UxBRG with
- * @see CPUCLK
- */
-static uint16_t calculateBaud(uartBaudRates_t baud, bool highSpeed)
+    SFR_WRITE(&timer->tmr.reg, 0);
+    SFR_WRITE(&timer->con.set, _T2CON_ON_MASK);
+    // A match from before the restart must not end the new period
+    IFS0CLR = _IFS0_T2IF_MASK << (4 * (handle->idleTimer - 2));
+}
+
+static void uartIdleStop(drv_uartHandle_t handle)
 {
-    if (highSpeed) {
-        return (SYS_CLK_FREQ / (4 * baud)) - 1;
-    } else {
-        return (SYS_CLK_FREQ / (16 * baud)) - 1;
-    }
+    uartTimerRegs_t *timer = uartTimerRegs(handle->idleTimer);
+
+    SFR_WRITE(&timer->con.clr, _T2CON_ON_MASK);
+    IFS0CLR = _IFS0_T2IF_MASK << (4 * (handle->idleTimer - 2));
 }
 
 /**
- * Function to enable interrupts for a uart device
+ * Claim a timer to flush received bytes after the line has been idle. Both
+ * vectors are built with DRV_UART_IPL and uartInit holds intPriority to it,
+ * so the timer and the uart interrupt never preempt each other.
  * @param handle    Handle to the uart instance.
+ * @param timer     Timer 2 - 5.
+ * @param chars     Character times of silence.
  * @param priority  Interrupt priority
  */
-static void uartEnableInt(drv_uartHandle_t handle, uint8_t priority)
+static void uartIdleInit(drv_uartHandle_t handle, uint8_t timer, uint8_t chars,
+        uint8_t priority)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            IFS0CLR = IFS0_U1E_BIT;
-            IPC6SET = (priority << 2) | (3);
-            IEC0SET = IEC0_U1E_BIT;
+    uint32_t mask = _IFS0_T2IF_MASK << (4 * (timer - 2));
+
+    handle->idleTimer = timer;
+    handle->idleChars = chars;
+    timerOwners[timer - 2] = handle;
+    SFR_WRITE(&uartTimerRegs(timer)->con.reg, 0);
+    uartIdleSetPeriod(handle);
+    IFS0CLR = mask;
+    switch (timer) {
+        case 2:
+            IPC2CLR = 0x1F;
+            IPC2SET = (priority << 2) | 3;
             break;
-        case UART_DEV2:
-            IFS1CLR = IFS1_U2RX_BIT;
-            IPC8SET = (priority << 2) | (3);
-            IEC1SET = IEC1_U2E_BIT;
+        case 3:
+            IPC3CLR = 0x1F;
+            IPC3SET = (priority << 2) | 3;
+            break;
+        case 4:
+            IPC4CLR = 0x1F;
+            IPC4SET = (priority << 2) | 3;
+            break;
+        case 5:
+            IPC5CLR = 0x1F;
+            IPC5SET = (priority << 2) | 3;
             break;
     }
+    IEC0SET = mask;
+    // The first character of a burst starts the timer
+    if (!handle->rxDma)
+        uartRxThreshold(handle, FIFO_CHAR);
 }
 
 /**
- * Set flags in the mode register for a uart device
+ * Note received bytes for idle detection, called from the receive interrupt.
+ * The first character of a burst starts the timer. In interrupt mode it also
+ * raises the FIFO level back to the configured one, in DMA mode the receive
+ * interrupt is masked until the line is idle again.
  * @param handle Handle to the uart instance.
- * @param flags Flags to set in the register.
  */
-static void uartModeSetFlags(drv_uartHandle_t handle, uint32_t flags)
+static void uartRxActivity(drv_uartHandle_t handle)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            U1MODESET = flags;
-            break;
-        case UART_DEV2:
-            U2MODESET = flags;
-            break;
+    handle->rxSeen = true;
+    if (handle->rxActive)
+        return;
+    if (handle->rxDma) {
+        uartRxIntDisable(handle);
+        handle->rxDmaMark = SFR_READ(&handle->rxDma->dptr.reg);
+    } else {
+        uartRxThreshold(handle, handle->rxFifoSize);
     }
+    handle->rxActive = true;
+    uartIdleStart(handle);
 }
 
 /**
- * Clear flags in the mode register for a uart device
- * @param handle Handle to the uart instance.
- * @param flags Flags to clear in the register.
+ * Check for received bytes once per timer period, called from the timer
+ * interrupt. Bytes below the FIFO level are read out, a period in which
+ * nothing arrived ends the burst and wakes waiting tasks even below their
+ * trigger level. The silence is therefore detected between one and two
+ * periods after the last character.
+ * @param timer Timer 2 - 5.
  */
-static void uartModeClrFlags(drv_uartHandle_t handle, uint32_t flags)
+static void uartIdleService(uint8_t timer)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            U1MODECLR = flags;
-            break;
-        case UART_DEV2:
-            U2MODECLR = flags;
-            break;
+    drv_uartHandle_t handle = timerOwners[timer - 2];
+    uint8_t uartBuf[UART_FIFO_DEPTH];
+    BaseType_t hasWoken = pdFALSE;
+    uint32_t offset;
+    uint8_t len, errors;
+    UART_ISR_BEGIN();
+
+    IFS0CLR = _IFS0_T2IF_MASK << (4 * (timer - 2));
+    if (!handle || !handle->rxActive)
+        return;
+    if (handle->rxDma) {
+        offset = SFR_READ(&handle->rxDma->dptr.reg);
+        if (offset != handle->rxDmaMark) {
+            // Still receiving, check again after another period
+            handle->rxDmaMark = offset;
+        } else {
+            uartIdleStop(handle);
+            handle->rxActive = false;
+            uartRxDmaService(handle, true, &hasWoken);
+            uartRxIntEnable(handle);
+            // A character between the check and the enable is not flagged again
+            if (SFR_READ(&handle->rxDma->dptr.reg) != offset)
+                uartRxActivity(handle);
+        }
+    } else {
+        len = uartRxDrain(handle, uartBuf, &errors);
+        handle->rxStamp = _CP0_GET_COUNT();
+        // Bytes read here count towards the arrival rate as well
+        if (handle->rxAdaptive)
+            uartRxAdapt(handle, len);
+        if (len)
+            uartRxService(handle, uartBuf, len, errors, &hasWoken);
+        if (len || handle->rxSeen) {
+            handle->rxSeen = false;
+        } else {
+            uartIdleStop(handle);
+            handle->rxActive = false;
+            // The next character raises the receive interrupt again
+            uartRxThreshold(handle, FIFO_CHAR);
+            uartRxAsync(handle, true, &hasWoken);
+            if (handle->rxWaiter && uartRingCount(&handle->rx)) {
+                vTaskNotifyGiveFromISR(handle->rxWaiter, &hasWoken);
+                handle->rxWaiter = NULL;
+            }
+        }
     }
+    UART_ISR_END(handle);
+    portYIELD_FROM_ISR(hasWoken);
 }
 
-static void uartHandlers(void *data, uint8_t source)
+void __ISR(_TIMER_2_VECTOR, UART_IPL(DRV_UART_IPL)) timer2Handler(void)
 {
-    switch (source) {
-        case _UART1_VECTOR:
-            if(handlers[UART_DEV1]->onReceive)
-                handlers[UART_DEV1]->onReceive(data, U1STAbits.URXISEL);
-            break;
-        case _UART2_VECTOR:
-            if(handlers[UART_DEV2]->onReceive)
-                handlers[UART_DEV2]->onReceive(data, U2STAbits.URXISEL);
-            break;
-    }
+    uartIdleService(2);
 }
 
-void __ISR(_UART1_VECTOR, ipl6auto) uart1Handler(void)
+void __ISR(_TIMER_3_VECTOR, UART_IPL(DRV_UART_IPL)) timer3Handler(void)
 {
-    uint8_t i;
-    bool hasWoken = false;
-    uint8_t uartBuf[U1STAbits.URXISEL];
-    for (i = 0; i < U1STAbits.URXISEL; i++) {
-        uartBuf[i] = U1RXREG;
-        xQueueSendToBackFromISR(handlers[UART_DEV1]->queueHandle, &uartBuf[i], 
-                (BaseType_t *)&hasWoken);
-        portYIELD_FROM_ISR(hasWoken);
-    }
-    uartHandlers((void*)uartBuf, _UART1_VECTOR);
-    IFS0CLR = IFS0_U1E_BIT;
+    uartIdleService(3);
 }
 
-void __ISR(_UART2_VECTOR, ipl1auto) uart2Handler(void)
+void __ISR(_TIMER_4_VECTOR, UART_IPL(DRV_UART_IPL)) timer4Handler(void)
 {
-    uint8_t i;
-    bool hasWoken = false;
-    uint8_t uartBuf[U2STAbits.URXISEL];
-    for (i = 0; i < U2STAbits.URXISEL; i++) {
-        uartBuf[i] = U2RXREG;
-        xQueueSendToBackFromISR(handlers[UART_DEV2]->queueHandle, &uartBuf[i], 
-                (BaseType_t *)&hasWoken);
-        portYIELD_FROM_ISR(hasWoken);
+    uartIdleService(4);
+}
+
+void __ISR(_TIMER_5_VECTOR, UART_IPL(DRV_UART_IPL)) timer5Handler(void)
+{
+    uartIdleService(5);
+}
+
+/**
+ * Service the error, receive and transmit interrupts of a uart device, shared
+ * by the interrupt handlers of every uart.
+ * @param uartDev Uart device that raised the interrupt.
+ */
+static void uartService(uartDevices_t uartDev)
+{
+    drv_uartHandle_t handle = handlers[uartDev];
+    const uartPort_t *port = &uartPorts[uartDev];
+    uint8_t uartBuf[UART_FIFO_DEPTH];
+    uint8_t i = 0, errors = 0;
+    bool overrun;
+    BaseType_t hasWoken = pdFALSE;
+    UART_ISR_BEGIN();
+
+    if ((SFR_READ(&UART_IFS(port->errReg)->reg) & port->errMask) ||
+            (SFR_READ(&UART_IFS(port->rxReg)->reg) & port->rxMask)) {
+        // With DMA receive only errors are handled here
+        if (handle->rxDma)
+            UART_STAT_LINE(handle, SFR_READ(&port->regs->sta.reg));
+        else
+            i = uartRxDrain(handle, uartBuf, &errors);
+        handle->rxStamp = _CP0_GET_COUNT();
+        if (handle->rxAdaptive) {
+            UART_STAT_ADD(handle, rxLevelIsrs[handle->rxTier], 1);
+            uartRxAdapt(handle, i);
+        }
+        // Clearing OERR resets the FIFO, it is read out first
+        overrun = SFR_READ(&port->regs->sta.reg) & (1 << U_OERR);
+        if (overrun) {
+            UART_STAT_ADD(handle, overrunErrors, 1);
+            SFR_WRITE(&port->regs->sta.clr, 1 << U_OERR);
+        }
+        if (handle->idleTimer)
+            uartRxActivity(handle);
+        if (!handle->rxDma)
+            uartRxService(handle, uartBuf, i, errors, &hasWoken);
+        // The characters after the ones just read were lost
+        if (overrun)
+            handle->rxGap = true;
+        SFR_WRITE(&UART_IFS(port->errReg)->clr, port->errMask);
+        SFR_WRITE(&UART_IFS(port->rxReg)->clr, port->rxMask);
+    }
+    if (!handle->txDma &&
+            (SFR_READ(&UART_IFS(port->txReg)->reg) & port->txMask)) {
+        uartTxService(handle, &hasWoken);
+        SFR_WRITE(&UART_IFS(port->txReg)->clr, port->txMask);
     }
-    uartHandlers((void*)uartBuf, _UART2_VECTOR);
-    IFS1CLR = IFS1_U2E_BIT;
+    UART_ISR_END(handle);
+    portYIELD_FROM_ISR(hasWoken);
 }
 
-drv_uartHandle_t drv_uartNew(drv_uartConfig_t *config)
+// Every vector only forwards to the shared service routine
+#define UART_HANDLER(n) \
+    void __ISR(_UART##n##_VECTOR, UART_IPL(DRV_UART_IPL)) uart##n##Handler(void) \
+    { \
+        uartService(UART_DEV##n); \
+    }
+
+UART_HANDLER(1)
+UART_HANDLER(2)
+UART_HANDLER(3)
+UART_HANDLER(4)
+UART_HANDLER(5)
+UART_HANDLER(6)
+
+/**
+ * Set up flow control with the watermarks of the config, the defaults pause
+ * the peer at 3/4 of the receive ring and resume it at 1/4.
+ * @param handle Handle to the uart instance.
+ * @param config Configuration for the uart device.
+ * @param rxSize Size of the receive ring.
+ */
+static void uartFlowInit(drv_uartHandle_t handle, drv_uartConfig_t *config,
+        uint32_t rxSize)
+{
+    handle->flow = config->flowControl;
+    handle->rxHigh = config->rxHighWater ? config->rxHighWater : rxSize * 3 / 4;
+    if (handle->rxHigh > rxSize)
+        handle->rxHigh = rxSize;
+    if (handle->rxHigh == 0)
+        handle->rxHigh = 1;
+    handle->rxLow = config->rxLowWater ? config->rxLowWater : rxSize / 4;
+    if (handle->rxLow >= handle->rxHigh)
+        handle->rxLow = handle->rxHigh - 1;
+}
+
+/**
+ * Configure a uart instance on top of storage that is already in place, shared
+ * by drv_uartNew and drv_uartNewStatic. The storage is checked before the
+ * hardware is touched.
+ * @param config    Configuration for the uart device.
+ * @param storage   Instance and buffers.
+ * @return Handle to the uart instance, NULL if storage lacks a buffer the
+ *         config needs or the baudrate is out of range.
+ */
+static drv_uartHandle_t uartInit(drv_uartConfig_t *config,
+        const drv_uartStorage_t *storage)
 {
-    drv_uartHandle_t handle = calloc(1, sizeof (struct drv_uartHandle));
+    drv_uartHandle_t handle = storage->handle;
+    bool framing = config->framing != UART_FRAME_NONE;
+    bool queue = framing && !config->onReceive;
+    uint32_t rxSize = uartRingFit(storage->rxSize);
+    uint32_t txSize = config->isBlocking && storage->txBuf ?
+            uartRingFit(storage->txSize) : 0;
+    uint32_t urgentSize = txSize && storage->urgentBuf ?
+            uartRingFit(storage->urgentSize) : 0;
+    uint32_t frameSize = storage->frameSize < UINT8_MAX ?
+            storage->frameSize : UINT8_MAX;
+    uint32_t queueSize = uartRingFit(storage->frameQueueSize);
+    uint32_t frameHead = config->isBlocking && config->timestamps ?
+            1 + sizeof (uint32_t) : 1;
+    uartTransferModes_t transferMode = config->transferMode;
+    uartBaudSetting_t setting;
+#ifdef DRV_UART_PORT
+    if (config->uartDev != DRV_UART_PORT)
+        return NULL;
+#endif
+    if (config->uartDev >= NUM_UARTS || !handle || !storage->rxBuf || !rxSize)
+        return NULL;
+    // A module without a rate never starts, it would leave UxBRG as it was
+    if (!calculateBaud(config->baud, &setting))
+        return NULL;
+    // The vectors are built for one level, IPCx must hold the same one
+    if (config->isBlocking && config->intPriority != DRV_UART_IPL)
+        return NULL;
+    // Only UART1 - 3 have RTS and CTS pins
+    if (config->flowControl == UART_FLOW_RTS_CTS &&
+            (!config->isBlocking || config->uartDev > UART_DEV3))
+        return NULL;
+    if (framing && (!storage->frameBuf || !frameSize))
+        return NULL;
+    // Every frame in the queue takes a length byte and maybe a timestamp
+    if (queue && (!storage->frameQueue || queueSize < frameSize + frameHead))
+        return NULL;
+    if (config->isBlocking && config->lineStatus && !framing &&
+            !storage->rxStatus)
+        return NULL;
+    memset(handle, 0, sizeof (struct drv_uartHandle));
+    handle->uartDev = config->uartDev;
+    handle->halfDuplex = config->isBlocking && config->halfDuplex;
+    handle->echo = handle->halfDuplex && config->echo;
+    if (handle->halfDuplex) {
+        // Transmit through the interrupt, it hands the line back
+        transferMode = UART_XFER_INT;
+        handle->dirLat = config->dirLat;
+        handle->dirMask = config->dirMask;
+    }
+    if (handle->dirLat) {
+        // Receive until the first burst, TRISx is two blocks below LATx
+        SFR_WRITE(&((uartSfr_t *)handle->dirLat)->clr, handle->dirMask);
+        SFR_WRITE(&((uartSfr_t *)handle->dirLat - 2)->clr, handle->dirMask);
+    }
+    if (config->isBlocking && config->flowControl != UART_FLOW_NONE)
+        uartFlowInit(handle, config, rxSize);
+    // The receive interrupt watches the watermarks, XON and XOFF go
+    // through the transmit interrupt
+    if (handle->flow == UART_FLOW_RTS_CTS)
+        transferMode &= ~UART_XFER_DMA_RX;
+    else if (handle->flow == UART_FLOW_XON_XOFF)
+        transferMode = UART_XFER_INT;
+    // PERR and FERR are only seen when the interrupt reads the FIFO
+    handle->lineStatus = config->isBlocking && config->lineStatus;
+    if (handle->lineStatus)
+        transferMode &= ~UART_XFER_DMA_RX;
+    // Stamps are taken when the interrupt reads the FIFO as well
+    handle->stamps = config->isBlocking && config->timestamps;
+    if (handle->stamps)
+        transferMode &= ~UART_XFER_DMA_RX;
+    handle->port = &uartPorts[config->uartDev];
     handle->onReceive = config->onReceive;
     drv_uartSetBaud(handle, config->baud);
     drv_uartSetDataBits(handle, config->dataBits);
     drv_uartSetStopBit(handle, config->stopBits);
     drv_uartSetFifoSize(handle, config->fifoSize);
-    handle->queueHandle = xQueueCreate(config->bufferSize, sizeof(uint8_t));
-    if(handle->queueHandle == NULL)
-        return NULL;
+    uartRingInit(&handle->rx, storage->rxBuf, rxSize);
+    if (handle->lineStatus && !framing) {
+        handle->rxStatus = storage->rxStatus;
+        memset(handle->rxStatus, 0, (rxSize + 7) / 8);
+    }
+    handle->rxReadMax = rxSize < UINT8_MAX ? rxSize : UINT8_MAX;
+    drv_uartSetRxTrigger(handle, config->rxTrigger);
+    if (txSize)
+        uartRingInit(&handle->tx, storage->txBuf, txSize);
+    if (urgentSize)
+        uartRingInit(&handle->txUrgent, storage->urgentBuf, urgentSize);
+    handle->crc = config->crc;
+    if (framing)
+        uartFrameInit(&handle->frame, config->framing, config->crc,
+                storage->frameBuf, frameSize);
+    if (queue)
+        uartRingInit(&handle->frames, storage->frameQueue, queueSize);
+    if (config->isBlocking && (transferMode & UART_XFER_DMA_RX)) {
+        // Every character is a DMA cell
+        drv_uartSetFifoSize(handle, FIFO_CHAR);
+        uartRxDmaInit(handle, config->dmaRxChannel, config->intPriority);
+    }
+    if (handle->tx.buf && (transferMode & UART_XFER_DMA_TX))
+        uartTxDmaInit(handle, config->dmaTxChannel, config->intPriority);
+    if (config->isBlocking && config->idleChars &&
+            config->idleTimer >= 2 && config->idleTimer <= 5)
+        uartIdleInit(handle, config->idleTimer, config->idleChars,
+                config->intPriority);
+    // A lone XON or XOFF must not wait below the FIFO level
+    if (handle->flow == UART_FLOW_XON_XOFF && !handle->idleTimer)
+        drv_uartSetFifoSize(handle, FIFO_CHAR);
+    // Line status is polled without waiting, a flagged byte below the level
+    // would not be seen
+    if (handle->lineStatus)
+        drv_uartSetFifoSize(handle, FIFO_CHAR);
     if (config->isBlocking)
         uartEnableInt(handle, config->intPriority);
-    uartModeSetFlags(handle, U_ON);
+    // UEN = 10 hands UxRTS and UxCTS to the module, RTSMD = 0 drops RTS
+    // while the receive FIFO is full. Any other mode leaves them to the port.
+    uartModeClrFlags(handle, 3 << U_UEN0);
+    if (handle->flow == UART_FLOW_RTS_CTS)
+        uartModeSetFlags(handle, 2 << U_UEN0);
+    uartModeSetFlags(handle, 1 << U_ON);
     handlers[config->uartDev] = handle;
     return handle;
 }
 
-void drv_uartEnable(drv_uartHandle_t handle)
+drv_uartHandle_t drv_uartNew(drv_uartConfig_t *config)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            U1STASET = (1 << U_URXEN) | (1 << U_UTXEN);
-            break;
-        case UART_DEV2:
-            U2STASET = (1 << U_URXEN) | (1 << U_UTXEN);
-            break;
+    drv_uartStorage_t storage = {0};
+    drv_uartHandle_t handle = NULL;
+    uint32_t capacity, head;
+
+    // Everything is allocated before the hardware is touched
+    storage.rxSize = uartRingSize(config->bufferSize);
+    if (config->isBlocking && config->txBufferSize)
+        storage.txSize = uartRingSize(config->txBufferSize);
+    if (storage.txSize && config->urgentBufferSize)
+        storage.urgentSize = uartRingSize(config->urgentBufferSize);
+    if (config->framing != UART_FRAME_NONE) {
+        capacity = config->maxFrameSize ? config->maxFrameSize : config->bufferSize;
+        storage.frameSize = capacity < UINT8_MAX ? capacity : UINT8_MAX;
     }
+    if (config->framing != UART_FRAME_NONE && !config->onReceive) {
+        capacity = config->frameQueueSize ? config->frameQueueSize : config->bufferSize;
+        head = config->isBlocking && config->timestamps ?
+                1 + sizeof (uint32_t) : 1;
+        if (capacity < storage.frameSize + head)
+            capacity = storage.frameSize + head;
+        storage.frameQueueSize = uartRingSize(capacity);
+    }
+    storage.handle = malloc(sizeof (struct drv_uartHandle));
+    storage.rxBuf = malloc(storage.rxSize);
+    if (storage.txSize)
+        storage.txBuf = malloc(storage.txSize);
+    if (storage.urgentSize)
+        storage.urgentBuf = malloc(storage.urgentSize);
+    if (storage.frameSize)
+        storage.frameBuf = malloc(storage.frameSize);
+    if (storage.frameQueueSize)
+        storage.frameQueue = malloc(storage.frameQueueSize);
+    if (config->isBlocking && config->lineStatus &&
+            config->framing == UART_FRAME_NONE)
+        storage.rxStatus = malloc((storage.rxSize + 7) / 8);
+    if (storage.handle && storage.rxBuf &&
+            (storage.txBuf || !storage.txSize) &&
+            (storage.urgentBuf || !storage.urgentSize) &&
+            (storage.frameBuf || !storage.frameSize) &&
+            (storage.frameQueue || !storage.frameQueueSize))
+        handle = uartInit(config, &storage);
+    if (handle == NULL) {
+        free(storage.handle);
+        free(storage.rxBuf);
+        free(storage.txBuf);
+        free(storage.urgentBuf);
+        free(storage.frameBuf);
+        free(storage.frameQueue);
+        free(storage.rxStatus);
+        return NULL;
+    }
+    handle->heap = true;
+    // Callers size their drv_uartTryGets buffer after bufferSize
+    if (config->bufferSize < handle->rxReadMax)
+        handle->rxReadMax = config->bufferSize;
+    return handle;
+}
+
+drv_uartHandle_t drv_uartNewStatic(drv_uartConfig_t *config,
+        const drv_uartStorage_t *storage)
+{
+    return uartInit(config, storage);
+}
+
+void drv_uartEnable(drv_uartHandle_t handle)
+{
+    SFR_WRITE(&UART_REGS(handle)->sta.set, (1 << U_URXEN) | (1 << U_UTXEN));
 }
 
 void drv_uartPut(drv_uartHandle_t handle, uint8_t data)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            while (U1STAbits.UTXBF);
-            U1TXREG = data;
-            break;
-        case UART_DEV2:
-            while (U2STAbits.UTXBF);
-            U2TXREG = data;
+    drv_uartIovec_t iov = {&data, 1};
+
+    uartTxSend(handle, &iov, 1, 0, true);
+}
+
+int8_t drv_uartTryPut(drv_uartHandle_t handle, uint8_t data)
+{
+    drv_uartIovec_t iov = {&data, 1};
+
+    return uartTxSend(handle, &iov, 1, 0, false) ? UART_SUCCES : UART_BUSY;
+}
+
+void drv_uartPuts(drv_uartHandle_t handle, uint8_t *data)
+{
+    drv_uartIovec_t iov = {data, strlen((char *)data)};
+
+    uartTxSend(handle, &iov, 1, 0, true);
+}
+
+uint32_t drv_uartTryPuts(drv_uartHandle_t handle, const uint8_t *data)
+{
+    drv_uartIovec_t iov = {data, strlen((const char *)data)};
+
+    return uartTxSend(handle, &iov, 1, 0, false);
+}
+
+void drv_uartWrite(drv_uartHandle_t handle, const uint8_t *data, uint32_t len)
+{
+    drv_uartIovec_t iov = {data, len};
+
+    uartTxSend(handle, &iov, 1, 0, true);
+}
+
+uint32_t drv_uartTryWrite(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len)
+{
+    drv_uartIovec_t iov = {data, len};
+
+    return uartTxSend(handle, &iov, 1, 0, false);
+}
+
+void drv_uartWritev(drv_uartHandle_t handle, const drv_uartIovec_t *iov,
+        uint8_t count)
+{
+    uartTxSend(handle, iov, count, 0, true);
+}
+
+uint32_t drv_uartTryWritev(drv_uartHandle_t handle, const drv_uartIovec_t *iov,
+        uint8_t count, uint32_t skip)
+{
+    return uartTxSend(handle, iov, count, skip, false);
+}
+
+bool drv_uartWriteCrc(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len)
+{
+    uint8_t size = uartCrcSize(handle->crc);
+    uint8_t head = len + size;
+    uint8_t trailer[UART_CRC_MAX];
+    drv_uartIovec_t iov[3] = {{&head, 1}, {data, len}, {trailer, size}};
+    bool length = handle->frame.mode == UART_FRAME_LENGTH;
+
+    if (!size || (length && len + size > UINT8_MAX))
+        return false;
+    uartCrcPut(handle->crc, uartCrcUpdate(handle->crc,
+            uartCrcInit(handle->crc), data, len), trailer);
+    uartTxSend(handle, iov + !length, 3 - !length, 0, true);
+    return true;
+}
+
+bool drv_uartWriteUrgent(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len, uint32_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t elapsed;
+    uint32_t stamp = _CP0_GET_COUNT();
+    bool room;
+
+    if (!handle->txUrgent.buf || len > handle->txUrgent.mask + 1)
+        return false;
+    while (true) {
+        // The interrupt never sees part of a frame
+        taskENTER_CRITICAL();
+        room = uartRingFree(&handle->txUrgent) >= len;
+        if (room) {
+            uartRingWrite(&handle->txUrgent, data, len);
+            uartTxEndPush(handle, UART_LANE_URGENT, stamp);
+        }
+        handle->txUrgentWaiter = room ? NULL : xTaskGetCurrentTaskHandle();
+        taskEXIT_CRITICAL();
+        if (room)
             break;
-        default:
+        elapsed = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && elapsed >= timeout) {
+            taskENTER_CRITICAL();
+            handle->txUrgentWaiter = NULL;
+            taskEXIT_CRITICAL();
+            return false;
+        }
+        ulTaskNotifyTake(pdTRUE, timeout == portMAX_DELAY ?
+                portMAX_DELAY : timeout - elapsed);
+    }
+    uartTxStart(handle);
+    return true;
+}
+
+uint8_t drv_uartGet(drv_uartHandle_t handle)
+{
+    while (!uartRxAvailable(handle));
+    return uartRxRead(handle);
+}
+
+uint8_t drv_uartTryGet(drv_uartHandle_t handle)
+{
+    if (uartRxAvailable(handle))
+        return uartRxRead(handle);
+    return UART_NO_DATA;
+}
+
+uint8_t drv_uartGets(drv_uartHandle_t handle, uint8_t *data)
+{
+    drv_uartWaitRx(handle, portMAX_DELAY);
+    return drv_uartTryGets(handle, data);
+}
+
+uint8_t drv_uartTryGets(drv_uartHandle_t handle, uint8_t *data)
+{
+    uint8_t len;
+
+    uartRxPoll(handle);
+    len = uartRingRead(&handle->rx, data, handle->rxReadMax);
+    uartRxFlow(handle);
+    return len;
+}
+
+uint32_t drv_uartTryReadStatus(drv_uartHandle_t handle, uint8_t *data,
+        uint8_t *status, uint32_t len)
+{
+    uint32_t count, tail;
+    uint32_t i, pos;
+
+    uartRxPoll(handle);
+    count = uartRingCount(&handle->rx);
+    tail = handle->rx.tail;
+    if (len > count)
+        len = count;
+    memset(status, 0, (len + 7) / 8);
+    // The bits belong to the ISR again once the bytes are consumed
+    for (i = 0; handle->rxStatus && i < len; i++) {
+        pos = (tail + i) & handle->rx.mask;
+        if (handle->rxStatus[pos >> 3] & (1 << (pos & 7)))
+            status[i >> 3] |= 1 << (i & 7);
+    }
+    len = uartRingRead(&handle->rx, data, len);
+    uartRxFlow(handle);
+    return len;
+}
+
+uint32_t drv_uartTryReadStamped(drv_uartHandle_t handle, uint8_t *data,
+        uint32_t len, uint32_t *stamp)
+{
+    uartRxStamps_t *marks = &handle->rxStamps;
+    uint32_t count;
+    uint8_t next;
+
+    if (!handle->stamps)
+        return 0;
+    uartRxPoll(handle);
+    // The interrupt adds and trims marks, the oldest is read with it masked
+    taskENTER_CRITICAL();
+    uartRxStampTrim(handle);
+    count = uartRingCount(&handle->rx);
+    *stamp = marks->head != marks->tail ?
+            marks->stamp[marks->tail & (UART_RX_STAMPS - 1)] :
+            handle->rxStamp;
+    if ((uint8_t)(marks->head - marks->tail) > 1) {
+        next = (marks->tail + 1) & (UART_RX_STAMPS - 1);
+        count = marks->start[next] - handle->rx.tail;
+    }
+    taskEXIT_CRITICAL();
+    if (len > count)
+        len = count;
+    len = uartRingRead(&handle->rx, data, len);
+    uartRxFlow(handle);
+    return len;
+}
+
+uint32_t drv_uartRxStamp(drv_uartHandle_t handle)
+{
+    return handle->rxStamp;
+}
+
+bool drv_uartRxPeek(drv_uartHandle_t handle, const uint8_t **data, uint32_t *len)
+{
+    uartRxPoll(handle);
+    *len = uartRingSpan(&handle->rx, data);
+    return *len != 0;
+}
+
+uint32_t drv_uartRxPeek2(drv_uartHandle_t handle, const uint8_t *data[2],
+        uint32_t len[2])
+{
+    uartRxPoll(handle);
+    return uartRingSpans(&handle->rx, data, len);
+}
+
+void drv_uartRxConsume(drv_uartHandle_t handle, uint32_t len)
+{
+    uint32_t count;
+
+    uartRxPoll(handle);
+    count = uartRingCount(&handle->rx);
+
+    if (len > count)
+        len = count;
+    uartRingSkip(&handle->rx, len);
+    uartRxFlow(handle);
+}
+
+uint32_t drv_uartWaitRx(drv_uartHandle_t handle, uint32_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t elapsed;
+    uint32_t count;
+    bool ready;
+
+    while (true) {
+        uartRxPoll(handle);
+        taskENTER_CRITICAL();
+        count = uartRingCount(&handle->rx);
+        handle->rxWant = 0;
+        // Fewer bytes do once the line went idle after them
+        ready = uartRxReady(handle) ||
+                (count && handle->idleTimer && !handle->rxActive);
+        handle->rxWaiter = ready ? NULL : xTaskGetCurrentTaskHandle();
+        taskEXIT_CRITICAL();
+        if (ready)
+            return count;
+        elapsed = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && elapsed >= timeout)
             break;
+        ulTaskNotifyTake(pdTRUE, timeout == portMAX_DELAY ?
+                portMAX_DELAY : timeout - elapsed);
     }
+    uartRxPoll(handle);
+    taskENTER_CRITICAL();
+    handle->rxWaiter = NULL;
+    count = uartRingCount(&handle->rx);
+    taskEXIT_CRITICAL();
+    return count;
 }
 
-int8_t drv_uartTryPut(drv_uartHandle_t handle, uint8_t data)
+void drv_uartSetRxTrigger(drv_uartHandle_t handle, uint32_t trigger)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            if (U1STAbits.UTXBF)
-                return UART_BUSY;
-            else
-                U1TXREG = data;
-            return UART_SUCCES;
-        case UART_DEV2:
-            if (U2STAbits.UTXBF)
-                return UART_BUSY;
-            else
-                U2TXREG = data;
-            return UART_SUCCES;
-        default:
-            return UART_ERROR;
+    if (trigger == 0)
+        trigger = 1;
+    if (trigger > handle->rx.mask + 1)
+        trigger = handle->rx.mask + 1;
+    handle->rxTrigger = trigger;
+}
+
+/**
+ * Finish a read that slept in uartRxSleep and resume a paused peer.
+ * @param handle    Handle to the uart instance.
+ */
+static void uartRxDone(drv_uartHandle_t handle)
+{
+    uartRxFlow(handle);
+    handle->rxWant = 0;
+    if (!handle->rxDma && !handle->idleTimer)
+        uartRxThreshold(handle, handle->rxFifoSize);
+}
+
+/**
+ * Sleep until the receive ring holds the bytes a reader needs. The request is
+ * clamped to the ring size, the ring can never hold more.
+ * @param handle    Handle to the uart instance.
+ * @param want      Bytes needed.
+ * @param start     Tick count when the read started.
+ * @param timeout   Ticks the read may take, portMAX_DELAY to wait forever.
+ * @return False if the timeout expired first.
+ */
+static bool uartRxSleep(drv_uartHandle_t handle, uint32_t want,
+        TickType_t start, uint32_t timeout)
+{
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    bool ready;
+
+    if (want > handle->rx.mask + 1)
+        want = handle->rx.mask + 1;
+    uartRxPoll(handle);
+    // The reader emptied the ring, a paused peer has to send the rest
+    uartRxFlow(handle);
+    taskENTER_CRITICAL();
+    handle->rxWant = want;
+    ready = uartRxReady(handle);
+    handle->rxWaiter = ready ? NULL : xTaskGetCurrentTaskHandle();
+    if (!ready)
+        uartRxLevel(handle);
+    taskEXIT_CRITICAL();
+    if (ready)
+        return true;
+    if (timeout != portMAX_DELAY && elapsed >= timeout) {
+        taskENTER_CRITICAL();
+        handle->rxWaiter = NULL;
+        taskEXIT_CRITICAL();
+        return false;
     }
+    ulTaskNotifyTake(pdTRUE, timeout == portMAX_DELAY ?
+            portMAX_DELAY : timeout - elapsed);
+    return true;
 }
 
-void drv_uartPuts(drv_uartHandle_t handle, uint8_t *data)
+uint32_t drv_uartRead(drv_uartHandle_t handle, uint8_t *data, uint32_t len,
+        uint32_t timeout)
 {
-    while (*data) {
-        drv_uartPut(handle, *(data++));
+    TickType_t start = xTaskGetTickCount();
+    uint32_t done = 0;
+
+    while (true) {
+        uartRxPoll(handle);
+        done += uartRingRead(&handle->rx, data + done, len - done);
+        if (done == len || !uartRxSleep(handle, len - done, start, timeout))
+            break;
     }
+    uartRxDone(handle);
+    return done;
 }
 
-int8_t drv_uarTryPuts(drv_uartHandle_t handle, uint8_t *data)
+uint32_t drv_uartReadUntil(drv_uartHandle_t handle, uint8_t *data,
+        uint32_t maxLen, uint8_t delimiter, uint32_t timeout)
 {
-    //TODO: keep track of index
-    while (*data) {
-        if(drv_uartTryPut(handle, *(data++) == UART_BUSY))
-            return UART_BUSY;
+    TickType_t start = xTaskGetTickCount();
+    const uint8_t *span, *end;
+    uint32_t done = 0, len;
+
+    while (true) {
+        uartRxPoll(handle);
+        // Copy block by block, the delimiter ends the copy
+        while (done < maxLen && (len = uartRingSpan(&handle->rx, &span))) {
+            if (len > maxLen - done)
+                len = maxLen - done;
+            end = memchr(span, delimiter, len);
+            if (end)
+                len = end - span + 1;
+            memcpy(data + done, span, len);
+            uartRingSkip(&handle->rx, len);
+            done += len;
+            if (end) {
+                uartRxDone(handle);
+                return done;
+            }
+        }
+        if (done == maxLen || !uartRxSleep(handle, 1, start, timeout))
+            break;
     }
-    return UART_SUCCES;
+    uartRxDone(handle);
+    return done;
 }
 
-uint8_t drv_uartGet(drv_uartHandle_t handle)
+uint32_t drv_uartTransact(drv_uartHandle_t handle, const uint8_t *request,
+        uint32_t reqLen, uint8_t *reply, uint32_t replyLen, uint32_t timeout)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            while (!U1STAbits.URXDA);
-            return U1RXREG;
-        case UART_DEV2:
-            while (!U2STAbits.URXDA);
-            return U2RXREG;
-        default:
-            return 0;
+    taskENTER_CRITICAL();
+    // Echoes still owed after the line was handed back were lost
+    if (!handle->hdxTx)
+        handle->echoSkip = 0;
+    // Bytes below the FIFO level are stale too, apart from echoes
+    while (!handle->rxDma && uartRxAvailable(handle)) {
+        uartRxRead(handle);
+        if (handle->echoSkip)
+            handle->echoSkip--;
     }
+    taskEXIT_CRITICAL();
+    drv_uartRxConsume(handle, UINT32_MAX);
+    drv_uartWrite(handle, request, reqLen);
+    if (!replyLen)
+        return 0;
+    return drv_uartRead(handle, reply, replyLen, timeout);
 }
 
-uint8_t drv_uartTryGet(drv_uartHandle_t handle)
+/**
+ * Take the oldest frame of a queue of frames, sleeping until one arrives.
+ * @param handle    Handle to the uart instance.
+ * @param frames    Frames as a length byte and the payload.
+ * @param waiter    Set to the reading task while it sleeps.
+ * @param data      Buffer to store the frame in.
+ * @param timeout   Ticks to wait for a frame, portMAX_DELAY to wait forever.
+ * @return Length of the frame, 0 on a timeout.
+ */
+static uint8_t uartFramesRead(drv_uartHandle_t handle, uartRing_t *frames,
+        TaskHandle_t *waiter, uint8_t *data, uint32_t *stamp, uint32_t timeout)
 {
-    switch(handle->uartDev) {
-        case UART_DEV1:
-            if(U1STAbits.URXDA)
-                return U1RXREG;
-            else
-                return UART_NO_DATA;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t elapsed;
+    uint32_t when = 0;
+    uint8_t len = 0;
+
+    while (true) {
+        uartRxPoll(handle);
+        // Length and payload are taken together, frames are short
+        taskENTER_CRITICAL();
+        if (uartRingCount(frames)) {
+            uartRingRead(frames, &len, 1);
+            if (handle->stamps)
+                uartRingRead(frames, (uint8_t *)&when, sizeof (when));
+            uartRingRead(frames, data, len);
+        }
+        *waiter = len ? NULL : xTaskGetCurrentTaskHandle();
+        taskEXIT_CRITICAL();
+        if (len) {
+            if (stamp)
+                *stamp = when;
+            return len;
+        }
+        elapsed = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && elapsed >= timeout)
             break;
-        case UART_DEV2:
-            if(U2STAbits.URXDA)
-                return U1RXREG;
-            else
-                return UART_NO_DATA;
+        ulTaskNotifyTake(pdTRUE, timeout == portMAX_DELAY ?
+                portMAX_DELAY : timeout - elapsed);
+    }
+    taskENTER_CRITICAL();
+    *waiter = NULL;
+    taskEXIT_CRITICAL();
+    return 0;
+}
+
+uint8_t drv_uartReadFrame(drv_uartHandle_t handle, uint8_t *data,
+        uint32_t timeout)
+{
+    if (!handle->frames.buf)
+        return 0;
+    return uartFramesRead(handle, &handle->frames, &handle->rxWaiter, data,
+            NULL, timeout);
+}
+
+uint8_t drv_uartReadFrameStamped(drv_uartHandle_t handle, uint8_t *data,
+        uint32_t *stamp, uint32_t timeout)
+{
+    if (!handle->frames.buf || !handle->stamps)
+        return 0;
+    return uartFramesRead(handle, &handle->frames, &handle->rxWaiter, data,
+            stamp, timeout);
+}
+
+bool drv_uartRouteAdd(drv_uartHandle_t handle, drv_uartRoute_t *route,
+        const drv_uartRouteConfig_t *config)
+{
+    drv_uartRoute_t **link;
+    uint32_t size = uartRingFit(config->size);
+
+    if (handle->frame.mode == UART_FRAME_NONE || !config->buf ||
+            size < handle->frame.size + uartFrameHead(handle))
+        return false;
+    route->next = NULL;
+    route->offset = config->offset;
+    route->mask = config->mask;
+    route->value = config->value;
+    route->policy = config->policy;
+    uartRingInit(&route->frames, config->buf, size);
+    route->waiter = NULL;
+    route->dropped = 0;
+    taskENTER_CRITICAL();
+    for (link = &handle->routes; *link; link = &(*link)->next);
+    *link = route;
+    taskEXIT_CRITICAL();
+    return true;
+}
+
+void drv_uartRouteRemove(drv_uartHandle_t handle, drv_uartRoute_t *route)
+{
+    drv_uartRoute_t **link;
+
+    taskENTER_CRITICAL();
+    for (link = &handle->routes; *link; link = &(*link)->next) {
+        if (*link == route) {
+            *link = route->next;
             break;
-        default:
-            return UART_NO_DATA;
+        }
     }
+    taskEXIT_CRITICAL();
 }
 
-uint8_t drv_uartGets(drv_uartHandle_t handle, uint8_t *data)
+uint8_t drv_uartRouteRead(drv_uartHandle_t handle, drv_uartRoute_t *route,
+        uint8_t *data, uint32_t timeout)
 {
-    uint8_t i;
-    for (i = 0; i < sizeof(data); i++) {
-        data[i] = drv_uartGet(handle);
-    }   
-    return i;
+    return uartFramesRead(handle, &route->frames, &route->waiter, data,
+            NULL, timeout);
 }
 
-uint8_t drv_uartTryGets(drv_uartHandle_t handle, uint8_t *data)
+uint8_t drv_uartRouteReadStamped(drv_uartHandle_t handle,
+        drv_uartRoute_t *route, uint8_t *data, uint32_t *stamp,
+        uint32_t timeout)
+{
+    if (!handle->stamps)
+        return 0;
+    return uartFramesRead(handle, &route->frames, &route->waiter, data,
+            stamp, timeout);
+}
+
+bool drv_uartWriteAsync(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len, drv_uartAsyncHandler_t onDone, void *context)
+{
+    uartAsync_t *async = &handle->txAsync;
+    bool started;
+
+    if (!handle->tx.buf || !len)
+        return false;
+    taskENTER_CRITICAL();
+    started = !async->data && !handle->txQueuing;
+    if (started) {
+        async->data = (uint8_t *)data;
+        async->len = len;
+        async->done = 0;
+        async->onDone = onDone;
+        async->context = context;
+        async->stamp = _CP0_GET_COUNT();
+        uartTxAsync(handle, NULL);
+    }
+    taskEXIT_CRITICAL();
+    if (started)
+        uartTxStart(handle);
+    return started;
+}
+
+bool drv_uartReadAsync(drv_uartHandle_t handle, uint8_t *data, uint32_t len,
+        drv_uartAsyncHandler_t onDone, void *context)
+{
+    uartAsync_t *async = &handle->rxAsync;
+    bool started;
+
+    if (!len || handle->frame.mode != UART_FRAME_NONE)
+        return false;
+    uartRxPoll(handle);
+    taskENTER_CRITICAL();
+    started = !async->data;
+    if (started) {
+        async->data = data;
+        async->len = len;
+        async->done = 0;
+        async->onDone = onDone;
+        async->context = context;
+        // Bytes from before the line went idle complete the read at once
+        uartRxAsync(handle, handle->idleTimer && !handle->rxActive, NULL);
+    }
+    taskEXIT_CRITICAL();
+    // The bytes taken may bring a paused peer below the low watermark
+    uartRxFlow(handle);
+    return started;
+}
+
+uint32_t drv_uartCancelAsync(drv_uartHandle_t handle, uartEvents_t event)
+{
+    uartAsync_t *async = event == UART_EVENT_READ ?
+            &handle->rxAsync : &handle->txAsync;
+    uint32_t done = 0;
+
+    taskENTER_CRITICAL();
+    if (async->data) {
+        done = async->done;
+        // The part already queued is sent, urgent frames may follow it
+        if (event == UART_EVENT_WRITE && handle->txUrgent.buf)
+            uartTxEndPush(handle, UART_LANE_BULK, async->stamp);
+        async->data = NULL;
+        // A write waiting for the ring may go ahead
+        if (event == UART_EVENT_WRITE)
+            uartWake(&handle->txWaiter, NULL);
+    }
+    taskEXIT_CRITICAL();
+    return done;
+}
+
+int8_t drv_uartWaitAny(const drv_uartHandle_t *handles, uint8_t count,
+        uint8_t *events, uint32_t timeout)
 {
-    uint8_t ret;
+    TickType_t start = xTaskGetTickCount();
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    TickType_t elapsed;
+    int8_t found;
     uint8_t i;
-    for (i = 0; i < uxQueueMessagesWaiting(handle->queueHandle); i++) {
-        ret = xQueueReceive(handle->queueHandle, (void*)&data[i], 0);
+
+    while (true) {
+        found = -1;
+        taskENTER_CRITICAL();
+        for (i = 0; i < count && found < 0; i++)
+            if (handles[i]->events)
+                found = i;
+        for (i = 0; i < count; i++)
+            handles[i]->eventWaiter = found < 0 ? self : NULL;
+        if (found >= 0) {
+            if (events)
+                *events = handles[found]->events;
+            handles[found]->events = 0;
+        }
+        taskEXIT_CRITICAL();
+        if (found >= 0)
+            return found;
+        elapsed = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && elapsed >= timeout)
+            break;
+        ulTaskNotifyTake(pdTRUE, timeout == portMAX_DELAY ?
+                portMAX_DELAY : timeout - elapsed);
     }
-    return ret;
+    taskENTER_CRITICAL();
+    for (i = 0; i < count; i++)
+        handles[i]->eventWaiter = NULL;
+    taskEXIT_CRITICAL();
+    return -1;
 }
 
 void drv_uartSetOnReceive(drv_uartHandle_t handle, drv_uartEventHandler_t task)
@@ -285,16 +2729,34 @@ void drv_uartSetOnReceive(drv_uartHandle_t handle, drv_uartEventHandler_t task)
     handle->onReceive = task;
 }
 
-void drv_uartSetBaud(drv_uartHandle_t handle, uartBaudRates_t baud)
+uint32_t drv_uartSetBaud(drv_uartHandle_t handle, uint32_t baud)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            U1BRG = calculateBaud(baud, false);
-            break;
-        case UART_DEV2:
-            U2BRG = calculateBaud(baud, false);
-            break;
-    }
+    uartBaudSetting_t setting;
+
+    if (!calculateBaud(baud, &setting))
+        return 0;
+    if (setting.highSpeed)
+        uartModeSetFlags(handle, 1 << U_BRGH);
+    else
+        uartModeClrFlags(handle, 1 << U_BRGH);
+    SFR_WRITE(&UART_REGS(handle)->brg.reg, setting.brg);
+    handle->baud = baud;
+    handle->bitClocks = (setting.highSpeed ? 4 : 16) * (setting.brg + 1u);
+    if (handle->idleTimer)
+        uartIdleSetPeriod(handle);
+    return PB_CLK_FREQ / handle->bitClocks;
+}
+
+uint32_t drv_uartGetBaud(drv_uartHandle_t handle, int32_t *error)
+{
+    uint32_t actual;
+
+    if (!handle->bitClocks)
+        return 0;
+    actual = PB_CLK_FREQ / handle->bitClocks;
+    if (error)
+        *error = ((int64_t)actual - handle->baud) * 10000 / (int64_t)handle->baud;
+    return actual;
 }
 
 void drv_uartSetDataBits(drv_uartHandle_t handle, uartDataBits_t data)
@@ -329,19 +2791,110 @@ void drv_uartSetStopBit(drv_uartHandle_t handle, uartStopBits_t stop)
 
 void drv_uartSetFifoSize(drv_uartHandle_t handle, uartFifoSizes_t fifoSize)
 {
-    switch (handle->uartDev) {
-        case UART_DEV1:
-            U1STAbits.URXISEL = fifoSize;
-            break;
-        case UART_DEV2:
-            U2STAbits.URXISEL = fifoSize;
-            break;
+    handle->rxAdaptive = fifoSize == FIFO_ADAPTIVE;
+    handle->rxTier = 0;
+    if (handle->rxAdaptive) {
+        // Start as a quiet line, the first burst raises the level
+        handle->rxRate = UART_RX_QUIET;
+        handle->rxLastIsr = _CP0_GET_COUNT();
+        fifoSize = uartFifoTiers[0];
+    }
+    handle->rxFifoSize = fifoSize;
+    // An idle line waits for the first character, the level applies after it
+    if (!handle->idleTimer || handle->rxDma || handle->rxActive)
+        uartRxThreshold(handle, fifoSize);
+}
+
+void drv_uartGetStats(drv_uartHandle_t handle, drv_uartStats_t *stats)
+{
+#if DRV_UART_STATS
+    uint64_t isrTicks, txLatencyTicks[UART_TX_LANES];
+    uint32_t isrMaxTicks, txLatencyCount[UART_TX_LANES];
+    uint32_t txLatencyMax[UART_TX_LANES];
+    uint32_t rxRate;
+    uint8_t lane;
+
+    taskENTER_CRITICAL();
+    *stats = handle->stats;
+    rxRate = handle->rxRate;
+    stats->rxFifoLevel = handle->rxFifoSize;
+    isrTicks = handle->isrTicks;
+    isrMaxTicks = handle->isrMaxTicks;
+    memcpy(txLatencyTicks, handle->txLatencyTicks, sizeof (txLatencyTicks));
+    memcpy(txLatencyCount, handle->txLatencyCount, sizeof (txLatencyCount));
+    memcpy(txLatencyMax, handle->txLatencyMax, sizeof (txLatencyMax));
+    taskEXIT_CRITICAL();
+    stats->framesDropped = handle->frame.dropped;
+    stats->crcErrors = handle->frame.crcErrors;
+    if (stats->isrCount) {
+        stats->bytesPerIsr = (stats->rxBytes + stats->txBytes) / stats->isrCount;
+        isrTicks /= stats->isrCount;
     }
+    // The core timer counts at half the system clock
+    stats->isrAvgNs = isrTicks * 2000000000ull / SYS_CLK_FREQ;
+    stats->isrMaxNs = isrMaxTicks * 2000000000ull / SYS_CLK_FREQ;
+    for (lane = 0; lane < UART_TX_LANES; lane++) {
+        if (txLatencyCount[lane])
+            txLatencyTicks[lane] /= txLatencyCount[lane];
+        stats->txLatencyAvgNs[lane] =
+                txLatencyTicks[lane] * 2000000000ull / SYS_CLK_FREQ;
+        stats->txLatencyMaxNs[lane] =
+                txLatencyMax[lane] * 2000000000ull / SYS_CLK_FREQ;
+    }
+    if (handle->rxAdaptive)
+        stats->rxGapAvgNs = (uint64_t)rxRate * UART_CHAR_BITS *
+                handle->bitClocks * 1000000000ull / 16 / PB_CLK_FREQ;
+#else
+    (void)handle;
+    memset(stats, 0, sizeof (*stats));
+#endif
+}
+
+void drv_uartResetStats(drv_uartHandle_t handle)
+{
+#if DRV_UART_STATS
+    taskENTER_CRITICAL();
+    memset(&handle->stats, 0, sizeof (handle->stats));
+    handle->isrTicks = 0;
+    handle->isrMaxTicks = 0;
+    memset(handle->txLatencyTicks, 0, sizeof (handle->txLatencyTicks));
+    memset(handle->txLatencyCount, 0, sizeof (handle->txLatencyCount));
+    memset(handle->txLatencyMax, 0, sizeof (handle->txLatencyMax));
+    handle->frame.dropped = 0;
+    handle->frame.crcErrors = 0;
+    taskEXIT_CRITICAL();
+#else
+    (void)handle;
+#endif
 }
 
 void drv_uartDestroy(drv_uartHandle_t handle)
 {
-    uartModeClrFlags(handle, U_ON);
-    vQueueDelete(handle->queueHandle);
+    const uartPort_t *port = UART_PORT(handle);
+
+    uartModeClrFlags(handle, (1 << U_ON) | (3 << U_UEN0));
+    if (handle->idleTimer) {
+        uartIdleStop(handle);
+        IEC0CLR = _IEC0_T2IE_MASK << (4 * (handle->idleTimer - 2));
+        timerOwners[handle->idleTimer - 2] = NULL;
+    }
+    if (handle->rxDma)
+        uartDmaRelease(handle->rxDma);
+    if (handle->txDma)
+        uartDmaRelease(handle->txDma);
+    SFR_WRITE(&UART_IEC(port->errReg)->clr, port->errMask);
+    SFR_WRITE(&UART_IEC(port->rxReg)->clr, port->rxMask);
+    SFR_WRITE(&UART_IEC(port->txReg)->clr, port->txMask);
+    if (handle->dirLat)
+        SFR_WRITE(&((uartSfr_t *)handle->dirLat)->clr, handle->dirMask);
+    handlers[handle->uartDev] = NULL;
+    if (!handle->heap)
+        return;
+    free(handle->rx.buf);
+    free(handle->tx.buf);
+    free(handle->txUrgent.buf);
+    free(handle->frame.buf);
+    free(handle->frames.buf);
+    free(handle->rxStatus);
     free(handle);
 }
\ No newline at end of file
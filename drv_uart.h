@@ -26,7 +26,21 @@
 extern "C" {
 #endif
 
-#define NUM_UARTS   2
+#define NUM_UARTS   6
+
+// Set to 0 to build the driver without per port counters
+#ifndef DRV_UART_STATS
+#define DRV_UART_STATS  1
+#endif
+
+// Priority every interrupt vector of the driver is built with, the uart,
+// DMA and idle timer vectors alike. intPriority must match it
+#ifndef DRV_UART_IPL
+#define DRV_UART_IPL    6
+#endif
+
+// Define DRV_UART_PORT to one uartDevices_t to build the driver for that port
+// only, its register addresses are then resolved at compile time
     
 // Error codes
 #define UART_BUSY   -1
@@ -38,12 +52,24 @@ extern "C" {
 #define U_ON        15
 #define U_PDSEL0    1
 #define U_PDSEL1    2
+#define U_BRGH      3
 #define U_URXEN     12
 #define U_UTXEN     10
 #define U_STSEL     0
+#define U_URXDA     0
+#define U_OERR      1
+#define U_FERR      2
+#define U_PERR      3
+#define U_URXISEL0  6
+#define U_UTXBF     9
+#define U_TRMT      8
+#define U_UTXISEL0  14
+#define U_UEN0      8
 
 typedef struct drv_uartHandle *drv_uartHandle_t;
+typedef struct drv_uartRoute drv_uartRoute_t;
 typedef void(*drv_uartEventHandler_t)(void*, uint8_t);
+typedef void(*drv_uartAsyncHandler_t)(void *context, uint32_t len);
 
 typedef enum {
     BAUD1200 = 1200,
@@ -52,7 +78,11 @@ typedef enum {
     BAUD19200 = 19200,
     BAUD38400 = 38400,
     BAUD57600 = 57600,
-    BAUD115200 = 115200
+    BAUD115200 = 115200,
+    BAUD230400 = 230400,
+    BAUD460800 = 460800,
+    BAUD921600 = 921600,
+    BAUD1000000 = 1000000
 } uartBaudRates_t;
 
 typedef enum {
@@ -69,34 +99,175 @@ typedef enum {
 
 typedef enum {
     UART_DEV1 = 0,
-    UART_DEV2 = 1
+    UART_DEV2 = 1,
+    UART_DEV3 = 2,
+    UART_DEV4 = 3,
+    UART_DEV5 = 4,
+    UART_DEV6 = 5
 } uartDevices_t;
 
 typedef enum {
     FIFO_FULL = 3,
     FIFO_3 = 2,
-    FIFO_CHAR = 0
+    FIFO_CHAR = 0,
+    FIFO_ADAPTIVE = 4   /**<Follow the byte arrival rate, see drv_uartSetFifoSize*/
 } uartFifoSizes_t;
 
+typedef enum {
+    UART_XFER_INT = 0,      /**<Move all data in the uart interrupt*/
+    UART_XFER_DMA_RX = 1,   /**<Receive with a circular DMA channel*/
+    UART_XFER_DMA_TX = 2,   /**<Transmit with a DMA transfer per block*/
+    UART_XFER_DMA = 3       /**<Both directions through DMA*/
+} uartTransferModes_t;
+
+typedef enum {
+    UART_FRAME_NONE = 0,    /**<Deliver raw bytes*/
+    UART_FRAME_SLIP,        /**<Frames end with 0xC0, RFC 1055 escaping*/
+    UART_FRAME_COBS,        /**<Consistent overhead byte stuffing, frames end with 0x00*/
+    UART_FRAME_LENGTH       /**<A length byte followed by the payload*/
+} uartFraming_t;
+
+typedef enum {
+    UART_CRC_NONE = 0,      /**<No CRC*/
+    UART_CRC_16,            /**<CRC-16/CCITT-FALSE, see drv_uartCrc.h*/
+    UART_CRC_32             /**<CRC-32 as used by Ethernet, see drv_uartCrc.h*/
+} uartCrc_t;
+
+typedef enum {
+    UART_FLOW_NONE = 0,     /**<No flow control*/
+    UART_FLOW_RTS_CTS,      /**<Hardware handshake on the UxRTS and UxCTS pins, UART1 - 3 only*/
+    UART_FLOW_XON_XOFF      /**<Software handshake with XON (0x11) and XOFF (0x13) in the data*/
+} uartFlowControl_t;
+
+typedef enum {
+    UART_ROUTE_DROP_NEWEST = 0, /**<A full route drops the incoming frame*/
+    UART_ROUTE_DROP_OLDEST,     /**<A full route drops its oldest frames to make room*/
+    UART_ROUTE_PASS             /**<A full route hands the frame on to onReceive or the frame queue*/
+} uartRoutePolicy_t;
+
+typedef enum {
+    UART_LANE_BULK = 0,     /**<drv_uartWrite and the other writes*/
+    UART_LANE_URGENT,       /**<drv_uartWriteUrgent, sent ahead of bulk writes*/
+    UART_TX_LANES
+} uartTxLanes_t;
+
+typedef enum {
+    UART_EVENT_WRITE = 1 << 0,  /**<drv_uartWriteAsync completed*/
+    UART_EVENT_READ = 1 << 1    /**<drv_uartReadAsync completed*/
+} uartEvents_t;
+
 typedef struct {
-    uartBaudRates_t baud;               /**<Desired baudrate, see the BAUDRATE enum*/
+    uint32_t baud;                      /**<Desired baudrate, any rate up to PB_CLK_FREQ / 4, see uartBaudRates_t for the standard ones*/
     uartStopBits_t stopBits;            /**<Desired number of stopbits, see the STOPBITS enum*/
     uartDataBits_t dataBits;            /**<Desired number of data and parity bits, see DATABITS enum*/
-    uartDevices_t uartDev;              /**<Desired uart device to initialize, only UARTDEV1 is supported atm*/
+    uartDevices_t uartDev;              /**<Desired uart device to initialize*/
     bool isBlocking : 1;                /**<Use interrupts? must be on(1) for now*/
-    drv_uartEventHandler_t onReceive;   /**<Function to execute if the receive buffer is full*/
-    uint8_t intPriority;                /**<Priority of the interrupt*/
+    drv_uartEventHandler_t onReceive;   /**<Function to execute from the ISR with received bytes, or with each complete frame when framing is used*/
+    uint8_t intPriority;                /**<Priority of the interrupt, must be DRV_UART_IPL*/
     uartFifoSizes_t fifoSize;           /**<Size of the hardware FIFO buffer*/
-    uint8_t bufferSize;                 /**<Size of the software buffer*/
+    uint16_t bufferSize;                /**<Size of the software buffer, rounded up to a power of two*/
+    uint16_t txBufferSize;              /**<Size of the software transmit buffer, 0 to write the hardware FIFO directly. Needs interrupts*/
+    uint16_t urgentBufferSize;          /**<Size of the urgent transmit buffer, see drv_uartWriteUrgent, 0 for a single lane. Needs txBufferSize*/
+    uint16_t rxTrigger;                 /**<Buffered bytes needed to wake a task in drv_uartWaitRx, 0 or 1 wakes on every byte*/
+    uartTransferModes_t transferMode;   /**<Use DMA for either direction, needs interrupts. DMA transmit also needs txBufferSize*/
+    uint8_t dmaRxChannel;               /**<DMA channel for receiving, 0 - 7*/
+    uint8_t dmaTxChannel;               /**<DMA channel for transmitting, 0 - 7*/
+    uartFraming_t framing;              /**<Decode frames in the driver, see uartFraming_t*/
+    uint8_t maxFrameSize;               /**<Largest decoded frame, longer frames are dropped. Counts the CRC*/
+    uartCrc_t crc;                      /**<Check and strip a CRC at the end of each received frame, see drv_uartWriteCrc for sending*/
+    uint16_t frameQueueSize;            /**<Bytes to queue frames in when onReceive is NULL, each frame takes its length + 1, + 5 with timestamps. 0 uses bufferSize*/
+    uint8_t idleChars;                  /**<Character times of silence after which received bytes are flushed, 0 disables*/
+    uint8_t idleTimer;                  /**<Timer 2 - 5 used to detect the idle line, one per uart*/
+    bool halfDuplex : 1;                /**<Share one wire for both directions, needs interrupts and ignores transferMode*/
+    bool echo : 1;                      /**<Half-duplex: the line returns every transmitted byte, drop them*/
+    PORTREF dirLat;                     /**<Half-duplex: LATx of the direction pin, high while transmitting. NULL without one*/
+    uint32_t dirMask;                   /**<Half-duplex: bit of the direction pin in dirLat*/
+    uartFlowControl_t flowControl;      /**<Pause the peer when the receive buffer fills up, needs interrupt receive and no framing*/
+    uint16_t rxHighWater;               /**<Flow control: buffered bytes that pause the peer, 0 uses 3/4 of bufferSize*/
+    uint16_t rxLowWater;                /**<Flow control: buffered bytes that resume the peer, 0 uses 1/4 of bufferSize*/
+    bool lineStatus : 1;                /**<Flag bytes with parity or framing errors, or lost bytes before them, see drv_uartTryReadStatus. Frames with such bytes are dropped. Needs interrupt receive, receives at FIFO_CHAR*/
+    bool timestamps : 1;                /**<Record when received bytes and frames arrived, see drv_uartTryReadStamped and drv_uartReadFrameStamped. Needs interrupt receive*/
 } drv_uartConfig_t;
 
+typedef struct {
+    const uint8_t *data;                /**<Bytes to send*/
+    uint32_t len;                       /**<Number of bytes*/
+} drv_uartIovec_t;
+
+typedef struct {
+    uint32_t rxBytes;                   /**<Bytes moved into the receive buffer by the ISR or DMA*/
+    uint32_t txBytes;                   /**<Bytes written to the transmit FIFO or handed to DMA*/
+    uint32_t rxDropped;                 /**<Received bytes lost because the receive buffer was full*/
+    uint32_t framesDropped;             /**<Malformed, oversized, empty or unqueued frames*/
+    uint32_t crcErrors;                 /**<Frames dropped for a CRC that did not match*/
+    uint32_t rxHighWater;               /**<Most bytes the receive buffer held*/
+    uint32_t txHighWater;               /**<Most bytes the transmit buffer held*/
+    uint32_t overrunErrors;             /**<Hardware FIFO overruns (OERR)*/
+    uint32_t framingErrors;             /**<Characters received with a framing error (FERR)*/
+    uint32_t parityErrors;              /**<Characters received with a parity error (PERR)*/
+    uint32_t flowPauses;                /**<Times the peer was paused by RTS or XOFF*/
+    uint32_t isrCount;                  /**<Interrupts of the uart, its DMA channels and idle timer*/
+    uint32_t bytesPerIsr;               /**<Received and transmitted bytes per interrupt*/
+    uint32_t isrAvgNs;                  /**<Average interrupt duration*/
+    uint32_t isrMaxNs;                  /**<Longest interrupt duration*/
+    uint32_t txLatencyAvgNs[UART_TX_LANES]; /**<Average time from queueing a write to its last byte leaving the buffer, per lane. Needs urgentBufferSize*/
+    uint32_t txLatencyMaxNs[UART_TX_LANES]; /**<Longest of those times, per lane*/
+    uint32_t rxLevelRaises;             /**<Adaptive FIFO: times the receive interrupt level went up*/
+    uint32_t rxLevelDrops;              /**<Adaptive FIFO: times the receive interrupt level went down*/
+    uint32_t rxLevelIsrs[2];            /**<Adaptive FIFO: receive interrupts at FIFO_CHAR and FIFO_3*/
+    uint32_t rxGapAvgNs;                /**<Adaptive FIFO: recent average time between received bytes, at most 8 character times*/
+    uartFifoSizes_t rxFifoLevel;        /**<Receive interrupt level in use while bytes are arriving*/
+} drv_uartStats_t;
+
+typedef struct {
+    uint8_t offset;                     /**<Byte of the frame that is matched, shorter frames never match*/
+    uint8_t mask;                       /**<Bits of that byte to compare, 0xFF for a tag, 0 matches every frame*/
+    uint8_t value;                      /**<Value of the masked bits*/
+    uartRoutePolicy_t policy;           /**<What to do with a frame when the route is full*/
+    uint8_t *buf;                       /**<Queued frames, each takes its length + 1, + 5 with timestamps*/
+    uint32_t size;                      /**<Size of buf, at least maxFrameSize + 1, rounded down to a power of two*/
+} drv_uartRouteConfig_t;
+
+/**
+ * Caller owned memory of a uart instance, see DRV_UART_STATIC in
+ * drv_uartStatic.h. Ring sizes are rounded down to a power of two.
+ */
+typedef struct {
+    drv_uartHandle_t handle;            /**<Storage for the instance itself*/
+    uint8_t *rxBuf;                     /**<Receive ring*/
+    uint32_t rxSize;                    /**<Size of rxBuf*/
+    uint8_t *txBuf;                     /**<Transmit ring, used when the config is blocking*/
+    uint32_t txSize;                    /**<Size of txBuf, 0 to write the hardware FIFO directly*/
+    uint8_t *frameBuf;                  /**<Frame being decoded, used with framing*/
+    uint32_t frameSize;                 /**<Size of frameBuf, the largest frame, at most 255*/
+    uint8_t *frameQueue;                /**<Complete frames, used with framing when onReceive is NULL*/
+    uint32_t frameQueueSize;            /**<Size of frameQueue, each frame takes its length + 1, + 5 with timestamps*/
+    uint8_t *rxStatus;                  /**<A bit per byte of rxBuf, (rxSize + 7) / 8 bytes, used with lineStatus*/
+    uint8_t *urgentBuf;                 /**<Urgent transmit ring, used with txBuf. Left out by DRV_UART_STATIC*/
+    uint32_t urgentSize;                /**<Size of urgentBuf, 0 for a single lane*/
+} drv_uartStorage_t;
+
 /**
- * Initialise and configure a new uart instance.
+ * Initialise and configure a new uart instance. Nothing is touched if an
+ * allocation fails.
  * @param config    Configuration for the uart device.
- * @param handle    Handle to the uart instance.
+ * @return Handle to the uart instance, NULL if out of memory or the baudrate
+ *         is out of range.
  */
 drv_uartHandle_t drv_uartNew(drv_uartConfig_t *config);
 
+/**
+ * Initialise and configure a uart instance in caller owned memory, without
+ * using the heap. The buffer sizes in config are ignored, the ones in storage
+ * are used instead.
+ * @param config    Configuration for the uart device.
+ * @param storage   Instance and buffers, see DRV_UART_STATIC.
+ * @return Handle to the uart instance, NULL if storage lacks a buffer the
+ *         config needs or the baudrate is out of range.
+ */
+drv_uartHandle_t drv_uartNewStatic(drv_uartConfig_t *config,
+        const drv_uartStorage_t *storage);
+
 /**
  * Enable the uart device.
  * @param handle    Handle to the uart instance.
@@ -104,7 +275,8 @@ drv_uartHandle_t drv_uartNew(drv_uartConfig_t *config);
 void drv_uartEnable(drv_uartHandle_t handle);
 
 /**
- * Send a char over uart
+ * Send a char over uart. With a transmit buffer the char is queued and the
+ * calling task only sleeps while the buffer is full.
  * @param data  Char to send
  * @param handle    Handle to the uart instance.
  */
@@ -127,12 +299,83 @@ int8_t drv_uartTryPut(drv_uartHandle_t handle, uint8_t data);
 void drv_uartPuts(drv_uartHandle_t handle, uint8_t *data);
 
 /**
- * Try to send a string using uart, this function is non-blocking and might need
- * to be called multiple times if the uart device is busy.
- * @param handle
- * @return 
+ * Try to send a string using uart, this function is non-blocking. Call it
+ * again with data + the returned count to send the rest.
+ * @param handle    Handle to the uart instance.
+ * @param data      String to send.
+ * @return Number of chars accepted, the string length if all were.
  */
-int8_t drv_uartTryPuts(drv_uartHandle_t handle, uint8_t *data);
+uint32_t drv_uartTryPuts(drv_uartHandle_t handle, const uint8_t *data);
+
+/**
+ * Send a number of bytes over uart, the data may contain zeroes.
+ * @param handle    Handle to the uart instance.
+ * @param data      Bytes to send.
+ * @param len       Number of bytes to send.
+ * @see uartPut
+ */
+void drv_uartWrite(drv_uartHandle_t handle, const uint8_t *data, uint32_t len);
+
+/**
+ * Try to send a number of bytes, this function is non-blocking. Call it again
+ * with the remaining bytes to resume.
+ * @param handle    Handle to the uart instance.
+ * @param data      Bytes to send.
+ * @param len       Number of bytes to send.
+ * @return Number of bytes accepted.
+ */
+uint32_t drv_uartTryWrite(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len);
+
+/**
+ * Send several buffers as one transmission without copying them together
+ * first, for example a header, payload and checksum.
+ * @param handle    Handle to the uart instance.
+ * @param iov       Buffers to send in order.
+ * @param count     Number of buffers.
+ */
+void drv_uartWritev(drv_uartHandle_t handle, const drv_uartIovec_t *iov,
+        uint8_t count);
+
+/**
+ * Try to send several buffers, this function is non-blocking. To resume,
+ * call it again with the same buffers and the total accepted so far as skip.
+ * @param handle    Handle to the uart instance.
+ * @param iov       Buffers to send in order.
+ * @param count     Number of buffers.
+ * @param skip      Bytes of the buffers accepted by earlier calls.
+ * @return Number of bytes accepted by this call.
+ */
+uint32_t drv_uartTryWritev(drv_uartHandle_t handle, const drv_uartIovec_t *iov,
+        uint8_t count, uint32_t skip);
+
+/**
+ * Send bytes followed by the configured CRC over them as one write, so the
+ * protocol layer needs no pass of its own. With LENGTH framing a length byte
+ * that counts the CRC goes first. SLIP and COBS frames are encoded by the
+ * caller, which appends the CRC itself, see uartCrcUpdate in drv_uartCrc.h.
+ * @param handle    Handle to the uart instance.
+ * @param data      Bytes to send.
+ * @param len       Number of bytes.
+ * @return False without a CRC, or if the frame does not fit a length byte.
+ */
+bool drv_uartWriteCrc(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len);
+
+/**
+ * Send a frame ahead of the bulk writes, for safety traffic like an
+ * emergency stop. It goes out as soon as the write being transmitted is
+ * complete, bulk writes are never cut in two. A non-blocking write may be,
+ * where one call stopped accepting it and the next resumes. The frame is
+ * queued whole or not at all. Needs urgentBufferSize.
+ * @param handle    Handle to the uart instance.
+ * @param data      Bytes to send.
+ * @param len       Number of bytes, at most urgentBufferSize.
+ * @param timeout   Ticks to wait for room, portMAX_DELAY to wait forever.
+ * @return False if the frame was not queued.
+ */
+bool drv_uartWriteUrgent(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len, uint32_t timeout);
 
 /**
  * Get char from serial
@@ -152,8 +395,8 @@ uint8_t drv_uartGet(drv_uartHandle_t handle);
 uint8_t drv_uartTryGet(drv_uartHandle_t handle);
 
 /**
- * Get the full buffer of chars from serial, might be incomplete or empty
- * @param data  char array or pointer to store the buffer in
+ * Sleep until received chars are buffered, see drv_uartWaitRx, and take them.
+ * @param data  Buffer to store the chars in, at least bufferSize bytes.
  * @param handle    Handle to the uart instance.
  * @return Number of bytes read.
  */
@@ -163,12 +406,275 @@ uint8_t drv_uartGets(drv_uartHandle_t handle, uint8_t* data);
  * Try to receive a string using uart, this function is non-blocking and might need
  * to be called multiple times if the uart device is busy or no data is available.
  * @param handle    Handle to the uart instance.
- * @param data      Buffer to store the received values in.
- * @retval 0        Succes
- * @retval 1        Error
+ * @param data      Buffer to store the received values in, at least bufferSize bytes.
+ * @return Number of bytes read.
  */
 uint8_t drv_uartTryGets(drv_uartHandle_t handle, uint8_t *data);
 
+/**
+ * Take received bytes together with their line status, non-blocking. A set
+ * bit marks a byte received with a parity or framing error, or one that
+ * follows bytes lost to an overrun or a full buffer. Needs lineStatus,
+ * without it no bit is set.
+ * @param handle    Handle to the uart instance.
+ * @param data      Buffer to store the bytes in.
+ * @param status    Set to a bit per byte, bit i % 8 of status[i / 8] for
+ *                  data[i], (len + 7) / 8 bytes.
+ * @param len       Size of data.
+ * @return Number of bytes read.
+ */
+uint32_t drv_uartTryReadStatus(drv_uartHandle_t handle, uint8_t *data,
+        uint8_t *status, uint32_t len);
+
+/**
+ * Take received bytes together with the time they arrived, non-blocking.
+ * Bytes are stamped per receive interrupt, a read stops where the next
+ * interrupt's bytes start so all bytes returned share the stamp. When more
+ * interrupts are buffered than can be told apart, the newest share the stamp
+ * before them. Needs timestamps, use drv_uartWaitRx to sleep for bytes.
+ * @param handle    Handle to the uart instance.
+ * @param data      Buffer to store the bytes in.
+ * @param len       Size of data.
+ * @param stamp     Set to the core timer count, SYS_CLK_FREQ / 2, when the
+ *                  interrupt read the bytes from the FIFO.
+ * @return Number of bytes read.
+ */
+uint32_t drv_uartTryReadStamped(drv_uartHandle_t handle, uint8_t *data,
+        uint32_t len, uint32_t *stamp);
+
+/**
+ * Get the core timer count at which the running receive interrupt read the
+ * FIFO, for onReceive callbacks. Outside the callback it is the count of the
+ * latest receive interrupt.
+ * @param handle    Handle to the uart instance.
+ */
+uint32_t drv_uartRxStamp(drv_uartHandle_t handle);
+
+/**
+ * Lend the largest contiguous block of received bytes straight from the
+ * software receive buffer, nothing is copied or consumed. The block stays
+ * valid until it is released with drv_uartRxConsume.
+ * @param handle    Handle to the uart instance.
+ * @param data      Set to the first received byte.
+ * @param len       Set to the number of bytes readable at data.
+ * @return True if any data was available.
+ */
+bool drv_uartRxPeek(drv_uartHandle_t handle, const uint8_t **data, uint32_t *len);
+
+/**
+ * Lend all received bytes, split in two blocks when the data wraps around the
+ * end of the software receive buffer.
+ * @param handle    Handle to the uart instance.
+ * @param data      Set to the start of both blocks.
+ * @param len       Set to the length of both blocks, len[1] is 0 without a wrap.
+ * @return Total number of bytes lent.
+ */
+uint32_t drv_uartRxPeek2(drv_uartHandle_t handle, const uint8_t *data[2],
+        uint32_t len[2]);
+
+/**
+ * Release bytes lent by drv_uartRxPeek or drv_uartRxPeek2, the ISR may reuse
+ * their storage afterwards.
+ * @param handle    Handle to the uart instance.
+ * @param len       Number of bytes to release, clamped to the buffered count.
+ */
+void drv_uartRxConsume(drv_uartHandle_t handle, uint32_t len);
+
+/**
+ * Sleep until the software receive buffer holds at least the trigger level
+ * of bytes, or until the line goes idle with fewer bytes when idle detection
+ * is configured. The ISR wakes the task at most once per interrupt. With DMA
+ * receive and without idle detection the check only runs on every half
+ * buffer, use a timeout to pick up shorter messages.
+ * @param handle    Handle to the uart instance.
+ * @param timeout   Ticks to wait at most, portMAX_DELAY to wait forever.
+ * @return Number of bytes buffered, below the trigger level on a timeout.
+ */
+uint32_t drv_uartWaitRx(drv_uartHandle_t handle, uint32_t timeout);
+
+/**
+ * Change the number of buffered bytes that wakes a task in drv_uartWaitRx.
+ * @param handle    Handle to the uart instance.
+ * @param trigger   Trigger level, clamped to the buffer size.
+ */
+void drv_uartSetRxTrigger(drv_uartHandle_t handle, uint32_t trigger);
+
+/**
+ * Read an exact number of bytes, sleeping on the software receive buffer
+ * until they arrive. With DMA receive and without idle detection the bytes
+ * are only seen on every half buffer or once the timeout expires.
+ * @param handle    Handle to the uart instance.
+ * @param data      Buffer to store the bytes in, at least len bytes.
+ * @param len       Number of bytes to read.
+ * @param timeout   Ticks the whole read may take, portMAX_DELAY to wait forever.
+ * @return Number of bytes read, below len on a timeout.
+ */
+uint32_t drv_uartRead(drv_uartHandle_t handle, uint8_t *data, uint32_t len,
+        uint32_t timeout);
+
+/**
+ * Read bytes up to and including a delimiter, sleeping on the software
+ * receive buffer until it arrives. Bytes after the delimiter stay buffered.
+ * @param handle    Handle to the uart instance.
+ * @param data      Buffer to store the bytes in, at least maxLen bytes.
+ * @param maxLen    Most bytes to read, the read stops here without delimiter.
+ * @param delimiter Byte that ends the read, for example '\n'.
+ * @param timeout   Ticks the whole read may take, portMAX_DELAY to wait forever.
+ * @return Number of bytes read, the last one is the delimiter unless maxLen
+ *         was reached or the timeout expired.
+ */
+uint32_t drv_uartReadUntil(drv_uartHandle_t handle, uint8_t *data,
+        uint32_t maxLen, uint8_t delimiter, uint32_t timeout);
+
+/**
+ * Take the oldest complete frame from the frame queue. Only used with framing
+ * and without an onReceive callback, which gets the frames instead.
+ * @param handle    Handle to the uart instance.
+ * @param data      Buffer to store the frame in, at least maxFrameSize bytes.
+ * @param timeout   Ticks to wait for a frame, portMAX_DELAY to wait forever.
+ * @return Length of the frame, 0 on a timeout.
+ */
+uint8_t drv_uartReadFrame(drv_uartHandle_t handle, uint8_t *data,
+        uint32_t timeout);
+
+/**
+ * Take the oldest complete frame from the frame queue with the time its last
+ * byte was read from the FIFO. Needs timestamps.
+ * @param handle    Handle to the uart instance.
+ * @param data      Buffer to store the frame in, at least maxFrameSize bytes.
+ * @param stamp     Set to the core timer count, SYS_CLK_FREQ / 2, when the
+ *                  frame completed.
+ * @param timeout   Ticks to wait for a frame, portMAX_DELAY to wait forever.
+ * @return Length of the frame, 0 on a timeout.
+ */
+uint8_t drv_uartReadFrameStamped(drv_uartHandle_t handle, uint8_t *data,
+        uint32_t *stamp, uint32_t timeout);
+
+/**
+ * Deliver matching frames straight into a queue of their own, so every
+ * consumer reads only its own traffic. Routes are matched in the order they
+ * were added, the first match takes the frame. Frames no route matches go to
+ * onReceive or the frame queue as before. Only used with framing.
+ * @param handle    Handle to the uart instance.
+ * @param route     Caller owned route, see drv_uartStatic.h.
+ * @param config    Match rule, overflow policy and storage of the route.
+ * @return False without framing or if the storage cannot hold a frame.
+ */
+bool drv_uartRouteAdd(drv_uartHandle_t handle, drv_uartRoute_t *route,
+        const drv_uartRouteConfig_t *config);
+
+/**
+ * Stop routing frames to a route, queued frames are thrown away.
+ * @param handle    Handle to the uart instance.
+ * @param route     Route added with drv_uartRouteAdd.
+ */
+void drv_uartRouteRemove(drv_uartHandle_t handle, drv_uartRoute_t *route);
+
+/**
+ * Take the oldest frame of a route. One task reads each route.
+ * @param handle    Handle to the uart instance.
+ * @param route     Route added with drv_uartRouteAdd.
+ * @param data      Buffer to store the frame in, at least maxFrameSize bytes.
+ * @param timeout   Ticks to wait for a frame, portMAX_DELAY to wait forever.
+ * @return Length of the frame, 0 on a timeout.
+ */
+uint8_t drv_uartRouteRead(drv_uartHandle_t handle, drv_uartRoute_t *route,
+        uint8_t *data, uint32_t timeout);
+
+/**
+ * Take the oldest frame of a route with the time it completed, see
+ * drv_uartReadFrameStamped. Needs timestamps.
+ * @param handle    Handle to the uart instance.
+ * @param route     Route added with drv_uartRouteAdd.
+ * @param data      Buffer to store the frame in, at least maxFrameSize bytes.
+ * @param stamp     Set to the core timer count when the frame completed.
+ * @param timeout   Ticks to wait for a frame, portMAX_DELAY to wait forever.
+ * @return Length of the frame, 0 on a timeout.
+ */
+uint8_t drv_uartRouteReadStamped(drv_uartHandle_t handle,
+        drv_uartRoute_t *route, uint8_t *data, uint32_t *stamp,
+        uint32_t timeout);
+
+/**
+ * Start a write without waiting for it. The transmit interrupt copies data
+ * into the transmit buffer as room frees up and calls onDone once it took the
+ * last byte, data must stay untouched until then. A write that fits right away
+ * completes in this call. One asynchronous write per uart at a time. Other
+ * writes wait until it completed or was cancelled, the non-blocking ones
+ * accept nothing meanwhile. Start the next one from a task, not from onDone.
+ * Needs txBufferSize.
+ * @param handle    Handle to the uart instance.
+ * @param data      Bytes to send.
+ * @param len       Number of bytes.
+ * @param onDone    Called from the interrupt, or with interrupts masked from
+ *                  this call, with the bytes written. NULL to only signal
+ *                  drv_uartWaitAny.
+ * @param context   Passed to onDone.
+ * @return False if a write is already pending or being queued by a task,
+ *         len is 0 or there is no transmit buffer.
+ */
+bool drv_uartWriteAsync(drv_uartHandle_t handle, const uint8_t *data,
+        uint32_t len, drv_uartAsyncHandler_t onDone, void *context);
+
+/**
+ * Start a read without waiting for it. Buffered bytes are taken at once, the
+ * receive interrupt copies the rest and calls onDone when len bytes are in.
+ * With an idle timer the read also completes when the line goes idle after at
+ * least one byte. With DMA receive bytes are taken at the half and full
+ * buffer interrupts and on idle. One asynchronous read per uart at a time,
+ * other reads must not run meanwhile. Start the next one from a task, not
+ * from onDone. Not used with framing.
+ * @param handle    Handle to the uart instance.
+ * @param data      Buffer to store the bytes in, at least len bytes.
+ * @param len       Number of bytes to read.
+ * @param onDone    Called from the interrupt, or with interrupts masked from
+ *                  this call, with the bytes read. NULL to only signal
+ *                  drv_uartWaitAny.
+ * @param context   Passed to onDone.
+ * @return False if a read is already pending, len is 0 or framing is used.
+ */
+bool drv_uartReadAsync(drv_uartHandle_t handle, uint8_t *data, uint32_t len,
+        drv_uartAsyncHandler_t onDone, void *context);
+
+/**
+ * Stop a pending asynchronous read or write, onDone is not called. Bytes a
+ * write already queued are still sent.
+ * @param handle    Handle to the uart instance.
+ * @param event     UART_EVENT_READ or UART_EVENT_WRITE.
+ * @return Bytes the request moved before it was stopped.
+ */
+uint32_t drv_uartCancelAsync(drv_uartHandle_t handle, uartEvents_t event);
+
+/**
+ * Sleep until an asynchronous read or write on any of several uarts has
+ * completed, so one task can serve all of them. Completions are remembered
+ * until they are collected here, earlier handles in the list are served
+ * first. One task waits on a uart at a time.
+ * @param handles   Uart instances to wait on.
+ * @param count     Number of handles.
+ * @param events    Set to the completions of the returned handle, see
+ *                  uartEvents_t, which are cleared. May be NULL.
+ * @param timeout   Ticks to wait, portMAX_DELAY to wait forever.
+ * @return Index of the handle in handles, -1 on a timeout.
+ */
+int8_t drv_uartWaitAny(const drv_uartHandle_t *handles, uint8_t count,
+        uint8_t *events, uint32_t timeout);
+
+/**
+ * Half-duplex: send a request and read the reply of a fixed length. Stale
+ * received bytes are dropped first. The transmitter hands the line back as
+ * soon as the last stop bit is out, echoed bytes never reach data.
+ * @param handle    Handle to the uart instance.
+ * @param request   Bytes to send.
+ * @param reqLen    Number of bytes to send.
+ * @param reply     Buffer to store the reply in, at least replyLen bytes.
+ * @param replyLen  Length of the reply, 0 if none is expected.
+ * @param timeout   Ticks to wait for the reply, portMAX_DELAY to wait forever.
+ * @return Number of reply bytes read, below replyLen on a timeout.
+ */
+uint32_t drv_uartTransact(drv_uartHandle_t handle, const uint8_t *request,
+        uint32_t reqLen, uint8_t *reply, uint32_t replyLen, uint32_t timeout);
+
 /**
  * Change the callback when a the uart buffer is full
  * @param task      function to excecute
@@ -177,11 +683,24 @@ uint8_t drv_uartTryGets(drv_uartHandle_t handle, uint8_t *data);
 void drv_uartSetOnReceive(drv_uartHandle_t handle, drv_uartEventHandler_t task);
 
 /**
- * Change baudrate of a uart device
- * @param baud      Desired baudrate, see the BAUDRATE enum
+ * Change baudrate of a uart device. The 16x or 4x (BRGH) clock is picked to
+ * get closest to the requested rate, the standard rates are resolved at
+ * compile time.
+ * @param baud      Desired baudrate in bit/s, see uartBaudRates_t
+ * @param handle    Handle to the uart instance.
+ * @return Achieved baudrate, 0 if the rate is out of range and the baudrate
+ *         was left unchanged.
+ */
+uint32_t drv_uartSetBaud(drv_uartHandle_t handle, uint32_t baud);
+
+/**
+ * Get the baudrate a uart device actually runs at.
  * @param handle    Handle to the uart instance.
+ * @param error     Set to the deviation from the requested baudrate in
+ *                  hundredths of a percent, may be NULL.
+ * @return Achieved baudrate.
  */
-void drv_uartSetBaud(drv_uartHandle_t handle, uartBaudRates_t baud);
+uint32_t drv_uartGetBaud(drv_uartHandle_t handle, int32_t *error);
 
 /**
  * Change the number of stopbits of a uart device
@@ -198,14 +717,37 @@ void drv_uartSetDataBits(drv_uartHandle_t handle, uartDataBits_t data);
 void drv_uartSetStopBit(drv_uartHandle_t device, uartStopBits_t stop);
 
 /**
- * Set the hardware fifo size for uart's received data.
+ * Set the hardware fifo size for uart's received data. FIFO_ADAPTIVE measures
+ * the byte arrival rate in the receive interrupt and moves between FIFO_CHAR
+ * and FIFO_3: back to back bytes raise the level to save interrupts, a quiet
+ * line drops it to interrupt on every byte. It stays two characters short of
+ * a full FIFO to leave the interrupt time before an overrun. The last bytes of a burst
+ * can stay below the level, configure an idle timer to flush them. Without one
+ * they are read when a task sleeps for them or reads an empty buffer. Only
+ * interrupt receive adapts, DMA receive stays at FIFO_CHAR.
  * @param handle    Handle to the uart instance.
  * @param fifoSize  Fifo size.
  */
 void drv_uartSetFifoSize(drv_uartHandle_t handle, uartFifoSizes_t fifoSize);
 
 /**
- * Delete the uart driver instance and free up memory
+ * Get the counters of a uart device since it was created or the counters were
+ * last reset. All counters read 0 when the driver is built with
+ * DRV_UART_STATS set to 0.
+ * @param handle    Handle to the uart instance.
+ * @param stats     Filled with the counters.
+ */
+void drv_uartGetStats(drv_uartHandle_t handle, drv_uartStats_t *stats);
+
+/**
+ * Reset the counters of a uart device, including the high-water marks.
+ * @param handle    Handle to the uart instance.
+ */
+void drv_uartResetStats(drv_uartHandle_t handle);
+
+/**
+ * Delete the uart driver instance and free up memory. A static instance only
+ * releases the hardware, its storage can be passed to drv_uartNewStatic again.
  * @param handle    Handle to the uart instance.
  */
 void drv_uartDestroy(drv_uartHandle_t handle);
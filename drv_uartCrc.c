@@ -0,0 +1,108 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "drv_uartCrc.h"
+
+/*
+ * Table entries are built from one table entry per input bit, a CRC is linear
+ * so every other entry is the xor of those. The entry of the bit that reaches
+ * the top of the register first is the polynomial itself, each next bit adds
+ * a shift.
+ */
+#define CRC16_SHIFT(c)  ((((c) << 1) ^ ((c) & 0x8000u ? DRV_UART_CRC16_POLY : 0)) & 0xFFFFu)
+#define CRC16_BIT0      DRV_UART_CRC16_POLY
+#define CRC16_BIT1      CRC16_SHIFT(CRC16_BIT0)
+#define CRC16_BIT2      CRC16_SHIFT(CRC16_BIT1)
+#define CRC16_BIT3      CRC16_SHIFT(CRC16_BIT2)
+#define CRC16_BIT4      CRC16_SHIFT(CRC16_BIT3)
+#define CRC16_BIT5      CRC16_SHIFT(CRC16_BIT4)
+#define CRC16_BIT6      CRC16_SHIFT(CRC16_BIT5)
+#define CRC16_BIT7      CRC16_SHIFT(CRC16_BIT6)
+#define CRC16_ENTRY(i) \
+    (((i) & 0x01 ? CRC16_BIT0 : 0) ^ ((i) & 0x02 ? CRC16_BIT1 : 0) ^ \
+     ((i) & 0x04 ? CRC16_BIT2 : 0) ^ ((i) & 0x08 ? CRC16_BIT3 : 0) ^ \
+     ((i) & 0x10 ? CRC16_BIT4 : 0) ^ ((i) & 0x20 ? CRC16_BIT5 : 0) ^ \
+     ((i) & 0x40 ? CRC16_BIT6 : 0) ^ ((i) & 0x80 ? CRC16_BIT7 : 0))
+
+#define CRC32_SHIFT(c)  (((c) >> 1) ^ ((c) & 1u ? DRV_UART_CRC32_POLY : 0))
+#define CRC32_BIT7      DRV_UART_CRC32_POLY
+#define CRC32_BIT6      CRC32_SHIFT(CRC32_BIT7)
+#define CRC32_BIT5      CRC32_SHIFT(CRC32_BIT6)
+#define CRC32_BIT4      CRC32_SHIFT(CRC32_BIT5)
+#define CRC32_BIT3      CRC32_SHIFT(CRC32_BIT4)
+#define CRC32_BIT2      CRC32_SHIFT(CRC32_BIT3)
+#define CRC32_BIT1      CRC32_SHIFT(CRC32_BIT2)
+#define CRC32_BIT0      CRC32_SHIFT(CRC32_BIT1)
+#define CRC32_ENTRY(i) \
+    (((i) & 0x01 ? CRC32_BIT0 : 0) ^ ((i) & 0x02 ? CRC32_BIT1 : 0) ^ \
+     ((i) & 0x04 ? CRC32_BIT2 : 0) ^ ((i) & 0x08 ? CRC32_BIT3 : 0) ^ \
+     ((i) & 0x10 ? CRC32_BIT4 : 0) ^ ((i) & 0x20 ? CRC32_BIT5 : 0) ^ \
+     ((i) & 0x40 ? CRC32_BIT6 : 0) ^ ((i) & 0x80 ? CRC32_BIT7 : 0))
+
+#define CRC_ROW(entry, i) \
+    entry(i), entry(i + 1), entry(i + 2), entry(i + 3), \
+    entry(i + 4), entry(i + 5), entry(i + 6), entry(i + 7), \
+    entry(i + 8), entry(i + 9), entry(i + 10), entry(i + 11), \
+    entry(i + 12), entry(i + 13), entry(i + 14), entry(i + 15)
+#define CRC_TABLE(entry) \
+    CRC_ROW(entry, 0x00), CRC_ROW(entry, 0x10), CRC_ROW(entry, 0x20), \
+    CRC_ROW(entry, 0x30), CRC_ROW(entry, 0x40), CRC_ROW(entry, 0x50), \
+    CRC_ROW(entry, 0x60), CRC_ROW(entry, 0x70), CRC_ROW(entry, 0x80), \
+    CRC_ROW(entry, 0x90), CRC_ROW(entry, 0xA0), CRC_ROW(entry, 0xB0), \
+    CRC_ROW(entry, 0xC0), CRC_ROW(entry, 0xD0), CRC_ROW(entry, 0xE0), \
+    CRC_ROW(entry, 0xF0)
+
+const uint16_t uartCrc16Table[256] = {CRC_TABLE(CRC16_ENTRY)};
+const uint32_t uartCrc32Table[256] = {CRC_TABLE(CRC32_ENTRY)};
+
+uint32_t uartCrcUpdate(uartCrc_t type, uint32_t crc, const uint8_t *data,
+        uint32_t len)
+{
+    uint32_t i;
+
+    if (type == UART_CRC_16) {
+        for (i = 0; i < len; i++)
+            crc = (uint16_t)(crc << 8) ^
+                    uartCrc16Table[(uint8_t)(crc >> 8) ^ data[i]];
+    } else {
+        for (i = 0; i < len; i++)
+            crc = (crc >> 8) ^ uartCrc32Table[(uint8_t)crc ^ data[i]];
+    }
+    return crc;
+}
+
+void uartCrcPut(uartCrc_t type, uint32_t crc, uint8_t *out)
+{
+    if (type == UART_CRC_16) {
+        out[0] = crc >> 8;
+        out[1] = crc;
+        return;
+    }
+    crc ^= 0xFFFFFFFFu;
+    out[0] = crc;
+    out[1] = crc >> 8;
+    out[2] = crc >> 16;
+    out[3] = crc >> 24;
+}
+
+bool uartCrcCheck(uartCrc_t type, uint32_t crc, const uint8_t *trailer)
+{
+    uint8_t expect[UART_CRC_MAX];
+
+    uartCrcPut(type, crc, expect);
+    return !memcmp(expect, trailer, uartCrcSize(type));
+}
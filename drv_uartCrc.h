@@ -0,0 +1,120 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Table driven CRC engine used to check frames while the receive interrupt
+ * decodes them and to append a CRC to outgoing writes, so the protocol layer
+ * never runs over the bytes a second time. The tables are built by the
+ * compiler from the polynomials below, a byte costs one lookup.
+ *
+ * UART_CRC_16  MSB first, initial value 0xFFFF, no final xor, sent high byte
+ *              first. CRC-16/CCITT-FALSE with the default polynomial.
+ * UART_CRC_32  LSB first (reflected polynomial), initial value and final xor
+ *              0xFFFFFFFF, sent low byte first. The Ethernet and zlib CRC-32
+ *              with the default polynomial.
+ */
+
+#ifndef UART_CRC_H
+#define	UART_CRC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "drv_uart.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// Polynomial of UART_CRC_16, normal (MSB first) form
+#ifndef DRV_UART_CRC16_POLY
+#define DRV_UART_CRC16_POLY     0x1021u
+#endif
+
+// Polynomial of UART_CRC_32, reflected (LSB first) form
+#ifndef DRV_UART_CRC32_POLY
+#define DRV_UART_CRC32_POLY     0xEDB88320u
+#endif
+
+#define UART_CRC_MAX            4       /**<Bytes of the longest CRC*/
+
+extern const uint16_t uartCrc16Table[256];
+extern const uint32_t uartCrc32Table[256];
+
+/**
+ * Get the value a CRC starts from.
+ * @param type  CRC in use.
+ */
+static inline uint32_t uartCrcInit(uartCrc_t type)
+{
+    return type == UART_CRC_16 ? 0xFFFFu : 0xFFFFFFFFu;
+}
+
+/**
+ * Get the number of bytes a CRC takes on the wire.
+ * @param type  CRC in use, UART_CRC_NONE takes none.
+ */
+static inline uint8_t uartCrcSize(uartCrc_t type)
+{
+    return type == UART_CRC_16 ? 2 : type == UART_CRC_32 ? 4 : 0;
+}
+
+/**
+ * Add a byte to a running CRC, cheap enough for the receive interrupt.
+ * @param type  UART_CRC_16 or UART_CRC_32.
+ * @param crc   CRC so far.
+ * @param data  Next byte.
+ * @return Updated CRC.
+ */
+static inline uint32_t uartCrcByte(uartCrc_t type, uint32_t crc, uint8_t data)
+{
+    if (type == UART_CRC_16)
+        return (uint16_t)(crc << 8) ^ uartCrc16Table[(uint8_t)(crc >> 8) ^ data];
+    return (crc >> 8) ^ uartCrc32Table[(uint8_t)crc ^ data];
+}
+
+/**
+ * Add bytes to a running CRC.
+ * @param type  UART_CRC_16 or UART_CRC_32.
+ * @param crc   CRC so far, uartCrcInit for the first bytes.
+ * @param data  Next bytes.
+ * @param len   Number of bytes.
+ * @return Updated CRC.
+ */
+uint32_t uartCrcUpdate(uartCrc_t type, uint32_t crc, const uint8_t *data,
+        uint32_t len);
+
+/**
+ * Store a finished CRC in the byte order it is sent in.
+ * @param type  UART_CRC_16 or UART_CRC_32.
+ * @param crc   CRC over the bytes it protects.
+ * @param out   Buffer of uartCrcSize bytes.
+ */
+void uartCrcPut(uartCrc_t type, uint32_t crc, uint8_t *out);
+
+/**
+ * Compare a running CRC with the one received after the bytes.
+ * @param type  UART_CRC_16 or UART_CRC_32.
+ * @param crc   CRC over the bytes it protects.
+ * @param trailer Received CRC, uartCrcSize bytes.
+ * @return True if they match.
+ */
+bool uartCrcCheck(uartCrc_t type, uint32_t crc, const uint8_t *trailer);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* UART_CRC_H */
@@ -0,0 +1,271 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "drv_uartCrc.h"
+#include "drv_uartFrame.h"
+
+#define SLIP_END        0xC0
+#define SLIP_ESC        0xDB
+#define SLIP_ESC_END    0xDC
+#define SLIP_ESC_ESC    0xDD
+
+enum {
+    FRAME_IDLE = 0,     /**<Between frames*/
+    FRAME_DATA,         /**<Collecting payload*/
+    FRAME_ESCAPE,       /**<SLIP: escape byte seen*/
+    FRAME_DISCARD,      /**<Dropping the rest of a bad frame*/
+    FRAME_DONE          /**<Frame completed, handed to the caller*/
+};
+
+void uartFrameInit(uartFrame_t *frame, uartFraming_t mode, uartCrc_t crc,
+        uint8_t *buf, uint16_t size)
+{
+    frame->mode = mode;
+    frame->crcType = crc;
+    frame->buf = buf;
+    frame->size = size;
+    frame->dropped = 0;
+    frame->crcErrors = 0;
+    uartFrameReset(frame);
+}
+
+void uartFrameReset(uartFrame_t *frame)
+{
+    frame->len = 0;
+    frame->remaining = 0;
+    frame->code = 0;
+    frame->state = FRAME_IDLE;
+    frame->crc = uartCrcInit(frame->crcType);
+}
+
+/**
+ * Give up on the current frame.
+ * @param frame     Decoder.
+ * @param resync    True if the bad byte also ends the frame.
+ */
+static void frameDrop(uartFrame_t *frame, bool resync)
+{
+    frame->dropped++;
+    frame->len = 0;
+    frame->remaining = 0;
+    frame->code = 0;
+    frame->state = resync ? FRAME_IDLE : FRAME_DISCARD;
+    frame->crc = uartCrcInit(frame->crcType);
+}
+
+/**
+ * Append a decoded byte. The byte the CRC size before it can no longer be part
+ * of the trailer, it goes into the CRC.
+ * @param frame     Decoder.
+ * @param data      Decoded byte.
+ */
+static inline void frameAppend(uartFrame_t *frame, uint8_t data)
+{
+    uint8_t lag = uartCrcSize(frame->crcType);
+
+    if (lag && frame->len >= lag)
+        frame->crc = uartCrcByte(frame->crcType, frame->crc,
+                frame->buf[frame->len - lag]);
+    frame->buf[frame->len++] = data;
+}
+
+static bool frameStore(uartFrame_t *frame, uint8_t data)
+{
+    if (frame->len == frame->size) {
+        frameDrop(frame, false);
+        return false;
+    }
+    frameAppend(frame, data);
+    return true;
+}
+
+/**
+ * Check and strip the CRC of a complete frame.
+ * @param frame     Decoder holding the frame.
+ * @return False if the frame has to be dropped.
+ */
+static bool frameCheck(uartFrame_t *frame)
+{
+    uint8_t size = uartCrcSize(frame->crcType);
+
+    if (!size)
+        return true;
+    if (frame->len < size ||
+            !uartCrcCheck(frame->crcType, frame->crc,
+            frame->buf + frame->len - size)) {
+        frame->crcErrors++;
+        return false;
+    }
+    frame->len -= size;
+    return true;
+}
+
+static bool slipByte(uartFrame_t *frame, uint8_t data)
+{
+    if (data == SLIP_END) {
+        if (frame->state == FRAME_ESCAPE) {
+            frameDrop(frame, true);
+            return false;
+        }
+        // Back to back END bytes are allowed and carry no frame
+        if (frame->state == FRAME_DISCARD || !frame->len) {
+            frame->state = FRAME_IDLE;
+            return false;
+        }
+        return true;
+    }
+    switch (frame->state) {
+        case FRAME_DISCARD:
+            break;
+        case FRAME_ESCAPE:
+            frame->state = FRAME_DATA;
+            if (data == SLIP_ESC_END)
+                frameStore(frame, SLIP_END);
+            else if (data == SLIP_ESC_ESC)
+                frameStore(frame, SLIP_ESC);
+            else
+                frameDrop(frame, false);
+            break;
+        default:
+            frame->state = FRAME_DATA;
+            if (data == SLIP_ESC)
+                frame->state = FRAME_ESCAPE;
+            else
+                frameStore(frame, data);
+            break;
+    }
+    return false;
+}
+
+static bool cobsByte(uartFrame_t *frame, uint8_t data)
+{
+    if (data == 0) {
+        if (frame->state == FRAME_DISCARD || frame->state == FRAME_IDLE) {
+            frame->state = FRAME_IDLE;
+            return false;
+        }
+        // The delimiter may only follow a complete block
+        if (frame->remaining) {
+            frameDrop(frame, true);
+            return false;
+        }
+        return true;
+    }
+    if (frame->state == FRAME_DISCARD)
+        return false;
+    if (frame->remaining) {
+        frame->remaining--;
+        frameStore(frame, data);
+        return false;
+    }
+    // A code byte, every block shorter than 254 bytes ends in a zero
+    if (frame->state == FRAME_DATA && frame->code != 0xFF &&
+            !frameStore(frame, 0))
+        return false;
+    frame->state = FRAME_DATA;
+    frame->code = data;
+    frame->remaining = data - 1;
+    return false;
+}
+
+static bool lengthByte(uartFrame_t *frame, uint8_t data)
+{
+    switch (frame->state) {
+        case FRAME_IDLE:
+            // Zero length frames are keep-alives
+            if (!data)
+                return false;
+            frame->remaining = data;
+            frame->state = data > frame->size ? FRAME_DISCARD : FRAME_DATA;
+            if (frame->state == FRAME_DISCARD)
+                frame->dropped++;
+            return false;
+        case FRAME_DISCARD:
+            // Skip the payload of an oversized frame to stay in sync
+            if (!--frame->remaining)
+                frame->state = FRAME_IDLE;
+            return false;
+        default:
+            frameAppend(frame, data);
+            return !--frame->remaining;
+    }
+}
+
+void uartFrameDiscard(uartFrame_t *frame)
+{
+    uint16_t remaining = frame->remaining;
+
+    if (frame->mode != UART_FRAME_LENGTH) {
+        if (frame->state != FRAME_DISCARD)
+            frameDrop(frame, false);
+        return;
+    }
+    switch (frame->state) {
+        case FRAME_DATA:
+            frameDrop(frame, false);
+            frame->remaining = remaining;
+            break;
+        case FRAME_DISCARD:
+            break;
+        default:
+            // A bad length byte, there is nothing to stay in sync with
+            frame->dropped++;
+            frame->state = FRAME_IDLE;
+            return;
+    }
+    if (!--frame->remaining)
+        frame->state = FRAME_IDLE;
+}
+
+uint32_t uartFrameFeed(uartFrame_t *frame, const uint8_t *data, uint32_t len,
+        bool *complete)
+{
+    uint32_t i;
+    bool done = false;
+
+    if (frame->state == FRAME_DONE)
+        uartFrameReset(frame);
+    for (i = 0; i < len && !done; i++) {
+        switch (frame->mode) {
+            case UART_FRAME_SLIP:
+                done = slipByte(frame, data[i]);
+                break;
+            case UART_FRAME_COBS:
+                done = cobsByte(frame, data[i]);
+                break;
+            case UART_FRAME_LENGTH:
+                done = lengthByte(frame, data[i]);
+                break;
+            default:
+                break;
+        }
+    }
+    if (done && !frameCheck(frame)) {
+        uartFrameReset(frame);
+        done = false;
+    }
+    // An empty frame would read as no frame at all, COBS 0x01 0x00 or a
+    // trailer without payload
+    if (done && !frame->len) {
+        frame->dropped++;
+        uartFrameReset(frame);
+        done = false;
+    }
+    if (done)
+        frame->state = FRAME_DONE;
+    *complete = done;
+    return i;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Incremental frame decoder for the uart receive path. Bytes are fed in as
+ * the interrupt drains them and whole frames come out, so tasks only see
+ * complete messages. Frames that are malformed or do not fit the frame
+ * buffer are dropped here. With a CRC the decoder runs it over each byte as
+ * it is stored, lagging the CRC size behind, so the trailer is checked and
+ * stripped in one step when the frame ends.
+ *
+ * SLIP     Frames end with 0xC0, 0xDB escapes 0xC0 (0xDB 0xDC) and itself
+ *          (0xDB 0xDD), see RFC 1055.
+ * COBS     Consistent overhead byte stuffing, frames end with 0x00.
+ * LENGTH   A length byte followed by that many payload bytes.
+ */
+
+#ifndef UART_FRAME_H
+#define	UART_FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "drv_uart.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uartFraming_t mode;     /**<Framing in use*/
+    uint8_t *buf;           /**<Frame being assembled*/
+    uint16_t size;          /**<Size of buf*/
+    uint16_t len;           /**<Bytes assembled so far*/
+    uint16_t remaining;     /**<COBS: bytes left in the block, LENGTH: payload bytes left*/
+    uint8_t code;           /**<COBS: code of the current block*/
+    uint8_t state;          /**<Decoder state, see drv_uartFrame.c*/
+    uartCrc_t crcType;      /**<CRC at the end of each frame*/
+    uint32_t crc;           /**<CRC over all but the last CRC size bytes stored*/
+    uint32_t dropped;       /**<Malformed, oversized or empty frames*/
+    uint32_t crcErrors;     /**<Frames with a wrong CRC*/
+} uartFrame_t;
+
+/**
+ * Initialise a frame decoder on top of caller provided storage.
+ * @param frame Decoder to initialise.
+ * @param mode  Framing to decode.
+ * @param crc   CRC ending each frame, UART_CRC_NONE for none.
+ * @param buf   Storage for one frame.
+ * @param size  Size of buf, the largest frame accepted including the CRC.
+ */
+void uartFrameInit(uartFrame_t *frame, uartFraming_t mode, uartCrc_t crc,
+        uint8_t *buf, uint16_t size);
+
+/**
+ * Feed received bytes to the decoder. Decoding stops after the byte that
+ * completes a frame, the frame is then in frame->buf and frame->len until the
+ * next call. A CRC is already checked and left out of frame->len, a frame
+ * that is empty without it is dropped.
+ * @param frame     Decoder.
+ * @param data      Received bytes.
+ * @param len       Number of received bytes.
+ * @param complete  Set if a frame was completed.
+ * @return Number of bytes consumed.
+ */
+uint32_t uartFrameFeed(uartFrame_t *frame, const uint8_t *data, uint32_t len,
+        bool *complete);
+
+/**
+ * Throw away a partially received frame.
+ * @param frame Decoder.
+ */
+void uartFrameReset(uartFrame_t *frame);
+
+/**
+ * Drop the frame a byte with a line error belongs to, in place of feeding the
+ * byte. SLIP and COBS skip to the next delimiter, LENGTH skips the rest of
+ * the payload.
+ * @param frame Decoder.
+ */
+void uartFrameDiscard(uartFrame_t *frame);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* UART_FRAME_H */
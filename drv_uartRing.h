@@ -0,0 +1,219 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Lock-free single producer, single consumer byte ring used for the uart
+ * receive and transmit buffers. One side is always an interrupt handler, the
+ * other a task. The capacity is a power of two and the head and tail indices
+ * run freely, so the fill level is simply head - tail and every slot can be
+ * used. Each side only writes its own index and publishes it once per bulk
+ * copy.
+ */
+
+#ifndef UART_RING_H
+#define	UART_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// The PIC32 has a single core, only the compiler has to keep the order.
+#if defined(__mips__)
+#define uartRingBarrier()   __asm__ __volatile__("" ::: "memory")
+#else
+#define uartRingBarrier()   __sync_synchronize()
+#endif
+
+typedef struct {
+    uint8_t *buf;               /**<Storage, size is mask + 1*/
+    uint32_t mask;              /**<Capacity - 1*/
+    volatile uint32_t head;     /**<Write index, only changed by the producer*/
+    volatile uint32_t tail;     /**<Read index, only changed by the consumer*/
+} uartRing_t;
+
+/**
+ * Round a buffer size up to the next power of two.
+ * @param size  Requested size.
+ * @return Capacity to allocate for the ring.
+ */
+static inline uint32_t uartRingSize(uint32_t size)
+{
+    uint32_t capacity = 1;
+    while (capacity < size)
+        capacity <<= 1;
+    return capacity;
+}
+
+/**
+ * Round a buffer size down to a power of two, for storage that is already
+ * allocated.
+ * @param size  Size of the storage.
+ * @return Capacity of a ring on top of the storage, 0 if size is 0.
+ */
+static inline uint32_t uartRingFit(uint32_t size)
+{
+    uint32_t capacity = 1;
+    if (!size)
+        return 0;
+    while (capacity <= size / 2)
+        capacity <<= 1;
+    return capacity;
+}
+
+/**
+ * Initialise a ring on top of caller provided storage.
+ * @param ring      Ring to initialise.
+ * @param buf       Storage for the ring.
+ * @param capacity  Size of buf, must be a power of two.
+ */
+static inline void uartRingInit(uartRing_t *ring, uint8_t *buf, uint32_t capacity)
+{
+    ring->buf = buf;
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+static inline uint32_t uartRingCount(const uartRing_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+static inline uint32_t uartRingFree(const uartRing_t *ring)
+{
+    return ring->mask + 1 - (ring->head - ring->tail);
+}
+
+/**
+ * Copy bytes into the ring, producer side.
+ * @param ring  Ring to write to.
+ * @param data  Bytes to copy.
+ * @param len   Number of bytes to copy.
+ * @return Number of bytes copied, less than len if the ring filled up.
+ */
+static inline uint32_t uartRingWrite(uartRing_t *ring, const uint8_t *data,
+        uint32_t len)
+{
+    uint32_t head = ring->head;
+    uint32_t space = ring->mask + 1 - (head - ring->tail);
+    uint32_t offset = head & ring->mask;
+    uint32_t first;
+
+    if (len > space)
+        len = space;
+    first = ring->mask + 1 - offset;
+    if (first > len)
+        first = len;
+    uartRingBarrier();
+    memcpy(ring->buf + offset, data, first);
+    memcpy(ring->buf, data + first, len - first);
+    uartRingBarrier();
+    ring->head = head + len;
+    return len;
+}
+
+/**
+ * Copy bytes out of the ring, consumer side.
+ * @param ring  Ring to read from.
+ * @param data  Buffer to copy into.
+ * @param len   Size of the buffer.
+ * @return Number of bytes copied.
+ */
+static inline uint32_t uartRingRead(uartRing_t *ring, uint8_t *data, uint32_t len)
+{
+    uint32_t tail = ring->tail;
+    uint32_t count = ring->head - tail;
+    uint32_t offset = tail & ring->mask;
+    uint32_t first;
+
+    if (len > count)
+        len = count;
+    first = ring->mask + 1 - offset;
+    if (first > len)
+        first = len;
+    uartRingBarrier();
+    memcpy(data, ring->buf + offset, first);
+    memcpy(data + first, ring->buf, len - first);
+    uartRingBarrier();
+    ring->tail = tail + len;
+    return len;
+}
+
+/**
+ * Get the largest contiguous readable block without consuming it.
+ * @param ring  Ring to read from.
+ * @param data  Set to the first readable byte.
+ * @return Number of bytes readable at data.
+ */
+static inline uint32_t uartRingSpan(const uartRing_t *ring, const uint8_t **data)
+{
+    uint32_t tail = ring->tail;
+    uint32_t count = ring->head - tail;
+    uint32_t offset = tail & ring->mask;
+
+    if (count > ring->mask + 1 - offset)
+        count = ring->mask + 1 - offset;
+    uartRingBarrier();
+    *data = ring->buf + offset;
+    return count;
+}
+
+/**
+ * Get all readable bytes as at most two contiguous blocks, the second one
+ * starts at the beginning of the storage when the data wraps.
+ * @param ring  Ring to read from.
+ * @param data  Set to the start of both blocks.
+ * @param len   Set to the length of both blocks, len[1] is 0 without a wrap.
+ * @return Total number of readable bytes.
+ */
+static inline uint32_t uartRingSpans(const uartRing_t *ring,
+        const uint8_t *data[2], uint32_t len[2])
+{
+    uint32_t tail = ring->tail;
+    uint32_t count = ring->head - tail;
+    uint32_t offset = tail & ring->mask;
+    uint32_t first = ring->mask + 1 - offset;
+
+    if (first > count)
+        first = count;
+    uartRingBarrier();
+    data[0] = ring->buf + offset;
+    len[0] = first;
+    data[1] = ring->buf;
+    len[1] = count - first;
+    return count;
+}
+
+/**
+ * Consume bytes previously looked at with uartRingSpan.
+ * @param ring  Ring to consume from.
+ * @param len   Number of bytes to drop, at most uartRingCount.
+ */
+static inline void uartRingSkip(uartRing_t *ring, uint32_t len)
+{
+    uartRingBarrier();
+    ring->tail += len;
+}
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* UART_RING_H */
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "drv_uartServo.h"
+#include <string.h>
+#include <xc.h>
+
+#define SERVO_HEADER        0xFF
+#define SERVO_BROADCAST     0xFE
+#define SERVO_READ          0x02
+#define SERVO_SYNC_WRITE    0x83
+#define SERVO_PARAMS_MAX    253     /**<Length byte 255 minus instruction and checksum*/
+#define SERVO_READ_SIZE     8       /**<Read request, header to checksum*/
+#define SERVO_STATUS_SIZE   6       /**<Status packet without parameters*/
+#define SERVO_CHAR_BITS     10      /**<Start, 8 data and stop bit*/
+#define SERVO_TICKS_PER_US  (SYS_CLK_FREQ / 2000000)    /**<Core timer runs at half the system clock*/
+
+/**
+ * Fill in the header, length and checksum of a packet whose parameters are
+ * already in place.
+ * @param packet    Packet buffer, parameters start at offset 5.
+ * @param id        Servo id or SERVO_BROADCAST.
+ * @param instr     Instruction.
+ * @param params    Number of parameters.
+ * @return Size of the packet.
+ */
+static uint32_t servoPacket(uint8_t *packet, uint8_t id, uint8_t instr,
+        uint32_t params)
+{
+    uint8_t sum = 0;
+    uint32_t i;
+
+    packet[0] = SERVO_HEADER;
+    packet[1] = SERVO_HEADER;
+    packet[2] = id;
+    packet[3] = params + 2;
+    packet[4] = instr;
+    for (i = 2; i < params + 5; i++)
+        sum += packet[i];
+    packet[params + 5] = ~sum;
+    return params + 6;
+}
+
+/**
+ * Check a status packet of a servo.
+ * @param reply     Received packet.
+ * @param id        Servo that was asked.
+ * @param params    Expected number of parameters.
+ * @return True if the header, id, length and checksum are right.
+ */
+static bool servoStatusValid(const uint8_t *reply, uint8_t id, uint8_t params)
+{
+    uint8_t sum = 0;
+    uint32_t i;
+
+    if (reply[0] != SERVO_HEADER || reply[1] != SERVO_HEADER ||
+            reply[2] != id || reply[3] != params + 2)
+        return false;
+    for (i = 2; i < params + 5u; i++)
+        sum += reply[i];
+    sum = ~sum;
+    return reply[params + 5] == sum;
+}
+
+/**
+ * Send the targets of a group of servos as one sync-write packet, it queues
+ * behind whatever is still on the line.
+ * @param bus       Servo bus.
+ * @param targets   writeLen bytes for every servo.
+ * @param first     Position of the first servo of the group in ids.
+ * @param n         Servos in the group.
+ * @return Bytes put on the line.
+ */
+static uint32_t servoSyncWrite(drv_uartServoBus_t *bus, const uint8_t *targets,
+        uint32_t first, uint32_t n)
+{
+    const drv_uartServoConfig_t *config = &bus->config;
+    uint8_t *params = &bus->packet[5];
+    uint32_t size, i;
+
+    params[0] = config->writeAddr;
+    params[1] = config->writeLen;
+    for (i = 0; i < n; i++) {
+        params[2 + i * (config->writeLen + 1u)] = config->ids[first + i];
+        memcpy(&params[3 + i * (config->writeLen + 1u)],
+                &targets[(first + i) * config->writeLen], config->writeLen);
+    }
+    size = servoPacket(bus->packet, SERVO_BROADCAST, SERVO_SYNC_WRITE,
+            2 + n * (config->writeLen + 1u));
+    drv_uartWrite(config->uart, bus->packet, size);
+    return size;
+}
+
+/**
+ * Get the bytes the sync-write packets for a number of servos take.
+ * @param bus       Servo bus.
+ * @param servos    Servos still to write.
+ */
+static uint32_t servoSyncSize(const drv_uartServoBus_t *bus, uint32_t servos)
+{
+    uint32_t packets = (servos + bus->group - 1) / bus->group;
+
+    // Header, id, length, instruction, address, data length and checksum
+    return packets * 8 + servos * (bus->config.writeLen + 1u);
+}
+
+/**
+ * Read the status of one servo.
+ * @param bus       Servo bus.
+ * @param index     Position of the servo in ids.
+ * @param leadTicks Core timer ticks the line stays busy with earlier packets.
+ * @return True if a valid status came back.
+ */
+static bool servoPoll(drv_uartServoBus_t *bus, uint8_t index,
+        uint32_t leadTicks)
+{
+    const drv_uartServoConfig_t *config = &bus->config;
+    uint8_t reply[SERVO_STATUS_SIZE + SERVO_DATA_MAX];
+    uint8_t id = config->ids[index];
+    uint32_t size = SERVO_STATUS_SIZE + config->readLen;
+    // The timeout runs from queueing, the request may wait for the line
+    uint32_t leadMs = ((leadTicks + bus->pollTicks) / SERVO_TICKS_PER_US +
+            999) / 1000;
+
+    bus->packet[5] = config->readAddr;
+    bus->packet[6] = config->readLen;
+    servoPacket(bus->packet, id, SERVO_READ, 2);
+    bus->stats.polls++;
+    if (drv_uartTransact(config->uart, bus->packet, SERVO_READ_SIZE, reply,
+            size, pdMS_TO_TICKS(leadMs) + config->replyTimeout) != size ||
+            !servoStatusValid(reply, id, config->readLen)) {
+        bus->stats.timeouts++;
+        return false;
+    }
+    bus->error[index] = reply[4];
+    memcpy(bus->status[index], &reply[5], config->readLen);
+    bus->age[index] = 0;
+    return true;
+}
+
+/**
+ * Read the status of the servo whose turn it is, if the read ends in time.
+ * @param bus       Servo bus.
+ * @param start     Core timer count at the start of the cycle.
+ * @param busy      Ticks into the cycle the line is taken until, moved past
+ *                  the read.
+ * @param limit     Ticks into the cycle the read has to end by.
+ * @param report    Counts the answered reads and the timeouts.
+ * @return False if the read did not fit.
+ */
+static bool servoPollNext(drv_uartServoBus_t *bus, uint32_t start,
+        uint32_t *busy, uint32_t limit, drv_uartServoReport_t *report)
+{
+    uint32_t now = _CP0_GET_COUNT() - start;
+
+    if (*busy < now)
+        *busy = now;
+    if (*busy + bus->pollTicks > limit)
+        return false;
+    if (servoPoll(bus, bus->next, *busy - now))
+        report->polled++;
+    else
+        report->timeouts++;
+    *busy = _CP0_GET_COUNT() - start;
+    bus->next = (bus->next + 1) % bus->config.count;
+    return true;
+}
+
+bool drv_uartServoInit(drv_uartServoBus_t *bus,
+        const drv_uartServoConfig_t *config)
+{
+    uint32_t baud = drv_uartGetBaud(config->uart, NULL);
+    uint32_t chars = SERVO_READ_SIZE + SERVO_STATUS_SIZE + config->readLen;
+
+    if (!config->count || config->count > SERVO_MAX || !baud ||
+            !config->writeLen || config->writeLen > SERVO_DATA_MAX ||
+            config->readLen > SERVO_DATA_MAX)
+        return false;
+    memset(bus, 0, sizeof (drv_uartServoBus_t));
+    bus->config = *config;
+    bus->group = (SERVO_PARAMS_MAX - 2) / (config->writeLen + 1u);
+    if (config->syncGroup && config->syncGroup < bus->group)
+        bus->group = config->syncGroup;
+    // Both packets plus one character of slack for the turnaround
+    bus->pollTicks = (uint64_t)(chars + 1) * SERVO_CHAR_BITS * SERVO_TICKS_PER_US *
+            1000000 / baud + config->replyDelayUs * SERVO_TICKS_PER_US;
+    memset(bus->age, 0xFF, sizeof (bus->age));
+    return true;
+}
+
+bool drv_uartServoCycle(drv_uartServoBus_t *bus, const uint8_t *targets,
+        drv_uartServoReport_t *report)
+{
+    const drv_uartServoConfig_t *config = &bus->config;
+    uint32_t start = _CP0_GET_COUNT();
+    uint32_t budget = config->periodUs * SERVO_TICKS_PER_US;
+    uint32_t charTicks = bus->pollTicks / (SERVO_READ_SIZE +
+            SERVO_STATUS_SIZE + config->readLen + 1);
+    drv_uartServoReport_t cycle = {0};
+    uint32_t busy = 0, asked = 0, rest, now, n, i;
+
+    for (i = 0; i < config->count; i++) {
+        if (bus->age[i] != UINT32_MAX)
+            bus->age[i]++;
+    }
+    for (i = 0; i < config->count; i += n) {
+        n = config->count - i < bus->group ? config->count - i : bus->group;
+        now = _CP0_GET_COUNT() - start;
+        if (busy < now)
+            busy = now;
+        // The packet is still on the line when the next one or a poll is queued
+        busy += servoSyncWrite(bus, targets, i, n) * charTicks;
+        // A status read goes in between if the packets left still make it
+        rest = servoSyncSize(bus, config->count - i - n) * charTicks;
+        if (i + n < config->count && asked < config->count && rest < budget &&
+                servoPollNext(bus, start, &busy, budget - rest, &cycle))
+            asked++;
+    }
+    while (asked < config->count &&
+            servoPollNext(bus, start, &busy, budget, &cycle))
+        asked++;
+    now = _CP0_GET_COUNT() - start;
+    if (busy < now)
+        busy = now;
+    cycle.cycleUs = busy / SERVO_TICKS_PER_US;
+    cycle.written = config->count;
+    cycle.missed = busy > budget;
+    bus->stats.cycles++;
+    if (cycle.missed)
+        bus->stats.missedDeadlines++;
+    if (cycle.cycleUs > bus->stats.maxCycleUs)
+        bus->stats.maxCycleUs = cycle.cycleUs;
+    if (report)
+        *report = cycle;
+    return !cycle.missed;
+}
+
+uint32_t drv_uartServoStatus(const drv_uartServoBus_t *bus, uint8_t index,
+        const uint8_t **data)
+{
+    *data = bus->status[index];
+    return bus->age[index];
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Servo bus scheduler on top of a half-duplex uart, for Dynamixel protocol 1
+ * servos. Every cycle sends the targets of all servos as broadcast sync-write
+ * packets, which need no reply. Status reads go between the packets as long
+ * as the remaining packets still make the deadline, and fill the time left
+ * after the last one. They take one servo after the other and continue where
+ * the previous cycle stopped, so every servo is polled regularly.
+ *
+ * Packet  0xFF 0xFF id length instruction parameters checksum
+ *         length counts the instruction, parameters and checksum, the
+ *         checksum is the inverted low byte of the sum from id on.
+ * Status  0xFF 0xFF id length error parameters checksum
+ */
+
+#ifndef UART_SERVO_H
+#define	UART_SERVO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "drv_uart.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define SERVO_MAX           32      /**<Servos on one bus*/
+#define SERVO_DATA_MAX      8       /**<Largest target or status block of a servo*/
+#define SERVO_PACKET_MAX    (6 + 253)
+
+typedef struct {
+    drv_uartHandle_t uart;              /**<Half-duplex uart of the bus, with echo suppression if the line echoes*/
+    const uint8_t *ids;                 /**<Id of every servo, targets and status follow this order*/
+    uint8_t count;                      /**<Number of servos, at most SERVO_MAX*/
+    uint8_t writeAddr;                  /**<Control table address of the targets, for example the goal position*/
+    uint8_t writeLen;                   /**<Target bytes per servo, 1 - SERVO_DATA_MAX*/
+    uint8_t syncGroup;                  /**<Servos per sync-write packet, a status read can follow each packet. 0 fills every packet*/
+    uint8_t readAddr;                   /**<Control table address of the status, for example the present position*/
+    uint8_t readLen;                    /**<Status bytes per servo, at most SERVO_DATA_MAX*/
+    uint32_t periodUs;                  /**<Length of a cycle, its end is the deadline*/
+    uint32_t replyDelayUs;              /**<Return delay time set in the servos*/
+    uint32_t replyTimeout;              /**<Ticks to wait for a status reply before the servo is skipped*/
+} drv_uartServoConfig_t;
+
+typedef struct {
+    uint32_t cycleUs;                   /**<Time the cycle took*/
+    uint8_t written;                    /**<Servos that got their target*/
+    uint8_t polled;                     /**<Status reads that were answered*/
+    uint8_t timeouts;                   /**<Status reads without a valid reply*/
+    bool missed;                        /**<The cycle ended after its deadline*/
+} drv_uartServoReport_t;
+
+typedef struct {
+    uint32_t cycles;                    /**<Cycles run*/
+    uint32_t missedDeadlines;           /**<Cycles that ended after their deadline*/
+    uint32_t polls;                     /**<Status reads sent*/
+    uint32_t timeouts;                  /**<Status reads without a valid reply*/
+    uint32_t maxCycleUs;                /**<Longest cycle*/
+} drv_uartServoStats_t;
+
+typedef struct {
+    drv_uartServoConfig_t config;
+    uint8_t next;                       /**<Servo polled first in the next cycle*/
+    uint8_t group;                      /**<Servos per sync-write packet*/
+    uint32_t pollTicks;                 /**<Core timer ticks one status read takes on the line*/
+    uint8_t status[SERVO_MAX][SERVO_DATA_MAX];  /**<Last status read of every servo*/
+    uint8_t error[SERVO_MAX];           /**<Error byte of the last status of every servo*/
+    uint32_t age[SERVO_MAX];            /**<Cycles since the status of every servo was read*/
+    drv_uartServoStats_t stats;
+    uint8_t packet[SERVO_PACKET_MAX];   /**<Packet being assembled*/
+} drv_uartServoBus_t;
+
+/**
+ * Initialise a servo bus, the uart must already be configured.
+ * @param bus       Bus to initialise.
+ * @param config    Servos, registers and timing of the bus.
+ * @return False if the config exceeds SERVO_MAX or SERVO_DATA_MAX or has no
+ *         target bytes.
+ */
+bool drv_uartServoInit(drv_uartServoBus_t *bus,
+        const drv_uartServoConfig_t *config);
+
+/**
+ * Run one cycle: send all targets as sync writes and read the status of as
+ * many servos as fit before the deadline, between the packets and after them.
+ * @param bus       Servo bus.
+ * @param targets   writeLen bytes for every servo, in the order of ids.
+ * @param report    Filled with the result of the cycle, may be NULL.
+ * @return False if the cycle missed its deadline.
+ */
+bool drv_uartServoCycle(drv_uartServoBus_t *bus, const uint8_t *targets,
+        drv_uartServoReport_t *report);
+
+/**
+ * Get the last status read from a servo.
+ * @param bus       Servo bus.
+ * @param index     Position of the servo in ids.
+ * @param data      Set to readLen status bytes.
+ * @return Cycles since the status was read, UINT32_MAX if never.
+ */
+uint32_t drv_uartServoStatus(const drv_uartServoBus_t *bus, uint8_t index,
+        const uint8_t **data);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* UART_SERVO_H */
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Definition of the uart instance, for applications that allocate it
+ * themselves. Declare the instance and its buffers at file scope with
+ * DRV_UART_STATIC and pass them to drv_uartNewStatic, nothing is taken from
+ * the heap then. Routes for drv_uartRouteAdd are declared here as well.
+ * Everything else should only use drv_uart.h, the fields below are private to
+ * the driver.
+ */
+
+#ifndef UART_STATIC_H
+#define	UART_STATIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "drv_uart.h"
+#include "drv_uartFrame.h"
+#include "drv_uartRing.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define UART_TX_ENDS    8   /**<Writes per lane whose end is tracked*/
+#define UART_RX_STAMPS  16  /**<Receive interrupts told apart in the receive ring*/
+
+typedef struct uartPort uartPort_t;
+typedef struct uartDmaRegs uartDmaRegs_t;
+
+typedef struct {
+    uint32_t end[UART_TX_ENDS];         /**<Ring index after each queued write*/
+    uint32_t stamp[UART_TX_ENDS];       /**<Core timer count when the write was queued*/
+    uint8_t head;                       /**<Next entry to fill*/
+    uint8_t tail;                       /**<Oldest entry*/
+    uint32_t last;                      /**<End of the last write taken by the transmitter*/
+} uartTxEnds_t;
+
+typedef struct {
+    uint32_t start[UART_RX_STAMPS];     /**<Ring index of the first byte of each batch*/
+    uint32_t stamp[UART_RX_STAMPS];     /**<Core timer count when the batch was read from the FIFO*/
+    uint8_t head;                       /**<Next entry to fill*/
+    uint8_t tail;                       /**<Oldest entry*/
+} uartRxStamps_t;
+
+typedef struct {
+    uint8_t *data;                      /**<Caller's buffer, NULL while no request is pending. Only read by writes*/
+    uint32_t len;                       /**<Bytes requested*/
+    uint32_t done;                      /**<Bytes moved so far*/
+    drv_uartAsyncHandler_t onDone;      /**<Completion callback, may be NULL*/
+    void *context;                      /**<Passed to onDone*/
+    uint32_t stamp;                     /**<Core timer count when a write was started*/
+} uartAsync_t;
+
+struct drv_uartRoute {
+    drv_uartRoute_t *next;              /**<Route matched after this one*/
+    uint8_t offset;                     /**<Byte of the frame that is matched*/
+    uint8_t mask;                       /**<Bits of that byte to compare*/
+    uint8_t value;                      /**<Value of the masked bits*/
+    uartRoutePolicy_t policy;           /**<What to do with a frame when the route is full*/
+    uartRing_t frames;                  /**<Frames as a length byte and the payload*/
+    TaskHandle_t waiter;                /**<Task sleeping in drv_uartRouteRead*/
+    uint32_t dropped;                   /**<Frames lost to the overflow policy*/
+};
+
+struct drv_uartHandle {
+    uartDevices_t uartDev;              /**<Uart module of the instance*/
+    const uartPort_t *port;             /**<Registers and interrupt bits of the uart device*/
+    bool blocking : 1;                  /**<Use interrupts? must be on(1) for now*/
+    bool heap : 1;                      /**<Created by drv_uartNew, drv_uartDestroy frees the instance*/
+    bool halfDuplex : 1;                /**<One wire, the transmitter is switched off after each burst*/
+    bool echo : 1;                      /**<The line returns transmitted bytes*/
+    bool hdxTx : 1;                     /**<Half-duplex line is driven by the transmitter*/
+    bool lineStatus : 1;                /**<Flag received bytes with line errors*/
+    bool stamps : 1;                    /**<Record when received bytes and frames arrived*/
+    drv_uartEventHandler_t onReceive;   /**<Function to execute if the receive buffer is full*/
+    uartRing_t rx;                      /**<Software receive buffer, filled by the ISR*/
+    uint8_t *rxStatus;                  /**<Error bit per byte of the receive buffer, NULL if not kept*/
+    bool rxGap;                         /**<Bytes were lost, flag the next one stored*/
+    uint32_t rxStamp;                   /**<Core timer count when the receive interrupt last read the FIFO*/
+    uartRxStamps_t rxStamps;            /**<Arrival times of the batches in the receive ring*/
+    uint8_t rxReadMax;                  /**<Most bytes drv_uartTryGets returns at once*/
+    uint32_t rxTrigger;                 /**<Bytes to buffer before a waiting task is woken*/
+    TaskHandle_t rxWaiter;              /**<Task sleeping in drv_uartWaitRx or a read*/
+    uint32_t rxWant;                    /**<Bytes the sleeping reader needs, 0 uses rxTrigger*/
+    uartRing_t tx;                      /**<Software transmit buffer, no storage to write the FIFO directly*/
+    TaskHandle_t txWaiter;              /**<Task sleeping until the ring has room or an asynchronous write completed*/
+    bool txQueuing;                     /**<A task is copying a write into the transmit ring*/
+    uartRing_t txUrgent;                /**<Urgent transmit lane, no storage for a single lane*/
+    TaskHandle_t txUrgentWaiter;        /**<Task sleeping until the urgent ring has room*/
+    uartTxEnds_t txEnds[UART_TX_LANES]; /**<Write boundaries of both lanes*/
+    uartDmaRegs_t *rxDma;               /**<Channel filling the receive ring, NULL in interrupt mode*/
+    uartDmaRegs_t *txDma;               /**<Channel draining the transmit ring, NULL in interrupt mode*/
+    uint32_t txDmaLen;                  /**<Bytes in the running transmit transfer, 0 if idle*/
+    uint8_t txDmaLane;                  /**<Lane of the running transmit transfer*/
+    uartFrame_t frame;                  /**<Frame decoder, UART_FRAME_NONE passes raw bytes*/
+    uartCrc_t crc;                      /**<CRC checked by the decoder and appended by drv_uartWriteCrc*/
+    uartRing_t frames;                  /**<Complete frames as a length byte and the payload*/
+    drv_uartRoute_t *routes;            /**<Frame routes in match order*/
+    uartFifoSizes_t rxFifoSize;         /**<Receive interrupt level while bytes are arriving*/
+    bool rxAdaptive;                    /**<rxFifoSize follows the byte arrival rate*/
+    uint8_t rxTier;                     /**<Adaptive level, index into uartFifoTiers*/
+    uint16_t rxRate;                    /**<Average character times between received bytes, in 1/16*/
+    uint32_t rxLastIsr;                 /**<Core timer at the previous receive interrupt*/
+    uint32_t baud;                      /**<Requested baudrate*/
+    uint32_t bitClocks;                 /**<Peripheral clocks per bit at the current baudrate*/
+    uint8_t idleTimer;                  /**<Timer 2 - 5 detecting the idle line, 0 if disabled*/
+    uint8_t idleChars;                  /**<Character times of silence that make the line idle*/
+    bool rxActive;                      /**<Bytes arrived since the line was last idle*/
+    bool rxSeen;                        /**<Receive interrupt since the previous idle check*/
+    uint32_t rxDmaMark;                 /**<Receive DMA pointer at the previous idle check*/
+    volatile uint32_t *dirLat;          /**<LATx of the direction pin, NULL without one*/
+    uint32_t dirMask;                   /**<Bit of the direction pin*/
+    uint32_t echoSkip;                  /**<Transmitted bytes whose echo is still due*/
+    uartFlowControl_t flow;             /**<Flow control towards and from the peer*/
+    uint32_t rxHigh;                    /**<Buffered bytes that pause the peer*/
+    uint32_t rxLow;                     /**<Buffered bytes that resume the peer*/
+    bool rxPaused;                      /**<The peer was told to stop sending*/
+    bool txPaused;                      /**<The peer sent XOFF, transmitting waits for XON*/
+    uint8_t flowChar;                   /**<XON or XOFF waiting for room in the FIFO, 0 if none*/
+    uartAsync_t rxAsync;                /**<Pending drv_uartReadAsync*/
+    uartAsync_t txAsync;                /**<Pending drv_uartWriteAsync*/
+    uint8_t events;                     /**<Completions not yet collected by drv_uartWaitAny, see uartEvents_t*/
+    TaskHandle_t eventWaiter;           /**<Task sleeping in drv_uartWaitAny*/
+#if DRV_UART_STATS
+    drv_uartStats_t stats;              /**<Counters, the derived fields are filled by drv_uartGetStats*/
+    uint64_t isrTicks;                  /**<Core timer ticks spent in interrupts*/
+    uint32_t isrMaxTicks;               /**<Core timer ticks of the longest interrupt*/
+    uint64_t txLatencyTicks[UART_TX_LANES]; /**<Core timer ticks writes spent queued*/
+    uint32_t txLatencyCount[UART_TX_LANES]; /**<Writes whose latency was measured*/
+    uint32_t txLatencyMax[UART_TX_LANES];   /**<Core timer ticks of the slowest write*/
+#endif
+};
+
+/**
+ * Declare a uart instance and its buffers at file scope, name is the
+ * drv_uartStorage_t to pass to drv_uartNewStatic. Ring sizes should be powers
+ * of two, other sizes waste the remainder. Sizes of 0 leave a buffer out.
+ * @param name              Name of the storage descriptor.
+ * @param rxSize            Receive ring.
+ * @param txSize            Transmit ring, 0 to write the hardware FIFO directly.
+ * @param frameSize         Largest decoded frame, 0 without framing.
+ * @param frameQueueSize    Frame queue, 0 without framing or with onReceive.
+ * @param lineStatus        Keep the line status bits for the receive ring,
+ *                          another rxSize / 8 bytes. Needs the lineStatus
+ *                          config without framing.
+ */
+#define DRV_UART_STATIC(name, rxSize, txSize, frameSize, frameQueueSize, \
+        lineStatus) \
+    static struct drv_uartHandle name##Handle; \
+    static uint8_t name##Rx[rxSize]; \
+    static uint8_t name##Tx[(txSize) ? (txSize) : 1]; \
+    static uint8_t name##Frame[(frameSize) ? (frameSize) : 1]; \
+    static uint8_t name##Frames[(frameQueueSize) ? (frameQueueSize) : 1]; \
+    static uint8_t name##Status[(lineStatus) ? ((rxSize) + 7) / 8 : 1]; \
+    static const drv_uartStorage_t name = { \
+        &name##Handle, name##Rx, (rxSize), name##Tx, (txSize), \
+        name##Frame, (frameSize), name##Frames, (frameQueueSize), \
+        (lineStatus) ? name##Status : NULL, NULL, 0 \
+    }
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* UART_STATIC_H */
@@ -49,10 +49,11 @@ static void uartThread(void *args)
         .baud = BAUD9600,
         .dataBits = NOPAR_8BIT,
         .fifoSize = FIFO_FULL,
-        .isBlocking = false,
+        .isBlocking = true,
         .uartDev = UART_DEV1,
-        .intPriority = 5,
+        .intPriority = DRV_UART_IPL,
         .bufferSize = 20,
+        .txBufferSize = 32,
         .stopBits = ONESTOP,
         .onReceive = uartHandler
     };
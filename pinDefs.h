@@ -40,6 +40,11 @@ typedef void* bundle;
 #define SYS_CLK_FREQ      64000000
 #endif //SYS_CLK_FREQ
 
+// peripheral bus clock, FPBDIV = DIV_2 in main.c
+#ifndef PB_CLK_FREQ
+#define PB_CLK_FREQ       (SYS_CLK_FREQ / 2)
+#endif //PB_CLK_FREQ
+
 // leds
 #define LEDS 4    
 
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for the FreeRTOS kernel headers, backed by pthreads in
+ * sim_rtos.c. Only the calls used by the hexapod drivers are provided.
+ * Interrupt masking is modelled by one recursive lock that the simulated
+ * interrupt thread holds while a handler runs.
+ */
+
+#ifndef SIM_FREERTOS_H
+#define	SIM_FREERTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 ((BaseType_t)0)
+#define pdTRUE                  ((BaseType_t)1)
+#define pdFAIL                  pdFALSE
+#define pdPASS                  pdTRUE
+#define errQUEUE_EMPTY          ((BaseType_t)0)
+#define errQUEUE_FULL           ((BaseType_t)0)
+
+#define configTICK_RATE_HZ      1000
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS      ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+void sim_enterCritical(void);
+void sim_exitCritical(void);
+void sim_yieldFromIsr(BaseType_t woken);
+
+#define portENTER_CRITICAL()                sim_enterCritical()
+#define portEXIT_CRITICAL()                 sim_exitCritical()
+#define taskENTER_CRITICAL()                sim_enterCritical()
+#define taskEXIT_CRITICAL()                 sim_exitCritical()
+#define taskENTER_CRITICAL_FROM_ISR()       (sim_enterCritical(), 0)
+#define taskEXIT_CRITICAL_FROM_ISR(x)       ((void)(x), sim_exitCritical())
+#define portYIELD_FROM_ISR(woken)           sim_yieldFromIsr(woken)
+#define portEND_SWITCHING_ISR(woken)        sim_yieldFromIsr(woken)
+#define portNOP()
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SIM_FREERTOS_H */
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_QUEUE_H
+#define	SIM_QUEUE_H
+
+#include "FreeRTOS.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct QueueDefinition *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item,
+        TickType_t ticksToWait);
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t queue, const void *item,
+        BaseType_t *higherPriorityTaskWoken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer,
+        TickType_t ticksToWait);
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *buffer,
+        BaseType_t *higherPriorityTaskWoken);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#define xQueueSend(q, item, ticks)  xQueueSendToBack(q, item, ticks)
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SIM_QUEUE_H */
@@ -0,0 +1,439 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for the XC32 device header. Every special function register
+ * the UART driver touches is backed by memory in sim_uart.c, laid out like
+ * the PIC32MX795 register blocks (REG, CLR, SET, INV at 4 byte steps).
+ *
+ * Reads go through sim_sfrLoad() so side effects such as popping UxRXREG or
+ * refreshing the UxSTA status bits happen on access. C cannot hook a plain
+ * assignment, so writes are recorded in a small write log instead: the macro
+ * hands out a slot, the assignment stores into it and the simulator applies
+ * the slot on its next access. Registers that are written this way (UxTXREG,
+ * UxBRG, the CLR/SET/INV aliases) are therefore write-only.
+ *
+ * Register blocks that the driver addresses through a pointer, such as the
+ * DMA channels, are reached with SFR_READ and SFR_WRITE, which the simulator
+ * overrides to apply the same side effects immediately.
+ */
+
+#ifndef SIM_P32XXXX_H
+#define	SIM_P32XXXX_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define SIM_NUM_UARTS       6
+#define SIM_NUM_DMA         8
+#define SIM_NUM_TIMERS      4       /**<Timer 2 - 5*/
+
+typedef struct {
+    volatile uint32_t reg;
+    volatile uint32_t clr;
+    volatile uint32_t set;
+    volatile uint32_t inv;
+} __attribute__((aligned(16))) sim_sfr_t;
+
+typedef struct {
+    sim_sfr_t mode;
+    sim_sfr_t sta;
+    sim_sfr_t tx;
+    sim_sfr_t rx;
+    sim_sfr_t brg;
+} sim_uartSfr_t;
+
+typedef struct {
+    unsigned URXDA : 1;
+    unsigned OERR : 1;
+    unsigned FERR : 1;
+    unsigned PERR : 1;
+    unsigned RIDLE : 1;
+    unsigned ADDEN : 1;
+    unsigned URXISEL : 2;
+    unsigned TRMT : 1;
+    unsigned UTXBF : 1;
+    unsigned UTXEN : 1;
+    unsigned UTXBRK : 1;
+    unsigned URXEN : 1;
+    unsigned UTXINV : 1;
+    unsigned UTXISEL : 2;
+    unsigned ADDR : 8;
+    unsigned ADM_EN : 1;
+    unsigned : 7;
+} __UxSTAbits_t;
+
+typedef struct {
+    unsigned STSEL : 1;
+    unsigned PDSEL : 2;
+    unsigned BRGH : 1;
+    unsigned RXINV : 1;
+    unsigned ABAUD : 1;
+    unsigned LPBACK : 1;
+    unsigned WAKE : 1;
+    unsigned UEN : 2;
+    unsigned : 1;
+    unsigned RTSMD : 1;
+    unsigned IREN : 1;
+    unsigned SIDL : 1;
+    unsigned : 1;
+    unsigned ON : 1;
+    unsigned : 16;
+} __UxMODEbits_t;
+
+typedef struct {
+    sim_sfr_t con;
+    sim_sfr_t econ;
+    sim_sfr_t intr;
+    sim_sfr_t ssa;
+    sim_sfr_t dsa;
+    sim_sfr_t ssiz;
+    sim_sfr_t dsiz;
+    sim_sfr_t sptr;
+    sim_sfr_t dptr;
+    sim_sfr_t csiz;
+    sim_sfr_t cptr;
+    sim_sfr_t dat;
+} sim_dmaSfr_t;
+
+typedef struct {
+    sim_sfr_t con;
+    sim_sfr_t tmr;
+    sim_sfr_t pr;
+} sim_timerSfr_t;
+
+extern sim_uartSfr_t sim_uartSfr[SIM_NUM_UARTS];
+extern sim_timerSfr_t sim_timerSfr[SIM_NUM_TIMERS];
+extern sim_dmaSfr_t sim_dmaSfr[SIM_NUM_DMA];
+extern sim_sfr_t sim_dmacon;
+extern sim_sfr_t sim_ifs[3];
+extern sim_sfr_t sim_iec[3];
+extern sim_sfr_t sim_ipc[16];
+
+uint32_t sim_sfrLoad(volatile uint32_t *sfr);
+void sim_sfrStore(volatile uint32_t *sfr, uint32_t value);
+_Atomic int64_t *sim_sfrLog(volatile uint32_t *sfr);
+volatile __UxSTAbits_t *sim_uartStaBits(unsigned uart);
+volatile __UxMODEbits_t *sim_uartModeBits(unsigned uart);
+
+#define SIM_SFR_R(sfr)      sim_sfrLoad(&(sfr))
+#define SIM_SFR_W(sfr)      (*sim_sfrLog(&(sfr)))
+
+#define SFR_READ(sfr)           sim_sfrLoad(sfr)
+#define SFR_WRITE(sfr, value)   sim_sfrStore((sfr), (value))
+#define SFR_IFS0                (&sim_ifs[0])
+#define SFR_IEC0                (&sim_iec[0])
+#define SFR_IPC0                (&sim_ipc[0])
+
+// Register blocks
+#define _UART1_BASE_ADDRESS ((uintptr_t)&sim_uartSfr[0])
+#define _UART2_BASE_ADDRESS ((uintptr_t)&sim_uartSfr[1])
+#define _UART3_BASE_ADDRESS ((uintptr_t)&sim_uartSfr[2])
+#define _UART4_BASE_ADDRESS ((uintptr_t)&sim_uartSfr[3])
+#define _UART5_BASE_ADDRESS ((uintptr_t)&sim_uartSfr[4])
+#define _UART6_BASE_ADDRESS ((uintptr_t)&sim_uartSfr[5])
+#define _DMAC0_BASE_ADDRESS ((uintptr_t)&sim_dmaSfr[0])
+#define _TMR2_BASE_ADDRESS  ((uintptr_t)&sim_timerSfr[0])
+#define _TMR3_BASE_ADDRESS  ((uintptr_t)&sim_timerSfr[1])
+#define _TMR4_BASE_ADDRESS  ((uintptr_t)&sim_timerSfr[2])
+#define _TMR5_BASE_ADDRESS  ((uintptr_t)&sim_timerSfr[3])
+
+#define U1MODE          SIM_SFR_R(sim_uartSfr[0].mode.reg)
+#define U1MODECLR       SIM_SFR_W(sim_uartSfr[0].mode.clr)
+#define U1MODESET       SIM_SFR_W(sim_uartSfr[0].mode.set)
+#define U1MODEINV       SIM_SFR_W(sim_uartSfr[0].mode.inv)
+#define U1MODEbits      (*sim_uartModeBits(0))
+#define U1STA           SIM_SFR_R(sim_uartSfr[0].sta.reg)
+#define U1STACLR        SIM_SFR_W(sim_uartSfr[0].sta.clr)
+#define U1STASET        SIM_SFR_W(sim_uartSfr[0].sta.set)
+#define U1STAINV        SIM_SFR_W(sim_uartSfr[0].sta.inv)
+#define U1STAbits       (*sim_uartStaBits(0))
+#define U1TXREG         SIM_SFR_W(sim_uartSfr[0].tx.reg)
+#define U1RXREG         SIM_SFR_R(sim_uartSfr[0].rx.reg)
+#define U1BRG           SIM_SFR_W(sim_uartSfr[0].brg.reg)
+#define U1BRGCLR        SIM_SFR_W(sim_uartSfr[0].brg.clr)
+#define U1BRGSET        SIM_SFR_W(sim_uartSfr[0].brg.set)
+
+#define U2MODE          SIM_SFR_R(sim_uartSfr[1].mode.reg)
+#define U2MODECLR       SIM_SFR_W(sim_uartSfr[1].mode.clr)
+#define U2MODESET       SIM_SFR_W(sim_uartSfr[1].mode.set)
+#define U2MODEINV       SIM_SFR_W(sim_uartSfr[1].mode.inv)
+#define U2MODEbits      (*sim_uartModeBits(1))
+#define U2STA           SIM_SFR_R(sim_uartSfr[1].sta.reg)
+#define U2STACLR        SIM_SFR_W(sim_uartSfr[1].sta.clr)
+#define U2STASET        SIM_SFR_W(sim_uartSfr[1].sta.set)
+#define U2STAINV        SIM_SFR_W(sim_uartSfr[1].sta.inv)
+#define U2STAbits       (*sim_uartStaBits(1))
+#define U2TXREG         SIM_SFR_W(sim_uartSfr[1].tx.reg)
+#define U2RXREG         SIM_SFR_R(sim_uartSfr[1].rx.reg)
+#define U2BRG           SIM_SFR_W(sim_uartSfr[1].brg.reg)
+#define U2BRGCLR        SIM_SFR_W(sim_uartSfr[1].brg.clr)
+#define U2BRGSET        SIM_SFR_W(sim_uartSfr[1].brg.set)
+
+#define U3MODE          SIM_SFR_R(sim_uartSfr[2].mode.reg)
+#define U3MODECLR       SIM_SFR_W(sim_uartSfr[2].mode.clr)
+#define U3MODESET       SIM_SFR_W(sim_uartSfr[2].mode.set)
+#define U3MODEINV       SIM_SFR_W(sim_uartSfr[2].mode.inv)
+#define U3MODEbits      (*sim_uartModeBits(2))
+#define U3STA           SIM_SFR_R(sim_uartSfr[2].sta.reg)
+#define U3STACLR        SIM_SFR_W(sim_uartSfr[2].sta.clr)
+#define U3STASET        SIM_SFR_W(sim_uartSfr[2].sta.set)
+#define U3STAINV        SIM_SFR_W(sim_uartSfr[2].sta.inv)
+#define U3STAbits       (*sim_uartStaBits(2))
+#define U3TXREG         SIM_SFR_W(sim_uartSfr[2].tx.reg)
+#define U3RXREG         SIM_SFR_R(sim_uartSfr[2].rx.reg)
+#define U3BRG           SIM_SFR_W(sim_uartSfr[2].brg.reg)
+#define U3BRGCLR        SIM_SFR_W(sim_uartSfr[2].brg.clr)
+#define U3BRGSET        SIM_SFR_W(sim_uartSfr[2].brg.set)
+
+#define U4MODE          SIM_SFR_R(sim_uartSfr[3].mode.reg)
+#define U4MODECLR       SIM_SFR_W(sim_uartSfr[3].mode.clr)
+#define U4MODESET       SIM_SFR_W(sim_uartSfr[3].mode.set)
+#define U4MODEINV       SIM_SFR_W(sim_uartSfr[3].mode.inv)
+#define U4MODEbits      (*sim_uartModeBits(3))
+#define U4STA           SIM_SFR_R(sim_uartSfr[3].sta.reg)
+#define U4STACLR        SIM_SFR_W(sim_uartSfr[3].sta.clr)
+#define U4STASET        SIM_SFR_W(sim_uartSfr[3].sta.set)
+#define U4STAINV        SIM_SFR_W(sim_uartSfr[3].sta.inv)
+#define U4STAbits       (*sim_uartStaBits(3))
+#define U4TXREG         SIM_SFR_W(sim_uartSfr[3].tx.reg)
+#define U4RXREG         SIM_SFR_R(sim_uartSfr[3].rx.reg)
+#define U4BRG           SIM_SFR_W(sim_uartSfr[3].brg.reg)
+#define U4BRGCLR        SIM_SFR_W(sim_uartSfr[3].brg.clr)
+#define U4BRGSET        SIM_SFR_W(sim_uartSfr[3].brg.set)
+
+#define U5MODE          SIM_SFR_R(sim_uartSfr[4].mode.reg)
+#define U5MODECLR       SIM_SFR_W(sim_uartSfr[4].mode.clr)
+#define U5MODESET       SIM_SFR_W(sim_uartSfr[4].mode.set)
+#define U5MODEINV       SIM_SFR_W(sim_uartSfr[4].mode.inv)
+#define U5MODEbits      (*sim_uartModeBits(4))
+#define U5STA           SIM_SFR_R(sim_uartSfr[4].sta.reg)
+#define U5STACLR        SIM_SFR_W(sim_uartSfr[4].sta.clr)
+#define U5STASET        SIM_SFR_W(sim_uartSfr[4].sta.set)
+#define U5STAINV        SIM_SFR_W(sim_uartSfr[4].sta.inv)
+#define U5STAbits       (*sim_uartStaBits(4))
+#define U5TXREG         SIM_SFR_W(sim_uartSfr[4].tx.reg)
+#define U5RXREG         SIM_SFR_R(sim_uartSfr[4].rx.reg)
+#define U5BRG           SIM_SFR_W(sim_uartSfr[4].brg.reg)
+#define U5BRGCLR        SIM_SFR_W(sim_uartSfr[4].brg.clr)
+#define U5BRGSET        SIM_SFR_W(sim_uartSfr[4].brg.set)
+
+#define U6MODE          SIM_SFR_R(sim_uartSfr[5].mode.reg)
+#define U6MODECLR       SIM_SFR_W(sim_uartSfr[5].mode.clr)
+#define U6MODESET       SIM_SFR_W(sim_uartSfr[5].mode.set)
+#define U6MODEINV       SIM_SFR_W(sim_uartSfr[5].mode.inv)
+#define U6MODEbits      (*sim_uartModeBits(5))
+#define U6STA           SIM_SFR_R(sim_uartSfr[5].sta.reg)
+#define U6STACLR        SIM_SFR_W(sim_uartSfr[5].sta.clr)
+#define U6STASET        SIM_SFR_W(sim_uartSfr[5].sta.set)
+#define U6STAINV        SIM_SFR_W(sim_uartSfr[5].sta.inv)
+#define U6STAbits       (*sim_uartStaBits(5))
+#define U6TXREG         SIM_SFR_W(sim_uartSfr[5].tx.reg)
+#define U6RXREG         SIM_SFR_R(sim_uartSfr[5].rx.reg)
+#define U6BRG           SIM_SFR_W(sim_uartSfr[5].brg.reg)
+#define U6BRGCLR        SIM_SFR_W(sim_uartSfr[5].brg.clr)
+#define U6BRGSET        SIM_SFR_W(sim_uartSfr[5].brg.set)
+
+#define DMACON          SIM_SFR_R(sim_dmacon.reg)
+#define DMACONCLR       SIM_SFR_W(sim_dmacon.clr)
+#define DMACONSET       SIM_SFR_W(sim_dmacon.set)
+#define _DMACON_ON_MASK     (1u << 15)
+
+// TxCON bits, the same for timer 2 - 5
+#define _T2CON_ON_MASK          (1u << 15)
+#define _T2CON_TCKPS_POSITION   4
+#define _T2CON_TCKPS_MASK       (7u << 4)
+
+#define IFS0            SIM_SFR_R(sim_ifs[0].reg)
+#define IFS0CLR         SIM_SFR_W(sim_ifs[0].clr)
+#define IFS0SET         SIM_SFR_W(sim_ifs[0].set)
+#define IEC0            SIM_SFR_R(sim_iec[0].reg)
+#define IEC0CLR         SIM_SFR_W(sim_iec[0].clr)
+#define IEC0SET         SIM_SFR_W(sim_iec[0].set)
+#define IFS1            SIM_SFR_R(sim_ifs[1].reg)
+#define IFS1CLR         SIM_SFR_W(sim_ifs[1].clr)
+#define IFS1SET         SIM_SFR_W(sim_ifs[1].set)
+#define IEC1            SIM_SFR_R(sim_iec[1].reg)
+#define IEC1CLR         SIM_SFR_W(sim_iec[1].clr)
+#define IEC1SET         SIM_SFR_W(sim_iec[1].set)
+#define IFS2            SIM_SFR_R(sim_ifs[2].reg)
+#define IFS2CLR         SIM_SFR_W(sim_ifs[2].clr)
+#define IFS2SET         SIM_SFR_W(sim_ifs[2].set)
+#define IEC2            SIM_SFR_R(sim_iec[2].reg)
+#define IEC2CLR         SIM_SFR_W(sim_iec[2].clr)
+#define IEC2SET         SIM_SFR_W(sim_iec[2].set)
+
+#define IPC0            SIM_SFR_R(sim_ipc[0].reg)
+#define IPC0CLR         SIM_SFR_W(sim_ipc[0].clr)
+#define IPC0SET         SIM_SFR_W(sim_ipc[0].set)
+#define IPC1            SIM_SFR_R(sim_ipc[1].reg)
+#define IPC1CLR         SIM_SFR_W(sim_ipc[1].clr)
+#define IPC1SET         SIM_SFR_W(sim_ipc[1].set)
+#define IPC2            SIM_SFR_R(sim_ipc[2].reg)
+#define IPC2CLR         SIM_SFR_W(sim_ipc[2].clr)
+#define IPC2SET         SIM_SFR_W(sim_ipc[2].set)
+#define IPC3            SIM_SFR_R(sim_ipc[3].reg)
+#define IPC3CLR         SIM_SFR_W(sim_ipc[3].clr)
+#define IPC3SET         SIM_SFR_W(sim_ipc[3].set)
+#define IPC4            SIM_SFR_R(sim_ipc[4].reg)
+#define IPC4CLR         SIM_SFR_W(sim_ipc[4].clr)
+#define IPC4SET         SIM_SFR_W(sim_ipc[4].set)
+#define IPC5            SIM_SFR_R(sim_ipc[5].reg)
+#define IPC5CLR         SIM_SFR_W(sim_ipc[5].clr)
+#define IPC5SET         SIM_SFR_W(sim_ipc[5].set)
+#define IPC6            SIM_SFR_R(sim_ipc[6].reg)
+#define IPC6CLR         SIM_SFR_W(sim_ipc[6].clr)
+#define IPC6SET         SIM_SFR_W(sim_ipc[6].set)
+#define IPC7            SIM_SFR_R(sim_ipc[7].reg)
+#define IPC7CLR         SIM_SFR_W(sim_ipc[7].clr)
+#define IPC7SET         SIM_SFR_W(sim_ipc[7].set)
+#define IPC8            SIM_SFR_R(sim_ipc[8].reg)
+#define IPC8CLR         SIM_SFR_W(sim_ipc[8].clr)
+#define IPC8SET         SIM_SFR_W(sim_ipc[8].set)
+#define IPC9            SIM_SFR_R(sim_ipc[9].reg)
+#define IPC9CLR         SIM_SFR_W(sim_ipc[9].clr)
+#define IPC9SET         SIM_SFR_W(sim_ipc[9].set)
+#define IPC10           SIM_SFR_R(sim_ipc[10].reg)
+#define IPC10CLR        SIM_SFR_W(sim_ipc[10].clr)
+#define IPC10SET        SIM_SFR_W(sim_ipc[10].set)
+#define IPC11           SIM_SFR_R(sim_ipc[11].reg)
+#define IPC11CLR        SIM_SFR_W(sim_ipc[11].clr)
+#define IPC11SET        SIM_SFR_W(sim_ipc[11].set)
+#define IPC12           SIM_SFR_R(sim_ipc[12].reg)
+#define IPC12CLR        SIM_SFR_W(sim_ipc[12].clr)
+#define IPC12SET        SIM_SFR_W(sim_ipc[12].set)
+#define IPC13           SIM_SFR_R(sim_ipc[13].reg)
+#define IPC13CLR        SIM_SFR_W(sim_ipc[13].clr)
+#define IPC13SET        SIM_SFR_W(sim_ipc[13].set)
+#define IPC14           SIM_SFR_R(sim_ipc[14].reg)
+#define IPC14CLR        SIM_SFR_W(sim_ipc[14].clr)
+#define IPC14SET        SIM_SFR_W(sim_ipc[14].set)
+#define IPC15           SIM_SFR_R(sim_ipc[15].reg)
+#define IPC15CLR        SIM_SFR_W(sim_ipc[15].clr)
+#define IPC15SET        SIM_SFR_W(sim_ipc[15].set)
+
+// Interrupt vectors
+#define _UART1_VECTOR       24
+#define _UART2_VECTOR       32
+#define _UART3_VECTOR       31
+#define _UART4_VECTOR       49
+#define _UART5_VECTOR       51
+#define _UART6_VECTOR       50
+#define _TIMER_2_VECTOR     8
+#define _TIMER_3_VECTOR     12
+#define _TIMER_4_VECTOR     16
+#define _TIMER_5_VECTOR     20
+#define _DMA_0_VECTOR       36
+#define _DMA_1_VECTOR       37
+#define _DMA_2_VECTOR       38
+#define _DMA_3_VECTOR       39
+#define _DMA_4_VECTOR       40
+#define _DMA_5_VECTOR       41
+#define _DMA_6_VECTOR       42
+#define _DMA_7_VECTOR       43
+
+// Interrupt request numbers, used as DMA start events
+#define _UART1_RX_IRQ       27
+#define _UART1_TX_IRQ       28
+#define _UART2_RX_IRQ       41
+#define _UART2_TX_IRQ       42
+#define _UART3_RX_IRQ       32
+#define _UART3_TX_IRQ       33
+#define _UART4_RX_IRQ       68
+#define _UART4_TX_IRQ       69
+#define _UART5_RX_IRQ       74
+#define _UART5_TX_IRQ       75
+#define _UART6_RX_IRQ       71
+#define _UART6_TX_IRQ       72
+
+// Interrupt flag and enable masks
+#define _IFS0_U1EIF_MASK    (1u << 26)
+#define _IFS0_U1RXIF_MASK   (1u << 27)
+#define _IFS0_U1TXIF_MASK   (1u << 28)
+#define _IFS1_U2EIF_MASK    (1u << 8)
+#define _IFS1_U2RXIF_MASK   (1u << 9)
+#define _IFS1_U2TXIF_MASK   (1u << 10)
+#define _IFS0_U3EIF_MASK    (1u << 31)
+#define _IFS1_U3RXIF_MASK   (1u << 0)
+#define _IFS1_U3TXIF_MASK   (1u << 1)
+#define _IFS2_U4EIF_MASK    (1u << 3)
+#define _IFS2_U4RXIF_MASK   (1u << 4)
+#define _IFS2_U4TXIF_MASK   (1u << 5)
+#define _IFS2_U6EIF_MASK    (1u << 6)
+#define _IFS2_U6RXIF_MASK   (1u << 7)
+#define _IFS2_U6TXIF_MASK   (1u << 8)
+#define _IFS2_U5EIF_MASK    (1u << 9)
+#define _IFS2_U5RXIF_MASK   (1u << 10)
+#define _IFS2_U5TXIF_MASK   (1u << 11)
+#define _IFS0_T2IF_MASK     (1u << 8)
+#define _IFS0_T3IF_MASK     (1u << 12)
+#define _IFS0_T4IF_MASK     (1u << 16)
+#define _IFS0_T5IF_MASK     (1u << 20)
+#define _IFS1_DMA0IF_MASK   (1u << 16)
+#define _IFS1_DMA1IF_MASK   (1u << 17)
+#define _IFS1_DMA2IF_MASK   (1u << 18)
+#define _IFS1_DMA3IF_MASK   (1u << 19)
+#define _IFS1_DMA4IF_MASK   (1u << 20)
+#define _IFS1_DMA5IF_MASK   (1u << 21)
+#define _IFS1_DMA6IF_MASK   (1u << 22)
+#define _IFS1_DMA7IF_MASK   (1u << 23)
+
+#define _IEC0_U1EIE_MASK    (1u << 26)
+#define _IEC0_U1RXIE_MASK   (1u << 27)
+#define _IEC0_U1TXIE_MASK   (1u << 28)
+#define _IEC1_U2EIE_MASK    (1u << 8)
+#define _IEC1_U2RXIE_MASK   (1u << 9)
+#define _IEC1_U2TXIE_MASK   (1u << 10)
+#define _IEC0_U3EIE_MASK    (1u << 31)
+#define _IEC1_U3RXIE_MASK   (1u << 0)
+#define _IEC1_U3TXIE_MASK   (1u << 1)
+#define _IEC2_U4EIE_MASK    (1u << 3)
+#define _IEC2_U4RXIE_MASK   (1u << 4)
+#define _IEC2_U4TXIE_MASK   (1u << 5)
+#define _IEC2_U6EIE_MASK    (1u << 6)
+#define _IEC2_U6RXIE_MASK   (1u << 7)
+#define _IEC2_U6TXIE_MASK   (1u << 8)
+#define _IEC2_U5EIE_MASK    (1u << 9)
+#define _IEC2_U5RXIE_MASK   (1u << 10)
+#define _IEC2_U5TXIE_MASK   (1u << 11)
+#define _IEC0_T2IE_MASK     (1u << 8)
+#define _IEC0_T3IE_MASK     (1u << 12)
+#define _IEC0_T4IE_MASK     (1u << 16)
+#define _IEC0_T5IE_MASK     (1u << 20)
+#define _IEC1_DMA0IE_MASK   (1u << 16)
+#define _IEC1_DMA1IE_MASK   (1u << 17)
+#define _IEC1_DMA2IE_MASK   (1u << 18)
+#define _IEC1_DMA3IE_MASK   (1u << 19)
+#define _IEC1_DMA4IE_MASK   (1u << 20)
+#define _IEC1_DMA5IE_MASK   (1u << 21)
+#define _IEC1_DMA6IE_MASK   (1u << 22)
+#define _IEC1_DMA7IE_MASK   (1u << 23)
+
+// Receive and error masks as used by drv_uart.c
+#define IFS0_U1E_BIT        (_IFS0_U1EIF_MASK | _IFS0_U1RXIF_MASK)
+#define IEC0_U1E_BIT        IFS0_U1E_BIT
+#define IFS1_U2E_BIT        (_IFS1_U2EIF_MASK | _IFS1_U2RXIF_MASK)
+#define IFS1_U2RX_BIT       _IFS1_U2RXIF_MASK
+#define IEC1_U2E_BIT        IFS1_U2E_BIT
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SIM_P32XXXX_H */
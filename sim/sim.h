@@ -0,0 +1,150 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Control interface of the host simulator. sim_uart.c models the PIC32MX
+ * UART modules (FIFOs, interrupt thresholds, status flags and character
+ * timing derived from UxBRG) together with the DMA channels that can serve
+ * them, and fires the driver's interrupt handlers from a separate thread;
+ * sim_rtos.c backs the FreeRTOS calls with pthreads. Together they let
+ * drv_uart.c run unmodified on a Linux host.
+ */
+
+#ifndef SIM_H
+#define	SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// FIFOs of the PIC32MX5xx/6xx/7xx, the parts with six uarts. The driver
+// assumes the same depth, UART_FIFO_DEPTH in drv_uart.c
+#define SIM_UART_RX_FIFO_DEPTH  8
+#define SIM_UART_TX_FIFO_DEPTH  8
+
+// Line errors that can be attached to an injected character
+#define SIM_RX_FERR     (1 << 9)
+#define SIM_RX_PERR     (1 << 10)
+
+typedef void (*sim_uartTxHook_t)(void *ctx, unsigned uart, uint16_t data);
+
+typedef struct {
+    uint32_t rxInjected;    /**<Characters queued on the wire towards the UART*/
+    uint32_t rxReceived;    /**<Characters shifted into the receive FIFO*/
+    uint32_t rxOverrun;     /**<Characters lost to a full FIFO or a pending OERR*/
+    uint32_t rxRead;        /**<Characters read from UxRXREG*/
+    uint32_t rxEmptyReads;  /**<Reads of UxRXREG while the FIFO was empty*/
+    uint32_t txWritten;     /**<Writes to UxTXREG*/
+    uint32_t txDropped;     /**<Writes to UxTXREG while the FIFO was full*/
+    uint32_t txSent;        /**<Characters shifted out on the wire*/
+    uint32_t isrCount;      /**<Interrupt handler invocations*/
+    uint64_t isrNs;         /**<Total time spent in the interrupt handler*/
+    uint64_t isrMaxNs;      /**<Longest single handler invocation*/
+} sim_uartStats_t;
+
+typedef struct {
+    uint32_t queueFull;     /**<Queue sends that failed because the queue was full*/
+    uint32_t yields;        /**<Context switches requested from an interrupt*/
+} sim_rtosStats_t;
+
+/**
+ * Start the peripheral and interrupt threads.
+ */
+void sim_uartStart(void);
+
+/**
+ * Stop the peripheral and interrupt threads, register state is kept.
+ */
+void sim_uartStop(void);
+
+/**
+ * Return all simulated registers and line buffers to their reset state.
+ */
+void sim_uartReset(void);
+
+/**
+ * Queue characters on the receive line of a UART, they arrive at the
+ * configured baudrate.
+ * @param uart  UART index, 0 for UART1.
+ * @param data  Characters to send to the UART.
+ * @param len   Number of characters.
+ */
+void sim_uartInject(unsigned uart, const uint8_t *data, size_t len);
+
+/**
+ * Queue a single character with line errors.
+ * @param uart  UART index, 0 for UART1.
+ * @param word  Character in bits 0-8, optionally SIM_RX_FERR and SIM_RX_PERR.
+ */
+void sim_uartInjectWord(unsigned uart, uint16_t word);
+
+/**
+ * Hold the next character on the receive line while the FIFO is full, as a
+ * sender with flow control would. A host that runs the interrupt late then
+ * slows the line instead of overrunning the FIFO. Off after sim_uartReset.
+ * @param uart  UART index, 0 for UART1.
+ * @param paced True to hold characters, false to lose them to an overrun.
+ */
+void sim_uartPace(unsigned uart, bool paced);
+
+/**
+ * Collect characters the UART has put on its transmit line.
+ * @param uart  UART index, 0 for UART1.
+ * @param data  Buffer to copy the characters into.
+ * @param len   Size of the buffer.
+ * @return Number of characters copied.
+ */
+size_t sim_uartTake(unsigned uart, uint8_t *data, size_t len);
+
+/**
+ * Call a function for every character that leaves the transmitter, used to
+ * model a device on the other end of the line.
+ */
+void sim_uartSetTxHook(unsigned uart, sim_uartTxHook_t hook, void *ctx);
+
+/**
+ * Check if both directions of a UART have nothing left to shift.
+ */
+bool sim_uartIsIdle(unsigned uart);
+
+/**
+ * Baudrate the UART currently runs at, derived from UxBRG and BRGH.
+ */
+uint32_t sim_uartBaud(unsigned uart);
+
+/**
+ * Duration of a single character including start, parity and stop bits.
+ */
+uint64_t sim_uartCharNs(unsigned uart);
+
+void sim_uartGetStats(unsigned uart, sim_uartStats_t *stats);
+void sim_rtosGetStats(sim_rtosStats_t *stats);
+void sim_rtosResetStats(void);
+
+/**
+ * Host monotonic clock in nanoseconds.
+ */
+uint64_t sim_nowNs(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SIM_H */
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Receive and transmit benchmark for drv_uart.c on the host simulator.
+ * For every standard baudrate a burst of data is pushed into UART1 at line
+ * rate while a task drains the driver, after which the drop rate and the
+ * interrupt cost are reported. Each baudrate runs once with interrupt driven
+ * transfers and once with DMA. A second table sends short messages below the
+ * receive trigger level and reports how long the reader waits for them, with
+ * and without idle line detection. Build from the repository root with:
+ *
+ *   gcc -std=gnu11 -O2 -Isim -I. drv_uart.c drv_uartFrame.c drv_uartCrc.c \
+ *       sim/sim_uart.c sim/sim_rtos.c sim/sim_bench.c -o uart_bench -lpthread
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "drv_uart.h"
+#include "sim.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_BURST_MS  200
+#define BENCH_MIN_BYTES 64
+#define BENCH_PUTS      10
+#define BENCH_MESSAGES  20
+#define BENCH_MSG_LEN   3
+#define BENCH_IDLE      3       /**<Character times of silence to flush on*/
+
+static const uartBaudRates_t benchBauds[] = {
+    BAUD1200, BAUD2400, BAUD9600, BAUD19200, BAUD38400, BAUD57600, BAUD115200,
+    BAUD460800, BAUD1000000
+};
+
+static volatile bool consumerRun;
+static uint32_t consumed;
+
+/* Drain the receive buffer in place, the way a packet parser would. */
+static uint32_t benchDrain(drv_uartHandle_t handle)
+{
+    const uint8_t *data[2];
+    uint32_t len[2];
+    uint32_t total = drv_uartRxPeek2(handle, data, len);
+
+    drv_uartRxConsume(handle, total);
+    return total;
+}
+
+static void *benchConsumer(void *args)
+{
+    drv_uartHandle_t handle = args;
+    consumed = 0;
+    while (consumerRun) {
+        drv_uartWaitRx(handle, 10);
+        consumed += benchDrain(handle);
+    }
+    consumed += benchDrain(handle);
+    return NULL;
+}
+
+static uint64_t benchCpuNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void benchWaitIdle(unsigned uart)
+{
+    while (!sim_uartIsIdle(uart))
+        vTaskDelay(1);
+    vTaskDelay(1 + sim_uartCharNs(uart) * 20 / 1000000);
+}
+
+static void benchBaud(uartBaudRates_t baud, uartTransferModes_t mode)
+{
+    drv_uartConfig_t uartConf = {
+        .baud = baud,
+        .dataBits = NOPAR_8BIT,
+        .fifoSize = FIFO_FULL,
+        .isBlocking = true,
+        .uartDev = UART_DEV1,
+        .intPriority = 6,
+        .bufferSize = 255,
+        .txBufferSize = 64,
+        .rxTrigger = 16,
+        .transferMode = mode,
+        .dmaRxChannel = 0,
+        .dmaTxChannel = 1,
+        .stopBits = ONESTOP,
+        .onReceive = NULL
+    };
+    uint8_t burst[256];
+    uint32_t bytes = baud / 10 * BENCH_BURST_MS / 1000;
+    uint32_t i;
+    uint64_t cpuNs;
+    drv_uartHandle_t handle;
+    pthread_t consumer;
+    sim_uartStats_t stats;
+    sim_rtosStats_t rtos;
+    drv_uartStats_t drvStats;
+
+    if (bytes < BENCH_MIN_BYTES)
+        bytes = BENCH_MIN_BYTES;
+    sim_uartReset();
+    sim_rtosResetStats();
+    sim_uartStart();
+    handle = drv_uartNew(&uartConf);
+    drv_uartEnable(handle);
+
+    consumerRun = true;
+    pthread_create(&consumer, NULL, benchConsumer, handle);
+    for (i = 0; i < sizeof (burst); i++)
+        burst[i] = i;
+    for (i = 0; i < bytes; i += sizeof (burst))
+        sim_uartInject(0, burst, bytes - i < sizeof (burst) ?
+                bytes - i : sizeof (burst));
+    benchWaitIdle(0);
+    consumerRun = false;
+    pthread_join(consumer, NULL);
+
+    cpuNs = benchCpuNs();
+    for (i = 0; i < BENCH_PUTS; i++)
+        drv_uartPuts(handle, (uint8_t *)"test\n\r");
+    cpuNs = benchCpuNs() - cpuNs;
+    benchWaitIdle(0);
+
+    sim_uartStop();
+    sim_uartGetStats(0, &stats);
+    sim_rtosGetStats(&rtos);
+    drv_uartGetStats(handle, &drvStats);
+    drv_uartDestroy(handle);
+
+    printf("%4s %7u %7u %7u %7u %7u %6.2f%% %7u %5.2f %7u %8.2f %8.2f %9.1f %5u %6u\n",
+            mode == UART_XFER_INT ? "int" : "dma",
+            (unsigned)baud, stats.rxInjected, stats.rxOverrun,
+            stats.rxEmptyReads, stats.rxReceived - stats.rxRead,
+            100.0 * (stats.rxInjected - consumed) / stats.rxInjected,
+            stats.isrCount,
+            stats.isrCount ? (double)stats.rxRead / stats.isrCount : 0.0,
+            rtos.yields,
+            stats.isrCount ? stats.isrNs / 1000.0 / stats.isrCount : 0.0,
+            stats.isrMaxNs / 1000.0, cpuNs / 1000.0 / BENCH_PUTS,
+            drvStats.overrunErrors, drvStats.rxHighWater);
+}
+
+static void benchIdle(uartTransferModes_t mode, uint8_t idleChars)
+{
+    drv_uartConfig_t uartConf = {
+        .baud = BAUD115200,
+        .dataBits = NOPAR_8BIT,
+        .fifoSize = FIFO_FULL,
+        .isBlocking = true,
+        .uartDev = UART_DEV1,
+        .intPriority = 6,
+        .bufferSize = 255,
+        .txBufferSize = 64,
+        .rxTrigger = 16,
+        .transferMode = mode,
+        .dmaRxChannel = 0,
+        .dmaTxChannel = 1,
+        .idleChars = idleChars,
+        .idleTimer = 2,
+        .stopBits = ONESTOP,
+        .onReceive = NULL
+    };
+    static const uint8_t msg[BENCH_MSG_LEN] = {0x55, 0xAA, 0x0D};
+    uint64_t wireNs, start, waitNs;
+    uint64_t totalNs = 0, maxNs = 0;
+    uint32_t received = 0;
+    drv_uartHandle_t handle;
+    unsigned i;
+
+    sim_uartReset();
+    sim_uartStart();
+    handle = drv_uartNew(&uartConf);
+    drv_uartEnable(handle);
+    wireNs = sim_uartCharNs(0) * BENCH_MSG_LEN;
+    for (i = 0; i < BENCH_MESSAGES; i++) {
+        start = sim_nowNs();
+        sim_uartInject(0, msg, sizeof (msg));
+        drv_uartWaitRx(handle, 10);
+        waitNs = sim_nowNs() - start;
+        waitNs = waitNs > wireNs ? waitNs - wireNs : 0;
+        totalNs += waitNs;
+        if (waitNs > maxNs)
+            maxNs = waitNs;
+        benchWaitIdle(0);
+        received += benchDrain(handle);
+    }
+    sim_uartStop();
+    drv_uartDestroy(handle);
+
+    printf("%4s %5u %8u %8u %9.1f %9.1f\n",
+            mode == UART_XFER_INT ? "int" : "dma", idleChars,
+            BENCH_MESSAGES * BENCH_MSG_LEN, received,
+            totalNs / 1000.0 / BENCH_MESSAGES, maxNs / 1000.0);
+}
+
+int main(void)
+{
+    static const uartTransferModes_t modes[] = {UART_XFER_INT, UART_XFER_DMA};
+    unsigned i, j;
+    printf("mode    baud    sent overrun   empty  strand    drop     isr  b/isr  yields  isr avg  isr max  puts cpu  oerr  rx hw\n");
+    printf("                                                                              us       us        us\n");
+    for (j = 0; j < sizeof (modes) / sizeof (modes[0]); j++) {
+        for (i = 0; i < sizeof (benchBauds) / sizeof (benchBauds[0]); i++)
+            benchBaud(benchBauds[i], modes[j]);
+    }
+    printf("\nmode  idle     sent received  wait avg  wait max\n");
+    printf("     chars                            us        us\n");
+    for (j = 0; j < sizeof (modes) / sizeof (modes[0]); j++) {
+        benchIdle(modes[j], 0);
+        benchIdle(modes[j], BENCH_IDLE);
+    }
+    return 0;
+}
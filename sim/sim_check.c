@@ -0,0 +1,1372 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Behaviour checks for drv_uart.c on the host simulator. Every case drives a
+ * feature through the simulated uarts and compares what comes out of the
+ * driver or off the line with what the feature promises. A failed check
+ * prints its line, the program exits with 1 if any case failed. Build from
+ * the repository root with:
+ *
+ *   gcc -std=gnu11 -O2 -Isim -I. drv_uart.c drv_uartFrame.c drv_uartCrc.c \
+ *       drv_uartServo.c sim/sim_uart.c sim/sim_rtos.c sim/sim_check.c \
+ *       -o uart_check -lpthread
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "drv_uartCrc.h"
+#include "drv_uartServo.h"
+#include "drv_uartStatic.h"
+#include "sim.h"
+#include <stdio.h>
+#include <string.h>
+#include <xc.h>
+
+#define CHECK_WAIT      pdMS_TO_TICKS(200)  /**<Longest wait for data that is on its way*/
+#define CHECK_QUIET     pdMS_TO_TICKS(10)   /**<Shortest quiet line that counts as idle*/
+
+#define CHECK(cond)     checkAssert((cond), #cond, __LINE__)
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} checkCase_t;
+
+typedef struct {
+    uint8_t packet[SERVO_PACKET_MAX];   /**<Packet being received*/
+    uint32_t len;
+    uint16_t target[256];               /**<Last target written to every id*/
+    char order[128];                    /**<S for a sync write, R for a read*/
+    uint32_t packets;
+    uint8_t silent;                     /**<Id that never answers*/
+} checkServos_t;
+
+DRV_UART_STATIC(checkStorage, 64, 64, 32, 64, false);
+
+typedef struct {
+    drv_uartHandle_t handle;
+    uint32_t writes;                    /**<Three byte writes to send*/
+    volatile bool done;
+} checkWriter_t;
+
+typedef struct {
+    uint32_t echoed;                    /**<Bytes sent back as echo*/
+    uint32_t undriven;                  /**<Bytes seen with the pin down and more still to shift*/
+    volatile uint32_t *dirLat;          /**<Direction pin register, NULL without one*/
+    uint32_t dirMask;
+    uint32_t replyAfter;                /**<Echo count after which reply is sent, 0 for none*/
+    const uint8_t *reply;
+    uint32_t replyLen;
+} checkWire_t;
+
+static unsigned checkFailed;
+
+static void checkAssert(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("    line %d: %s\n", line, what);
+        checkFailed++;
+    }
+}
+
+/* Interrupt driven UART1, slow enough for the host to keep up with. */
+static drv_uartConfig_t checkConfig(void)
+{
+    drv_uartConfig_t config = {
+        .baud = BAUD19200,
+        .dataBits = NOPAR_8BIT,
+        .fifoSize = FIFO_CHAR,
+        .isBlocking = true,
+        .uartDev = UART_DEV1,
+        .intPriority = DRV_UART_IPL,
+        .bufferSize = 256,
+        .stopBits = ONESTOP,
+        .onReceive = NULL
+    };
+    return config;
+}
+
+/* Reset the simulator, every line holds what a full FIFO has no room for. */
+static void checkReset(void)
+{
+    unsigned uart;
+
+    sim_uartReset();
+    for (uart = 0; uart < NUM_UARTS; uart++)
+        sim_uartPace(uart, true);
+}
+
+static drv_uartHandle_t checkOpen(drv_uartConfig_t *config)
+{
+    drv_uartHandle_t handle;
+
+    checkReset();
+    sim_uartStart();
+    handle = drv_uartNew(config);
+    if (handle)
+        drv_uartEnable(handle);
+    return handle;
+}
+
+static void checkClose(drv_uartHandle_t handle)
+{
+    sim_uartStop();
+    if (handle)
+        drv_uartDestroy(handle);
+}
+
+/*
+ * Wait until a uart has shifted everything and the line stayed quiet, bytes
+ * still in the driver's ring reach the FIFO within that time. At least
+ * CHECK_QUIET, a fast line is quiet for 20 characters while the host is late.
+ */
+static void checkWaitIdle(unsigned uart)
+{
+    uint32_t quiet = 0, ticks = 1 + sim_uartCharNs(uart) * 20 / 1000000;
+
+    if (ticks < CHECK_QUIET)
+        ticks = CHECK_QUIET;
+    while (quiet < ticks) {
+        quiet = sim_uartIsIdle(uart) ? quiet + 1 : 0;
+        vTaskDelay(1);
+    }
+}
+
+/* Wait until a uart has started to transmit, the first bytes left the ring. */
+static void checkWaitBusy(unsigned uart)
+{
+    uint32_t i;
+
+    for (i = 0; i < CHECK_WAIT && sim_uartIsIdle(uart); i++)
+        vTaskDelay(1);
+}
+
+/* COBS encode a frame including its terminating 0x00. */
+static uint32_t checkCobs(const uint8_t *data, uint32_t len, uint8_t *out)
+{
+    uint32_t code = 0, pos = 1, i;
+
+    for (i = 0; i < len; i++) {
+        if (data[i])
+            out[pos++] = data[i];
+        if (!data[i] || pos - code == 0xFF) {
+            out[code] = pos - code;
+            code = pos++;
+        }
+    }
+    out[code] = pos - code;
+    out[pos++] = 0;
+    return pos;
+}
+
+/*
+ * Good frames come out without their CRC, a frame with a flipped bit is
+ * counted in crcErrors and never delivered. LENGTH frames are produced by
+ * drv_uartWriteCrc, COBS frames are encoded here.
+ */
+static void checkCrc(void)
+{
+    static const uartFraming_t framings[] = {UART_FRAME_COBS, UART_FRAME_LENGTH};
+    static const uartCrc_t crcs[] = {UART_CRC_16, UART_CRC_32};
+    static const uint8_t payload[] = {0x10, 0x00, 0x20, 0x30, 0x00, 0x40};
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    drv_uartStats_t stats;
+    uint8_t frame[32], wire[32], bad[32];
+    uint32_t len, size, f, c, i;
+
+    for (f = 0; f < 2; f++) {
+        for (c = 0; c < 2; c++) {
+            config.framing = framings[f];
+            config.crc = crcs[c];
+            config.maxFrameSize = 16;
+            config.txBufferSize = 64;
+            handle = checkOpen(&config);
+            CHECK(handle != NULL);
+            if (!handle)
+                continue;
+            size = uartCrcSize(crcs[c]);
+            if (framings[f] == UART_FRAME_LENGTH) {
+                CHECK(drv_uartWriteCrc(handle, payload, sizeof (payload)));
+                checkWaitIdle(0);
+                len = sim_uartTake(0, wire, sizeof (wire));
+                CHECK(len == 1 + sizeof (payload) + size);
+            } else {
+                memcpy(frame, payload, sizeof (payload));
+                uartCrcPut(crcs[c], uartCrcUpdate(crcs[c],
+                        uartCrcInit(crcs[c]), payload, sizeof (payload)),
+                        frame + sizeof (payload));
+                len = checkCobs(frame, sizeof (payload) + size, wire);
+            }
+            // Byte 1 is the first payload byte in both encodings
+            memcpy(bad, wire, len);
+            bad[1] ^= 0x01;
+            sim_uartInject(0, wire, len);
+            sim_uartInject(0, bad, len);
+            sim_uartInject(0, wire, len);
+            for (i = 0; i < 2; i++) {
+                memset(frame, 0, sizeof (frame));
+                CHECK(drv_uartReadFrame(handle, frame, CHECK_WAIT) ==
+                        sizeof (payload));
+                CHECK(memcmp(frame, payload, sizeof (payload)) == 0);
+            }
+            checkWaitIdle(0);
+            CHECK(drv_uartReadFrame(handle, frame, 0) == 0);
+#if DRV_UART_STATS
+            drv_uartGetStats(handle, &stats);
+            CHECK(stats.crcErrors == 1);
+            CHECK(stats.framesDropped == 0);
+#else
+            (void)stats;
+#endif
+            checkClose(handle);
+        }
+    }
+}
+
+/*
+ * SLIP undoes both escapes and drops a frame with any other byte after 0xDB,
+ * back to back END bytes carry no frame. An empty frame, COBS 0x01 0x00 or a
+ * LENGTH frame of only its CRC, is dropped and the frame behind it is read.
+ */
+static void checkSlip(void)
+{
+    static const uartFraming_t framings[] = {
+        UART_FRAME_SLIP, UART_FRAME_COBS, UART_FRAME_LENGTH
+    };
+    static const uint8_t slip[] = {
+        0xC0, 0xC0, 0x01, 0xDB, 0xDC, 0xDB, 0xDD, 0x02, 0xC0,
+        0x03, 0xDB, 0x05, 0x04, 0xC0, 0x06, 0xC0
+    };
+    static const uint8_t decoded[] = {0x01, 0xC0, 0xDB, 0x02};
+    static const uint8_t cobs[] = {0x01, 0x00, 0x02, 0x06, 0x00};
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    drv_uartStats_t stats;
+    uint8_t frame[8], wire[8];
+    uint32_t f;
+
+    config.maxFrameSize = 8;
+    for (f = 0; f < 3; f++) {
+        config.framing = framings[f];
+        config.crc = framings[f] == UART_FRAME_LENGTH ? UART_CRC_16 :
+                UART_CRC_NONE;
+        handle = checkOpen(&config);
+        CHECK(handle != NULL);
+        if (!handle)
+            continue;
+        if (framings[f] == UART_FRAME_SLIP) {
+            sim_uartInject(0, slip, sizeof (slip));
+        } else if (framings[f] == UART_FRAME_COBS) {
+            sim_uartInject(0, cobs, sizeof (cobs));
+        } else {
+            wire[0] = 2;
+            uartCrcPut(UART_CRC_16, uartCrcInit(UART_CRC_16), wire + 1);
+            wire[3] = 3;
+            wire[4] = 0x06;
+            uartCrcPut(UART_CRC_16, uartCrcUpdate(UART_CRC_16,
+                    uartCrcInit(UART_CRC_16), wire + 4, 1), wire + 5);
+            sim_uartInject(0, wire, 7);
+        }
+        // Everything is queued, an empty frame must not hide the next one
+        checkWaitIdle(0);
+        if (framings[f] == UART_FRAME_SLIP) {
+            CHECK(drv_uartReadFrame(handle, frame, 0) == sizeof (decoded));
+            CHECK(memcmp(frame, decoded, sizeof (decoded)) == 0);
+        }
+        CHECK(drv_uartReadFrame(handle, frame, 0) == 1);
+        CHECK(frame[0] == 0x06);
+        CHECK(drv_uartReadFrame(handle, frame, 0) == 0);
+#if DRV_UART_STATS
+        drv_uartGetStats(handle, &stats);
+        CHECK(stats.framesDropped == 1 && stats.crcErrors == 0);
+#else
+        (void)stats;
+#endif
+        checkClose(handle);
+    }
+}
+
+/*
+ * Dynamixel servos on the far end of a half-duplex line, every byte sent
+ * comes back as echo. Sync writes store the targets, reads are answered with
+ * the target of the servo.
+ */
+static void checkServoHook(void *ctx, unsigned uart, uint16_t data)
+{
+    checkServos_t *servos = ctx;
+    uint8_t *packet = servos->packet;
+    uint8_t reply[8], sum = 0;
+    uint32_t i;
+
+    sim_uartInjectWord(uart, data & 0xFF);
+    packet[servos->len++] = data;
+    if (servos->len <= 2 && packet[servos->len - 1] != 0xFF)
+        servos->len = 0;
+    if (servos->len < 4 || servos->len < packet[3] + 4u)
+        return;
+    if (servos->packets < sizeof (servos->order) - 1)
+        servos->order[servos->packets++] = packet[4] == 0x83 ? 'S' : 'R';
+    if (packet[4] == 0x83) {
+        for (i = 7; i + packet[6] < servos->len; i += packet[6] + 1)
+            servos->target[packet[i]] = packet[i + 1] | packet[i + 2] << 8;
+    } else if (packet[4] == 0x02 && packet[2] != servos->silent) {
+        reply[0] = reply[1] = 0xFF;
+        reply[2] = packet[2];
+        reply[3] = 4;
+        reply[4] = 0;
+        reply[5] = servos->target[packet[2]];
+        reply[6] = servos->target[packet[2]] >> 8;
+        for (i = 2; i < 7; i++)
+            sum += reply[i];
+        reply[7] = ~sum;
+        sim_uartInject(uart, reply, sizeof (reply));
+    }
+    servos->len = 0;
+}
+
+static uint32_t checkServoAnswered(drv_uartServoBus_t *bus)
+{
+    const uint8_t *status;
+    uint32_t i, answered = 0;
+
+    for (i = 0; i < bus->config.count; i++)
+        answered += drv_uartServoStatus(bus, i, &status) != UINT32_MAX;
+    return answered;
+}
+
+/*
+ * Status reads go between the sync-write packets and fill the cycle after
+ * them, every servo gets its target and in turn its status read. A servo
+ * that never answers counts as timeout, a cycle the writes alone overrun is
+ * reported as missed.
+ */
+static void checkServo(void)
+{
+    static const uint8_t ids[18] = {
+        1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18
+    };
+    static checkServos_t servos;
+    static drv_uartServoBus_t bus;
+    drv_uartConfig_t config = checkConfig();
+    drv_uartServoConfig_t servoConfig = {
+        .ids = ids,
+        .count = sizeof (ids),
+        .writeAddr = 30,
+        .writeLen = 2,
+        .syncGroup = 6,
+        .readAddr = 36,
+        .readLen = 2,
+        .periodUs = 400000,
+        .replyDelayUs = 20,
+        // A reply the host delays past it lands in the next poll
+        .replyTimeout = 40
+    };
+    drv_uartServoReport_t report;
+    drv_uartHandle_t handle;
+    uint8_t targets[2 * sizeof (ids)];
+    const uint8_t *status;
+    uint32_t i, cycles = 0;
+
+    memset(&servos, 0, sizeof (servos));
+    servos.silent = 7;
+    config.halfDuplex = true;
+    config.echo = true;
+    config.txBufferSize = 128;
+    checkReset();
+    sim_uartSetTxHook(0, checkServoHook, &servos);
+    sim_uartStart();
+    handle = drv_uartNew(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    drv_uartEnable(handle);
+    servoConfig.uart = handle;
+    servoConfig.writeLen = 0;
+    CHECK(!drv_uartServoInit(&bus, &servoConfig));
+    servoConfig.writeLen = 2;
+    CHECK(drv_uartServoInit(&bus, &servoConfig));
+    for (i = 0; i < sizeof (ids); i++) {
+        targets[2 * i] = ids[i] * 37;
+        targets[2 * i + 1] = ids[i];
+    }
+    // About 210 ms of line time, the rest of the period is for a late host
+    CHECK(drv_uartServoCycle(&bus, targets, &report));
+    CHECK(report.written == sizeof (ids) && !report.missed);
+    // A poll the host made late may time out before its request is out
+    checkWaitIdle(0);
+    CHECK(strncmp(servos.order, "SRSRS", 5) == 0);
+    CHECK(servos.packets == 3u + report.polled + report.timeouts);
+    // Every servo is asked in turn, a late host only costs another round
+    while (checkServoAnswered(&bus) < sizeof (ids) - 1 && ++cycles < 20)
+        drv_uartServoCycle(&bus, targets, NULL);
+    for (i = 0; i < sizeof (ids); i++) {
+        CHECK(servos.target[ids[i]] == (targets[2 * i] | targets[2 * i + 1] << 8));
+        if (ids[i] == servos.silent) {
+            CHECK(drv_uartServoStatus(&bus, i, &status) == UINT32_MAX);
+            continue;
+        }
+        CHECK(drv_uartServoStatus(&bus, i, &status) != UINT32_MAX);
+        CHECK(memcmp(status, &targets[2 * i], 2) == 0);
+    }
+    CHECK(bus.stats.timeouts >= 1);
+    // The writes alone take longer than the period
+    cycles = bus.stats.missedDeadlines;
+    bus.config.periodUs = 5000;
+    CHECK(!drv_uartServoCycle(&bus, targets, &report));
+    CHECK(report.missed && report.polled == 0 && report.timeouts == 0);
+    CHECK(bus.stats.missedDeadlines == cycles + 1);
+    checkClose(handle);
+}
+
+/*
+ * Each uart device is driven through its own register block: the baudrate
+ * lands in its UxBRG only, the bytes written leave on its line and bytes on
+ * its line are read back, whichever module it is.
+ */
+static void checkPorts(void)
+{
+    static const uint8_t text[] = "port";
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    uint8_t data[8];
+    uint32_t reset, dev, other;
+
+    for (dev = UART_DEV1; dev <= UART_DEV6; dev++) {
+        config.uartDev = dev;
+        config.txBufferSize = 64;
+        handle = checkOpen(&config);
+        CHECK(handle != NULL);
+        if (!handle)
+            continue;
+        reset = sim_uartBaud(dev == UART_DEV1 ? UART_DEV2 : UART_DEV1);
+        CHECK(sim_uartBaud(dev) == drv_uartGetBaud(handle, NULL));
+        CHECK(drv_uartSetBaud(handle, BAUD38400) == sim_uartBaud(dev));
+        for (other = UART_DEV1; other <= UART_DEV6; other++) {
+            if (other != dev)
+                CHECK(sim_uartBaud(other) == reset);
+        }
+        drv_uartWrite(handle, text, sizeof (text));
+        checkWaitIdle(dev);
+        CHECK(sim_uartTake(dev, data, sizeof (data)) == sizeof (text));
+        CHECK(memcmp(data, text, sizeof (text)) == 0);
+        sim_uartInject(dev, text, sizeof (text));
+        CHECK(drv_uartRead(handle, data, sizeof (text), CHECK_WAIT) ==
+                sizeof (text));
+        CHECK(memcmp(data, text, sizeof (text)) == 0);
+        checkClose(handle);
+    }
+}
+
+/*
+ * A uart starts from what the previous owner left in UxMODE and IPCx: handing
+ * the flow control pins to the module is undone, every priority field holds
+ * the configured level whatever it held before.
+ */
+static void checkRegisters(void)
+{
+    const uint32_t level = DRV_UART_IPL << 2 | 3;
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+
+    checkReset();
+    sim_uartStart();
+    // UART1 in IPC6, timer 2 in IPC2, DMA channel 5 in IPC10 bits 8 - 12
+    sim_ipc[6].reg = 0x1F;
+    sim_ipc[2].reg = 0x1F;
+    sim_ipc[10].reg = 0x1F << 8;
+    config.flowControl = UART_FLOW_RTS_CTS;
+    config.idleChars = 4;
+    config.idleTimer = 2;
+    handle = drv_uartNew(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    CHECK((sim_uartSfr[0].mode.reg >> U_UEN0 & 3) == 2);
+    CHECK((sim_ipc[6].reg & 0x1F) == level);
+    CHECK((sim_ipc[2].reg & 0x1F) == level);
+    drv_uartDestroy(handle);
+    CHECK((sim_uartSfr[0].mode.reg >> U_UEN0 & 3) == 0);
+    config = checkConfig();
+    config.transferMode = UART_XFER_DMA_RX;
+    config.dmaRxChannel = 5;
+    handle = drv_uartNew(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    CHECK((sim_uartSfr[0].mode.reg >> U_UEN0 & 3) == 0);
+    CHECK((sim_ipc[10].reg >> 8 & 0x1F) == level);
+    checkClose(handle);
+}
+
+/*
+ * All six uarts run at once, every interrupt reaches the instance of its own
+ * module: bytes injected on one line are read from that handle only, and each
+ * handle's writes leave on its own line.
+ */
+static void checkAllPorts(void)
+{
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handles[NUM_UARTS];
+    uint8_t text[NUM_UARTS][16], data[16];
+    uint32_t dev, i;
+
+    checkReset();
+    sim_uartStart();
+    for (dev = 0; dev < NUM_UARTS; dev++) {
+        config.uartDev = dev;
+        config.txBufferSize = 64;
+        handles[dev] = drv_uartNew(&config);
+        CHECK(handles[dev] != NULL);
+        if (!handles[dev]) {
+            while (dev--)
+                drv_uartDestroy(handles[dev]);
+            checkClose(NULL);
+            return;
+        }
+        drv_uartEnable(handles[dev]);
+        for (i = 0; i < sizeof (text[dev]); i++)
+            text[dev][i] = dev << 4 | i;
+    }
+    for (dev = 0; dev < NUM_UARTS; dev++) {
+        sim_uartInject(dev, text[dev], sizeof (text[dev]));
+        drv_uartWrite(handles[dev], text[dev], sizeof (text[dev]));
+    }
+    for (dev = 0; dev < NUM_UARTS; dev++) {
+        memset(data, 0, sizeof (data));
+        CHECK(drv_uartRead(handles[dev], data, sizeof (data), CHECK_WAIT) ==
+                sizeof (data));
+        CHECK(memcmp(data, text[dev], sizeof (data)) == 0);
+        checkWaitIdle(dev);
+        CHECK(sim_uartTake(dev, data, sizeof (data)) == sizeof (data));
+        CHECK(memcmp(data, text[dev], sizeof (data)) == 0);
+        CHECK(drv_uartRead(handles[dev], data, 1, 0) == 0);
+    }
+    checkClose(NULL);
+    for (dev = 0; dev < NUM_UARTS; dev++)
+        drv_uartDestroy(handles[dev]);
+}
+
+/*
+ * An instance in caller owned memory takes its buffers from the storage and
+ * not from the config, refuses storage that lacks a buffer the config needs,
+ * and can be created again in the same storage after drv_uartDestroy.
+ */
+static void checkStatic(void)
+{
+    static const uint8_t payload[] = {1, 2, 0, 3, 4, 5, 6, 7, 8, 9};
+    drv_uartConfig_t config = checkConfig();
+    drv_uartStorage_t storage = checkStorage;
+    drv_uartHandle_t handle;
+    uint8_t wire[16], data[16];
+    uint32_t len, i, round;
+
+    config.framing = UART_FRAME_COBS;
+    config.maxFrameSize = 32;
+    config.bufferSize = 4;
+    config.txBufferSize = 4;
+    checkReset();
+    sim_uartStart();
+    storage.frameBuf = NULL;
+    CHECK(drv_uartNewStatic(&config, &storage) == NULL);
+    // The bitmap was left out of the storage
+    config.framing = UART_FRAME_NONE;
+    config.lineStatus = true;
+    CHECK(drv_uartNewStatic(&config, &checkStorage) == NULL);
+    config.framing = UART_FRAME_COBS;
+    config.lineStatus = false;
+    len = checkCobs(payload, sizeof (payload), wire);
+    for (round = 0; round < 2; round++) {
+        handle = drv_uartNewStatic(&config, &checkStorage);
+        CHECK(handle == checkStorage.handle);
+        if (!handle)
+            break;
+        drv_uartEnable(handle);
+        // Three frames are far more than the 4 bytes the config asks for
+        for (i = 0; i < 3; i++)
+            sim_uartInject(0, wire, len);
+        for (i = 0; i < 3; i++) {
+            CHECK(drv_uartReadFrame(handle, data, CHECK_WAIT) ==
+                    sizeof (payload));
+            CHECK(memcmp(data, payload, sizeof (payload)) == 0);
+        }
+        drv_uartWrite(handle, wire, len);
+        drv_uartWrite(handle, wire, len);
+        checkWaitIdle(0);
+        CHECK(sim_uartTake(0, data, sizeof (data)) == sizeof (data));
+        CHECK(memcmp(data, wire, len) == 0);
+        drv_uartDestroy(handle);
+        sim_uartTake(0, data, sizeof (data));
+    }
+    checkClose(NULL);
+}
+
+/*
+ * Scattered buffers leave the line in order as one stream. A non-blocking
+ * write that only partly fits resumes with skip where it stopped, with and
+ * without a transmit ring.
+ */
+static void checkWritev(void)
+{
+    static const uint16_t rings[] = {16, 0};
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    drv_uartIovec_t iov[3];
+    uint8_t head[3] = {0xA5, 0x5A, 40}, body[40], tail[2] = {0xEE, 0xFF};
+    uint8_t wire[2 * sizeof (body)], data[2 * sizeof (body)];
+    uint32_t len, total, skip, calls, r, i;
+
+    for (i = 0; i < sizeof (body); i++)
+        body[i] = i;
+    iov[0].data = head;
+    iov[0].len = sizeof (head);
+    iov[1].data = body;
+    iov[1].len = sizeof (body);
+    iov[2].data = tail;
+    iov[2].len = sizeof (tail);
+    total = sizeof (head) + sizeof (body) + sizeof (tail);
+    memcpy(wire, head, sizeof (head));
+    memcpy(wire + sizeof (head), body, sizeof (body));
+    memcpy(wire + sizeof (head) + sizeof (body), tail, sizeof (tail));
+    for (r = 0; r < sizeof (rings) / sizeof (rings[0]); r++) {
+        config.txBufferSize = rings[r];
+        handle = checkOpen(&config);
+        CHECK(handle != NULL);
+        if (!handle)
+            continue;
+        drv_uartWritev(handle, iov, 3);
+        checkWaitIdle(0);
+        len = sim_uartTake(0, data, sizeof (data));
+        CHECK(len == total && memcmp(data, wire, total) == 0);
+        // Neither the ring nor the FIFO takes it all at once
+        skip = calls = 0;
+        while (skip < total && calls < 1000) {
+            skip += drv_uartTryWritev(handle, iov, 3, skip);
+            calls++;
+            vTaskDelay(1);
+        }
+        CHECK(skip == total && calls > 1);
+        checkWaitIdle(0);
+        len = sim_uartTake(0, data, sizeof (data));
+        CHECK(len == total && memcmp(data, wire, total) == 0);
+        checkClose(handle);
+    }
+}
+
+/*
+ * Blocking reads wait for the bytes still on the line, stop at the delimiter
+ * or maxLen leaving the rest buffered, and give up with what they have once
+ * the timeout expired.
+ */
+static void checkRead(void)
+{
+    static const uint8_t lines[] = "hello\nworld";
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    uint8_t data[64], burst[48];
+    TickType_t start;
+    uint32_t i;
+
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    // The burst takes about 25 ms on the line
+    for (i = 0; i < sizeof (burst); i++)
+        burst[i] = i * 5;
+    sim_uartInject(0, burst, sizeof (burst));
+    CHECK(drv_uartRead(handle, data, sizeof (burst), CHECK_WAIT) ==
+            sizeof (burst));
+    CHECK(memcmp(data, burst, sizeof (burst)) == 0);
+    sim_uartInject(0, lines, sizeof (lines) - 1);
+    CHECK(drv_uartReadUntil(handle, data, sizeof (data), '\n', CHECK_WAIT) == 6);
+    CHECK(memcmp(data, "hello\n", 6) == 0);
+    CHECK(drv_uartReadUntil(handle, data, 3, '\n', CHECK_WAIT) == 3);
+    CHECK(memcmp(data, "wor", 3) == 0);
+    CHECK(drv_uartRead(handle, data, 2, CHECK_WAIT) == 2);
+    CHECK(memcmp(data, "ld", 2) == 0);
+    sim_uartInject(0, burst, 3);
+    start = xTaskGetTickCount();
+    CHECK(drv_uartRead(handle, data, 8, pdMS_TO_TICKS(50)) == 3);
+    CHECK(xTaskGetTickCount() - start >= pdMS_TO_TICKS(50));
+    sim_uartInject(0, lines, 5);
+    start = xTaskGetTickCount();
+    CHECK(drv_uartReadUntil(handle, data, sizeof (data), '\n',
+            pdMS_TO_TICKS(50)) == 5);
+    CHECK(xTaskGetTickCount() - start >= pdMS_TO_TICKS(50));
+    CHECK(drv_uartRead(handle, data, 1, 0) == 0);
+    checkClose(handle);
+}
+
+/*
+ * A single wire returns every byte sent, and answers once a request of
+ * replyAfter bytes is out.
+ */
+static void checkWireHook(void *ctx, unsigned uart, uint16_t data)
+{
+    checkWire_t *wire = ctx;
+    sim_uartStats_t stats;
+
+    sim_uartInjectWord(uart, data & 0xFF);
+    // The hook runs late on a busy host, the pin may drop once all is out
+    if (wire->dirLat && !(*wire->dirLat & wire->dirMask)) {
+        sim_uartGetStats(uart, &stats);
+        if (stats.txSent != stats.txWritten)
+            wire->undriven++;
+    }
+    if (++wire->echoed == wire->replyAfter)
+        sim_uartInject(uart, wire->reply, wire->replyLen);
+}
+
+/*
+ * Half-duplex: the direction pin is high while bytes leave and drops once the
+ * last stop bit is out, the echo of every byte sent is dropped while bytes
+ * from the peer get through, also right behind a request.
+ */
+static void checkHalfDuplex(void)
+{
+    static const uint8_t request[] = "ping", reply[] = "ack";
+    static const uint8_t peer[] = {0x11, 0x22, 0x33, 0x44, 0x55};
+    static sim_sfr_t lat;
+    static checkWire_t wire;
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    uint8_t data[32];
+    uint32_t i;
+
+    memset(&wire, 0, sizeof (wire));
+    lat.reg = 0;
+    config.halfDuplex = true;
+    config.echo = true;
+    config.dirLat = &lat.reg;
+    config.dirMask = 1 << 3;
+    config.txBufferSize = 64;
+    wire.dirLat = &lat.reg;
+    wire.dirMask = config.dirMask;
+    checkReset();
+    sim_uartSetTxHook(0, checkWireHook, &wire);
+    sim_uartStart();
+    handle = drv_uartNew(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    drv_uartEnable(handle);
+    CHECK(!(lat.reg & config.dirMask));
+    for (i = 0; i < sizeof (data); i++)
+        data[i] = 0x80 | i;
+    drv_uartWrite(handle, data, sizeof (data));
+    checkWaitIdle(0);
+    CHECK(!(lat.reg & config.dirMask));
+    CHECK(wire.echoed == sizeof (data));
+    CHECK(wire.undriven == 0);
+    CHECK(drv_uartRead(handle, data, 1, 0) == 0);
+    sim_uartInject(0, peer, sizeof (peer));
+    CHECK(drv_uartRead(handle, data, sizeof (peer), CHECK_WAIT) ==
+            sizeof (peer));
+    CHECK(memcmp(data, peer, sizeof (peer)) == 0);
+    // The reply starts right after the echo of the request
+    wire.replyAfter = wire.echoed + sizeof (request) - 1;
+    wire.reply = reply;
+    wire.replyLen = sizeof (reply) - 1;
+    CHECK(drv_uartTransact(handle, request, sizeof (request) - 1, data,
+            sizeof (reply) - 1, CHECK_WAIT) == sizeof (reply) - 1);
+    CHECK(memcmp(data, reply, sizeof (reply) - 1) == 0);
+    checkWaitIdle(0);
+    CHECK(!(lat.reg & config.dirMask));
+    CHECK(drv_uartRead(handle, data, 1, 0) == 0);
+    checkClose(handle);
+}
+
+/*
+ * XON/XOFF: XOFF from the peer holds back the transmit ring until XON, and
+ * neither reaches the reader. Filling the receive ring to the high watermark
+ * sends XOFF, reading it down to the low watermark sends XON.
+ */
+static void checkXonXoff(void)
+{
+    static const uint8_t xoff = 0x13, xon = 0x11;
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    drv_uartStats_t stats;
+    uint8_t sent[64], data[64], line[8];
+    uint32_t i;
+
+    config.flowControl = UART_FLOW_XON_XOFF;
+    config.bufferSize = 64;
+    config.txBufferSize = 64;
+    config.rxHighWater = 48;
+    config.rxLowWater = 16;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    for (i = 0; i < sizeof (sent); i++)
+        sent[i] = 0x20 + i;
+    sim_uartInject(0, &xoff, 1);
+    checkWaitIdle(0);
+    drv_uartWrite(handle, sent, 16);
+    checkWaitIdle(0);
+    CHECK(sim_uartTake(0, line, sizeof (line)) == 0);
+    sim_uartInject(0, &xon, 1);
+    checkWaitIdle(0);
+    CHECK(sim_uartTake(0, data, 16) == 16);
+    CHECK(memcmp(data, sent, 16) == 0);
+    CHECK(drv_uartRead(handle, data, 1, 0) == 0);
+    sim_uartInject(0, sent, 50);
+    checkWaitIdle(0);
+    CHECK(sim_uartTake(0, line, sizeof (line)) == 1 && line[0] == xoff);
+    CHECK(drv_uartRead(handle, data, 30, 0) == 30);
+    checkWaitIdle(0);
+    CHECK(sim_uartTake(0, line, sizeof (line)) == 0);
+    CHECK(drv_uartRead(handle, data + 30, 4, 0) == 4);
+    checkWaitIdle(0);
+    CHECK(sim_uartTake(0, line, sizeof (line)) == 1 && line[0] == xon);
+    CHECK(drv_uartRead(handle, data + 34, 16, 0) == 16);
+    CHECK(memcmp(data, sent, 50) == 0);
+#if DRV_UART_STATS
+    drv_uartGetStats(handle, &stats);
+    CHECK(stats.flowPauses == 1);
+#else
+    (void)stats;
+#endif
+    checkClose(handle);
+}
+
+/*
+ * Bytes received with a parity or framing error are flagged in the line
+ * status next to the data, and a frame holding one is dropped while the
+ * frames around it come through.
+ */
+static void checkLineStatus(void)
+{
+    static const uint8_t payload[] = {7, 8, 9};
+    static const uint16_t words[] = {
+        'a', 'b' | SIM_RX_PERR, 'c', 'd' | SIM_RX_FERR, 'e'
+    };
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    drv_uartStats_t stats;
+    uint8_t data[16], status[2], wire[8];
+    uint32_t len, i;
+
+    config.lineStatus = true;
+    // Overruled, five bytes stay below the level
+    config.fifoSize = FIFO_3;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    for (i = 0; i < sizeof (words) / sizeof (words[0]); i++)
+        sim_uartInjectWord(0, words[i]);
+    checkWaitIdle(0);
+    CHECK(drv_uartTryReadStatus(handle, data, status, sizeof (data)) == 5);
+    CHECK(memcmp(data, "abcde", 5) == 0);
+    CHECK((status[0] & 0x1F) == (1 << 1 | 1 << 3));
+#if DRV_UART_STATS
+    drv_uartGetStats(handle, &stats);
+    CHECK(stats.parityErrors == 1 && stats.framingErrors == 1);
+#endif
+    checkClose(handle);
+    config.framing = UART_FRAME_COBS;
+    config.maxFrameSize = 16;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    len = checkCobs(payload, sizeof (payload), wire);
+    sim_uartInject(0, wire, len);
+    sim_uartInjectWord(0, wire[0]);
+    sim_uartInjectWord(0, wire[1] | SIM_RX_PERR);
+    sim_uartInject(0, wire + 2, len - 2);
+    sim_uartInject(0, wire, len);
+    for (i = 0; i < 2; i++) {
+        CHECK(drv_uartReadFrame(handle, data, CHECK_WAIT) == sizeof (payload));
+        CHECK(memcmp(data, payload, sizeof (payload)) == 0);
+    }
+    checkWaitIdle(0);
+    CHECK(drv_uartReadFrame(handle, data, 0) == 0);
+#if DRV_UART_STATS
+    drv_uartGetStats(handle, &stats);
+    CHECK(stats.parityErrors == 1 && stats.framesDropped == 1);
+#else
+    (void)stats;
+#endif
+    checkClose(handle);
+}
+
+/* COBS encode a three byte frame and put it on the line. */
+static void checkInjectFrame(uint8_t tag, uint8_t n)
+{
+    uint8_t frame[3] = {tag, n, 0x55}, wire[8];
+
+    sim_uartInject(0, wire, checkCobs(frame, sizeof (frame), wire));
+}
+
+/*
+ * Frames go to the first route whose header matches. A full DROP_OLDEST
+ * route keeps the newest frames, DROP_NEWEST keeps the oldest and PASS hands
+ * the overflow to the frame queue, where unmatched frames go as well.
+ */
+static void checkRoutes(void)
+{
+    static const uartRoutePolicy_t policies[] = {
+        UART_ROUTE_DROP_OLDEST, UART_ROUTE_DROP_NEWEST, UART_ROUTE_PASS
+    };
+    // Four three byte frames fit, each with its length byte
+    static const uint8_t expect[3][4] = {{3, 4, 5, 6}, {1, 2, 3, 4}, {1, 2, 3, 4}};
+    static drv_uartRoute_t routes[3];
+    static uint8_t bufs[3][16];
+    drv_uartConfig_t config = checkConfig();
+    drv_uartRouteConfig_t route = {.offset = 0, .mask = 0xFF};
+    drv_uartHandle_t handle;
+    uint8_t data[16];
+    uint32_t r, n;
+
+    config.framing = UART_FRAME_COBS;
+    config.maxFrameSize = 8;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    for (r = 0; r < 3; r++) {
+        route.value = 'A' + r;
+        route.policy = policies[r];
+        route.buf = bufs[r];
+        route.size = sizeof (bufs[r]);
+        CHECK(drv_uartRouteAdd(handle, &routes[r], &route));
+    }
+    for (n = 1; n <= 6; n++) {
+        for (r = 0; r < 3; r++)
+            checkInjectFrame('A' + r, n);
+    }
+    checkInjectFrame('Z', 9);
+    checkWaitIdle(0);
+    for (r = 0; r < 3; r++) {
+        for (n = 0; n < 4; n++) {
+            CHECK(drv_uartRouteRead(handle, &routes[r], data, CHECK_WAIT) == 3);
+            CHECK(data[0] == 'A' + r && data[1] == expect[r][n]);
+        }
+        CHECK(drv_uartRouteRead(handle, &routes[r], data, 0) == 0);
+    }
+    // What PASS could not keep and the frame no route took
+    CHECK(drv_uartReadFrame(handle, data, CHECK_WAIT) == 3);
+    CHECK(data[0] == 'C' && data[1] == 5);
+    CHECK(drv_uartReadFrame(handle, data, CHECK_WAIT) == 3);
+    CHECK(data[0] == 'C' && data[1] == 6);
+    CHECK(drv_uartReadFrame(handle, data, CHECK_WAIT) == 3);
+    CHECK(data[0] == 'Z' && data[1] == 9);
+    CHECK(drv_uartReadFrame(handle, data, 0) == 0);
+    for (r = 0; r < 3; r++)
+        drv_uartRouteRemove(handle, &routes[r]);
+    checkClose(handle);
+}
+
+/*
+ * An urgent frame goes out right after the bulk write on the line, ahead of
+ * the bulk writes queued behind it, and never inside a write. The part of a
+ * non-blocking write that was accepted counts as a write of its own.
+ */
+static void checkUrgent(void)
+{
+    static const uint8_t urgent[] = {0xE5, 0xE5, 0xE5, 0xE5};
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    uint8_t first[40], second[40], line[256];
+    uint32_t len, i;
+
+    config.txBufferSize = 128;
+    config.urgentBufferSize = 32;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    memset(first, 'a', sizeof (first));
+    memset(second, 'b', sizeof (second));
+    // The first write takes 20 ms on the line, the rest is queued meanwhile
+    drv_uartWrite(handle, first, sizeof (first));
+    checkWaitBusy(0);
+    drv_uartWrite(handle, second, sizeof (second));
+    CHECK(drv_uartWriteUrgent(handle, urgent, sizeof (urgent), 0));
+    checkWaitIdle(0);
+    CHECK(sim_uartTake(0, line, sizeof (line)) ==
+            sizeof (first) + sizeof (urgent) + sizeof (second));
+    CHECK(memcmp(line, first, sizeof (first)) == 0);
+    CHECK(memcmp(line + sizeof (first), urgent, sizeof (urgent)) == 0);
+    CHECK(memcmp(line + sizeof (first) + sizeof (urgent), second,
+            sizeof (second)) == 0);
+    // Queued whole or not at all
+    CHECK(!drv_uartWriteUrgent(handle, line, 33, 0));
+    // The ring takes only part of it and the rest is never offered
+    memset(line, 'c', sizeof (line));
+    len = drv_uartTryWrite(handle, line, sizeof (line));
+    CHECK(len > 0 && len < sizeof (line));
+    checkWaitBusy(0);
+    CHECK(drv_uartWriteUrgent(handle, urgent, sizeof (urgent), 0));
+    checkWaitIdle(0);
+    memset(line, 0, sizeof (line));
+    CHECK(sim_uartTake(0, line, sizeof (line)) == len + sizeof (urgent));
+    for (i = 0; i < len && line[i] == 'c'; i++);
+    CHECK(i == len);
+    CHECK(memcmp(line + len, urgent, sizeof (urgent)) == 0);
+    checkClose(handle);
+}
+
+/*
+ * FIFO_ADAPTIVE raises the receive interrupt level under a back to back
+ * burst, so it takes far fewer interrupts than bytes, and drops it again
+ * once bytes come one at a time. No byte is lost or held back either way.
+ */
+static void checkAdaptive(void)
+{
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    drv_uartStats_t stats;
+    uint8_t burst[160], data[160];
+    uint32_t i;
+
+    config.fifoSize = FIFO_ADAPTIVE;
+    // Longer than a full FIFO, the timer must not drain it mid-burst
+    config.idleChars = 12;
+    config.idleTimer = 2;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    for (i = 0; i < sizeof (burst); i++)
+        burst[i] = i * 3;
+    sim_uartInject(0, burst, sizeof (burst));
+    CHECK(drv_uartRead(handle, data, sizeof (burst), CHECK_WAIT) ==
+            sizeof (burst));
+    CHECK(memcmp(data, burst, sizeof (burst)) == 0);
+#if DRV_UART_STATS
+    drv_uartGetStats(handle, &stats);
+    CHECK(stats.rxLevelRaises >= 1 && stats.rxLevelIsrs[1] > 0);
+    CHECK(stats.isrCount < sizeof (burst) / 2);
+    CHECK(stats.rxFifoLevel != FIFO_CHAR);
+#endif
+    // Ten character times apart, every byte is read on its own
+    for (i = 0; i < 8; i++) {
+        sim_uartInject(0, &burst[i], 1);
+        CHECK(drv_uartRead(handle, data, 1, CHECK_WAIT) == 1);
+        CHECK(data[0] == burst[i]);
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+#if DRV_UART_STATS
+    drv_uartGetStats(handle, &stats);
+    CHECK(stats.rxLevelDrops >= 1 && stats.rxFifoLevel == FIFO_CHAR);
+#else
+    (void)stats;
+#endif
+    checkClose(handle);
+}
+
+static void checkAsyncDone(void *context, uint32_t len)
+{
+    *(volatile uint32_t *)context = len;
+}
+
+/*
+ * One task serves two uarts: drv_uartWaitAny returns the uart whose request
+ * completed with its event, serves the earlier handle first when both did and
+ * times out while neither did. A cancelled read reports its bytes and never
+ * signals.
+ */
+static void checkAsync(void)
+{
+    static const uint8_t text[] = {1, 2, 3, 4};
+    static volatile uint32_t done[2];
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handles[2];
+    uint8_t data[2][40], line[40];
+    uint8_t events;
+    uint32_t i;
+
+    checkReset();
+    sim_uartStart();
+    for (i = 0; i < 2; i++) {
+        config.uartDev = i;
+        config.txBufferSize = 16;
+        handles[i] = drv_uartNew(&config);
+        CHECK(handles[i] != NULL);
+        if (!handles[i]) {
+            if (i)
+                drv_uartDestroy(handles[0]);
+            checkClose(NULL);
+            return;
+        }
+        drv_uartEnable(handles[i]);
+        done[i] = 0;
+    }
+    CHECK(drv_uartReadAsync(handles[0], data[0], 4, checkAsyncDone,
+            (void *)&done[0]));
+    CHECK(drv_uartReadAsync(handles[1], data[1], 4, checkAsyncDone,
+            (void *)&done[1]));
+    CHECK(!drv_uartReadAsync(handles[1], data[1], 4, NULL, NULL));
+    CHECK(drv_uartWaitAny(handles, 2, &events, pdMS_TO_TICKS(20)) == -1);
+    sim_uartInject(1, text, sizeof (text));
+    CHECK(drv_uartWaitAny(handles, 2, &events, CHECK_WAIT) == 1);
+    CHECK(events == UART_EVENT_READ && done[1] == sizeof (text));
+    CHECK(memcmp(data[1], text, sizeof (text)) == 0);
+    CHECK(done[0] == 0);
+    // Both complete before the task looks, the first handle comes first
+    CHECK(drv_uartReadAsync(handles[1], data[1], 4, NULL, NULL));
+    sim_uartInject(1, text, sizeof (text));
+    sim_uartInject(0, text, sizeof (text));
+    checkWaitIdle(0);
+    checkWaitIdle(1);
+    CHECK(drv_uartWaitAny(handles, 2, &events, 0) == 0);
+    CHECK(events == UART_EVENT_READ && done[0] == sizeof (text));
+    CHECK(drv_uartWaitAny(handles, 2, &events, 0) == 1);
+    CHECK(events == UART_EVENT_READ);
+    CHECK(drv_uartWaitAny(handles, 2, &events, 0) == -1);
+    // More than the ring holds, the interrupt feeds the rest
+    for (i = 0; i < sizeof (data[0]); i++)
+        data[0][i] = 0x40 + i;
+    done[0] = 0;
+    CHECK(drv_uartWriteAsync(handles[0], data[0], sizeof (data[0]),
+            checkAsyncDone, (void *)&done[0]));
+    CHECK(drv_uartWaitAny(handles, 2, &events, CHECK_WAIT) == 0);
+    CHECK(events == UART_EVENT_WRITE && done[0] == sizeof (data[0]));
+    checkWaitIdle(0);
+    CHECK(sim_uartTake(0, line, sizeof (line)) == sizeof (data[0]));
+    CHECK(memcmp(line, data[0], sizeof (data[0])) == 0);
+    CHECK(drv_uartReadAsync(handles[0], data[0], 8, NULL, NULL));
+    sim_uartInject(0, text, 3);
+    checkWaitIdle(0);
+    CHECK(drv_uartCancelAsync(handles[0], UART_EVENT_READ) == 3);
+    CHECK(drv_uartWaitAny(handles, 2, &events, pdMS_TO_TICKS(20)) == -1);
+    checkClose(NULL);
+    for (i = 0; i < 2; i++)
+        drv_uartDestroy(handles[i]);
+}
+
+/*
+ * Received bytes and frames carry the core timer count of their receive
+ * interrupt: stamps never go back, lie between the injection and the read,
+ * and a stamped read never mixes bytes of two bursts 10 ms apart.
+ */
+static void checkStamps(void)
+{
+    static const uint8_t text[] = {0x61, 0x62, 0x63, 0x64};
+    static const uint8_t payload[] = {5, 6, 7};
+    const uint32_t apart = SYS_CLK_FREQ / 2 / 200;
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    uint8_t data[16], wire[8];
+    uint32_t start, stamp, last, stamps[8], got, len, i;
+
+    config.timestamps = true;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    start = _CP0_GET_COUNT();
+    sim_uartInject(0, text, sizeof (text));
+    checkWaitIdle(0);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    sim_uartInject(0, text, sizeof (text));
+    checkWaitIdle(0);
+    for (got = 0; got < 2 * sizeof (text); got += len) {
+        len = drv_uartTryReadStamped(handle, data, sizeof (data), &stamp);
+        CHECK(len && got + len <= 2 * sizeof (text));
+        if (!len || got + len > 2 * sizeof (text))
+            break;
+        // A read stops where the second burst starts
+        CHECK(got >= sizeof (text) || got + len <= sizeof (text));
+        for (i = 0; i < len; i++)
+            stamps[got + i] = stamp;
+    }
+    CHECK(got == 2 * sizeof (text));
+    if (got == 2 * sizeof (text)) {
+        CHECK((int32_t)(stamps[0] - start) >= 0);
+        for (i = 1; i < got; i++)
+            CHECK((int32_t)(stamps[i] - stamps[i - 1]) >= 0);
+        CHECK(stamps[sizeof (text)] - stamps[sizeof (text) - 1] >= apart);
+        CHECK((int32_t)(_CP0_GET_COUNT() - stamps[got - 1]) >= 0);
+        CHECK(drv_uartRxStamp(handle) == stamps[got - 1]);
+    }
+    checkClose(handle);
+    config.framing = UART_FRAME_COBS;
+    config.maxFrameSize = 8;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    len = checkCobs(payload, sizeof (payload), wire);
+    sim_uartInject(0, wire, len);
+    checkWaitIdle(0);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    sim_uartInject(0, wire, len);
+    CHECK(drv_uartReadFrameStamped(handle, data, &last, CHECK_WAIT) ==
+            sizeof (payload));
+    CHECK(drv_uartReadFrameStamped(handle, data, &stamp, CHECK_WAIT) ==
+            sizeof (payload));
+    CHECK(memcmp(data, payload, sizeof (payload)) == 0);
+    CHECK(stamp - last >= apart);
+    CHECK((int32_t)(_CP0_GET_COUNT() - stamp) >= 0);
+    checkClose(handle);
+}
+
+/* The bytes of the n-th write of checkWriterTask. */
+static void checkWriterBytes(uint32_t n, uint8_t *msg)
+{
+    msg[0] = 0x80 | (n & 0x7F);
+    msg[1] = 0xF0;
+    msg[2] = 0xF1;
+}
+
+static void checkWriterTask(void *ctx)
+{
+    checkWriter_t *writer = ctx;
+    uint8_t msg[3];
+    uint32_t n;
+
+    for (n = 0; n < writer->writes; n++) {
+        checkWriterBytes(n, msg);
+        drv_uartWrite(writer->handle, msg, sizeof (msg));
+    }
+    writer->done = true;
+}
+
+/*
+ * Asynchronous writes fed by the transmit interrupt and blocking writes of
+ * another task share the transmit ring. Every write arrives whole and in
+ * order, none is cut into another and no byte is lost.
+ */
+static void checkAsyncShared(void)
+{
+    enum { BLOCK = 1000, BLOCKS = 10 };
+    static checkWriter_t writer;
+    static uint8_t line[BLOCKS * BLOCK + 3 * 2000];
+    static uint8_t block[BLOCK];
+    drv_uartConfig_t config = checkConfig();
+    drv_uartHandle_t handle;
+    uint8_t msg[3], events;
+    uint32_t len, async, sync, failed, b, i;
+
+    // Only sent, a fast line has nothing to overrun
+    config.baud = BAUD115200;
+    config.txBufferSize = 64;
+    handle = checkOpen(&config);
+    CHECK(handle != NULL);
+    if (!handle) {
+        checkClose(NULL);
+        return;
+    }
+    for (i = 0; i < BLOCK; i++)
+        block[i] = i & 0x7F;
+    writer.handle = handle;
+    writer.writes = 2000;
+    writer.done = false;
+    CHECK(xTaskCreate(checkWriterTask, "writer", 0, &writer, 1, NULL) == pdPASS);
+    for (b = 0; b < BLOCKS; b++) {
+        // Refused while the other task is copying a write in
+        for (i = 0; i < 1000; i++) {
+            if (drv_uartWriteAsync(handle, block, BLOCK, NULL, NULL))
+                break;
+            vTaskDelay(1);
+        }
+        CHECK(i < 1000);
+        CHECK(drv_uartTryWrite(handle, msg, 1) == 0);
+        CHECK(drv_uartWaitAny(&handle, 1, &events, 10 * CHECK_WAIT) == 0);
+        CHECK(events == UART_EVENT_WRITE);
+    }
+    for (i = 0; i < 1000 && !writer.done; i++)
+        vTaskDelay(1);
+    CHECK(writer.done);
+    checkWaitIdle(0);
+    len = sim_uartTake(0, line, sizeof (line));
+    CHECK(len == sizeof (line));
+    // Asynchronous bytes are below 0x80, the other writes above
+    failed = checkFailed;
+    for (i = async = sync = 0; i < len && checkFailed == failed; i++) {
+        if (line[i] < 0x80) {
+            CHECK(sync % 3 == 0 && line[i] == block[async % BLOCK]);
+            async++;
+        } else {
+            checkWriterBytes(sync / 3, msg);
+            CHECK(async % BLOCK == 0 && line[i] == msg[sync % 3]);
+            sync++;
+        }
+    }
+    CHECK(async == BLOCKS * BLOCK && sync == 3 * writer.writes);
+    checkClose(handle);
+}
+
+static const checkCase_t checkCases[] = {
+    {"crc", checkCrc},
+    {"slip", checkSlip},
+    {"servo", checkServo},
+    {"ports", checkPorts},
+    {"all ports", checkAllPorts},
+    {"registers", checkRegisters},
+    {"static", checkStatic},
+    {"writev", checkWritev},
+    {"read", checkRead},
+    {"half duplex", checkHalfDuplex},
+    {"xon xoff", checkXonXoff},
+    {"line status", checkLineStatus},
+    {"routes", checkRoutes},
+    {"urgent", checkUrgent},
+    {"adaptive", checkAdaptive},
+    {"async", checkAsync},
+    {"async shared", checkAsyncShared},
+    {"stamps", checkStamps},
+};
+
+int main(void)
+{
+    unsigned i, failed, cases = 0;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+    for (i = 0; i < sizeof (checkCases) / sizeof (checkCases[0]); i++) {
+        failed = checkFailed;
+        checkCases[i].run();
+        printf("%-12s %s\n", checkCases[i].name,
+                checkFailed == failed ? "ok" : "FAILED");
+        cases += checkFailed != failed;
+    }
+    printf("%u of %u cases failed\n", cases,
+            (unsigned)(sizeof (checkCases) / sizeof (checkCases[0])));
+    return cases ? 1 : 0;
+}
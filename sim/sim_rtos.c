@@ -0,0 +1,344 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "sim.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct QueueDefinition {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t *storage;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t count;
+    unsigned waiting;               /**<Tasks blocked on this queue*/
+};
+
+struct tskTaskControlBlock {
+    pthread_t thread;
+    TaskFunction_t code;
+    void *parameters;
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notifyValue;
+    bool waiting;                   /**<Task is blocked on a notification*/
+};
+
+static pthread_mutex_t cpuLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static _Atomic uint32_t queueFull;
+static _Atomic uint32_t yields;
+static __thread TaskHandle_t currentTask;
+
+static void simCondInit(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * Wait on a condition until an absolute deadline.
+ * @return false if the wait timed out
+ */
+static bool simCondWait(pthread_cond_t *cond, pthread_mutex_t *lock,
+        uint64_t deadline)
+{
+    struct timespec ts;
+    if (deadline == UINT64_MAX)
+        return pthread_cond_wait(cond, lock) == 0;
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    return pthread_cond_timedwait(cond, lock, &ts) == 0;
+}
+
+static uint64_t simDeadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+        return UINT64_MAX;
+    return sim_nowNs() + (uint64_t)ticks * (1000000000ull / configTICK_RATE_HZ);
+}
+
+void sim_enterCritical(void)
+{
+    pthread_mutex_lock(&cpuLock);
+}
+
+void sim_exitCritical(void)
+{
+    pthread_mutex_unlock(&cpuLock);
+}
+
+void sim_yieldFromIsr(BaseType_t woken)
+{
+    if (woken)
+        yields++;
+}
+
+void sim_rtosGetStats(sim_rtosStats_t *stats)
+{
+    stats->queueFull = queueFull;
+    stats->yields = yields;
+}
+
+void sim_rtosResetStats(void)
+{
+    queueFull = 0;
+    yields = 0;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    QueueHandle_t queue = calloc(1, sizeof (struct QueueDefinition));
+    if (!queue)
+        return NULL;
+    queue->storage = malloc(length * itemSize);
+    if (!queue->storage) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->itemSize = itemSize;
+    pthread_mutex_init(&queue->lock, NULL);
+    simCondInit(&queue->changed);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+    free(queue->storage);
+    free(queue);
+}
+
+static BaseType_t simQueuePut(QueueHandle_t queue, const void *item,
+        uint64_t deadline, BaseType_t *woken)
+{
+    UBaseType_t tail;
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        bool signalled = false;
+        if (deadline != 0) {
+            queue->waiting++;
+            signalled = simCondWait(&queue->changed, &queue->lock, deadline);
+            queue->waiting--;
+        }
+        if (!signalled && queue->count == queue->length) {
+            pthread_mutex_unlock(&queue->lock);
+            queueFull++;
+            return errQUEUE_FULL;
+        }
+    }
+    tail = (queue->head + queue->count++) % queue->length;
+    memcpy(queue->storage + tail * queue->itemSize, item, queue->itemSize);
+    if (queue->waiting) {
+        pthread_cond_broadcast(&queue->changed);
+        if (woken)
+            *woken = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+static BaseType_t simQueueGet(QueueHandle_t queue, void *buffer,
+        uint64_t deadline, BaseType_t *woken)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        bool signalled;
+        if (deadline == 0) {
+            pthread_mutex_unlock(&queue->lock);
+            return errQUEUE_EMPTY;
+        }
+        queue->waiting++;
+        signalled = simCondWait(&queue->changed, &queue->lock, deadline);
+        queue->waiting--;
+        if (!signalled && queue->count == 0) {
+            pthread_mutex_unlock(&queue->lock);
+            return errQUEUE_EMPTY;
+        }
+    }
+    memcpy(buffer, queue->storage + queue->head * queue->itemSize,
+            queue->itemSize);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    if (queue->waiting) {
+        pthread_cond_broadcast(&queue->changed);
+        if (woken)
+            *woken = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item,
+        TickType_t ticksToWait)
+{
+    return simQueuePut(queue, item, ticksToWait ? simDeadline(ticksToWait) : 0,
+            NULL);
+}
+
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t queue, const void *item,
+        BaseType_t *higherPriorityTaskWoken)
+{
+    return simQueuePut(queue, item, 0, higherPriorityTaskWoken);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer,
+        TickType_t ticksToWait)
+{
+    return simQueueGet(queue, buffer, ticksToWait ? simDeadline(ticksToWait) : 0,
+            NULL);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *buffer,
+        BaseType_t *higherPriorityTaskWoken)
+{
+    return simQueueGet(queue, buffer, 0, higherPriorityTaskWoken);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    UBaseType_t count;
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+static TaskHandle_t simTaskAlloc(void)
+{
+    TaskHandle_t task = calloc(1, sizeof (struct tskTaskControlBlock));
+    if (!task)
+        return NULL;
+    task->thread = pthread_self();
+    pthread_mutex_init(&task->lock, NULL);
+    simCondInit(&task->notified);
+    return task;
+}
+
+static void *simTaskMain(void *arg)
+{
+    TaskHandle_t task = arg;
+    currentTask = task;
+    task->code(task->parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name,
+        uint16_t stackDepth, void *parameters, UBaseType_t priority,
+        TaskHandle_t *createdTask)
+{
+    TaskHandle_t task = simTaskAlloc();
+    (void)name;
+    (void)stackDepth;
+    (void)priority;
+    if (!task)
+        return pdFAIL;
+    task->code = code;
+    task->parameters = parameters;
+    if (pthread_create(&task->thread, NULL, simTaskMain, task)) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    if (createdTask)
+        *createdTask = task;
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!currentTask)
+        currentTask = simTaskAlloc();
+    return currentTask;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(sim_nowNs() / (1000000000ull / configTICK_RATE_HZ));
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return xTaskGetTickCount();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint64_t ns = (uint64_t)ticks * (1000000000ull / configTICK_RATE_HZ);
+    struct timespec ts = {
+        .tv_sec = ns / 1000000000ull,
+        .tv_nsec = ns % 1000000000ull
+    };
+    nanosleep(&ts, NULL);
+}
+
+static bool simNotify(TaskHandle_t task)
+{
+    bool woken;
+    pthread_mutex_lock(&task->lock);
+    task->notifyValue++;
+    woken = task->waiting;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return woken;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    simNotify(task);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task,
+        BaseType_t *higherPriorityTaskWoken)
+{
+    if (simNotify(task) && higherPriorityTaskWoken)
+        *higherPriorityTaskWoken = pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    uint64_t deadline = simDeadline(ticksToWait);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    task->waiting = true;
+    while (!task->notifyValue && ticksToWait &&
+            simCondWait(&task->notified, &task->lock, deadline))
+        ;
+    task->waiting = false;
+    value = task->notifyValue;
+    if (value)
+        task->notifyValue = clearCountOnExit ? 0 : value - 1;
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
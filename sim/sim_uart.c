@@ -0,0 +1,1149 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pinDefs.h"
+#include "freertos/FreeRTOS.h"
+#include "sim.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/kmem.h>
+#include <time.h>
+#include <xc.h>
+
+// UxMODE bits
+#define MODE_STSEL      (1u << 0)
+#define MODE_PDSEL      (3u << 1)
+#define MODE_BRGH       (1u << 3)
+#define MODE_ON         (1u << 15)
+
+// UxSTA bits
+#define STA_URXDA       (1u << 0)
+#define STA_OERR        (1u << 1)
+#define STA_FERR        (1u << 2)
+#define STA_PERR        (1u << 3)
+#define STA_RIDLE       (1u << 4)
+#define STA_TRMT        (1u << 8)
+#define STA_UTXBF       (1u << 9)
+#define STA_UTXEN       (1u << 10)
+#define STA_URXEN       (1u << 12)
+#define STA_STATUS      (STA_URXDA | STA_OERR | STA_FERR | STA_PERR | \
+                         STA_RIDLE | STA_TRMT | STA_UTXBF)
+
+// DCHxCON, DCHxECON and DCHxINT bits
+#define DMA_CHEN        (1u << 7)
+#define DMA_CHAEN       (1u << 4)
+#define DMA_SIRQEN      (1u << 4)
+#define DMA_CHERIF      (1u << 0)
+#define DMA_CHCCIF      (1u << 2)
+#define DMA_CHBCIF      (1u << 3)
+#define DMA_CHDHIF      (1u << 4)
+#define DMA_CHDDIF      (1u << 5)
+#define DMA_CHSHIF      (1u << 6)
+#define DMA_CHSDIF      (1u << 7)
+
+#define SIM_LOG_SIZE        64
+#define SIM_LOG_EXPIRE_NS   10000000ull
+#define SIM_IDLE_NS         1000000ull
+#define SIM_POLL_NS         20000ull
+#define SIM_EMIT_MAX        64
+#define SIM_PA_REGIONS      255
+#define SIM_PA_SPAN         (1u << 20)
+#define SIM_VEC_DMA         SIM_NUM_UARTS
+#define SIM_VEC_TIMER       (SIM_VEC_DMA + SIM_NUM_DMA)
+#define SIM_NUM_VECTORS     (SIM_VEC_TIMER + SIM_NUM_TIMERS)
+
+typedef struct {
+    uint8_t vector;
+    uint8_t errReg;
+    uint8_t rxReg;
+    uint8_t txReg;
+    uint32_t errMask;
+    uint32_t rxMask;
+    uint32_t txMask;
+    uint8_t ipc;
+    uint8_t ipcShift;
+} simIrq_t;
+
+typedef struct {
+    uint16_t *wire;             /**<Characters still to arrive on the RX line*/
+    size_t wireHead;
+    size_t wireLen;
+    size_t wireCap;
+    uint64_t rxDue;             /**<Completion time of the character on the line, 0 if idle*/
+    bool paced;                 /**<The line holds a character while the FIFO is full*/
+    uint16_t rxFifo[SIM_UART_RX_FIFO_DEPTH];
+    unsigned rxHead;
+    unsigned rxCount;
+    bool oerr;
+    bool oerrShown;             /**<OERR as last published in UxSTA*/
+    uint16_t txFifo[SIM_UART_TX_FIFO_DEPTH];
+    unsigned txHead;
+    unsigned txCount;
+    bool txShifting;
+    uint16_t txShift;
+    uint64_t txDue;
+    uint8_t *out;               /**<Characters sent, collected by sim_uartTake*/
+    size_t outLen;
+    size_t outCap;
+    sim_uartTxHook_t hook;
+    void *hookCtx;
+    sim_uartStats_t stats;
+} simUart_t;
+
+typedef struct {
+    volatile uint32_t *sfr;
+    _Atomic int64_t value;
+    uint64_t issued;
+} simLogEntry_t;
+
+sim_uartSfr_t sim_uartSfr[SIM_NUM_UARTS];
+sim_dmaSfr_t sim_dmaSfr[SIM_NUM_DMA];
+sim_timerSfr_t sim_timerSfr[SIM_NUM_TIMERS];
+sim_sfr_t sim_dmacon;
+sim_sfr_t sim_ifs[3];
+sim_sfr_t sim_iec[3];
+sim_sfr_t sim_ipc[16];
+
+extern void uart1Handler(void) __attribute__((weak));
+extern void uart2Handler(void) __attribute__((weak));
+extern void uart3Handler(void) __attribute__((weak));
+extern void uart4Handler(void) __attribute__((weak));
+extern void uart5Handler(void) __attribute__((weak));
+extern void uart6Handler(void) __attribute__((weak));
+extern void dma0Handler(void) __attribute__((weak));
+extern void dma1Handler(void) __attribute__((weak));
+extern void dma2Handler(void) __attribute__((weak));
+extern void dma3Handler(void) __attribute__((weak));
+extern void dma4Handler(void) __attribute__((weak));
+extern void dma5Handler(void) __attribute__((weak));
+extern void dma6Handler(void) __attribute__((weak));
+extern void dma7Handler(void) __attribute__((weak));
+extern void timer2Handler(void) __attribute__((weak));
+extern void timer3Handler(void) __attribute__((weak));
+extern void timer4Handler(void) __attribute__((weak));
+extern void timer5Handler(void) __attribute__((weak));
+
+static const simIrq_t simIrqs[SIM_NUM_UARTS] = {
+    {_UART1_VECTOR, 0, 0, 0, _IFS0_U1EIF_MASK, _IFS0_U1RXIF_MASK, _IFS0_U1TXIF_MASK, 6, 0},
+    {_UART2_VECTOR, 1, 1, 1, _IFS1_U2EIF_MASK, _IFS1_U2RXIF_MASK, _IFS1_U2TXIF_MASK, 8, 0},
+    {_UART3_VECTOR, 0, 1, 1, _IFS0_U3EIF_MASK, _IFS1_U3RXIF_MASK, _IFS1_U3TXIF_MASK, 7, 24},
+    {_UART4_VECTOR, 2, 2, 2, _IFS2_U4EIF_MASK, _IFS2_U4RXIF_MASK, _IFS2_U4TXIF_MASK, 12, 8},
+    {_UART5_VECTOR, 2, 2, 2, _IFS2_U5EIF_MASK, _IFS2_U5RXIF_MASK, _IFS2_U5TXIF_MASK, 12, 24},
+    {_UART6_VECTOR, 2, 2, 2, _IFS2_U6EIF_MASK, _IFS2_U6RXIF_MASK, _IFS2_U6TXIF_MASK, 12, 16},
+};
+
+static simUart_t sims[SIM_NUM_UARTS];
+static uint64_t timerBase[SIM_NUM_TIMERS];  /**<Time at which TMRx was 0*/
+static simLogEntry_t simLog[SIM_LOG_SIZE];
+static unsigned logHead;
+static unsigned logTail;
+static uintptr_t paRegions[SIM_PA_REGIONS];
+static unsigned numPaRegions;
+
+static pthread_mutex_t simLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t simWake;
+static pthread_cond_t irqWake;
+static pthread_once_t simOnce = PTHREAD_ONCE_INIT;
+static pthread_t periphThread;
+static pthread_t irqThread;
+static bool running;
+
+uint64_t sim_nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint32_t sim_coreTimer(void)
+{
+    return (uint32_t)(sim_nowNs() * (SYS_CLK_FREQ / 2000) / 1000000);
+}
+
+static void simInit(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&simWake, &attr);
+    pthread_cond_init(&irqWake, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void simLock_(void)
+{
+    pthread_once(&simOnce, simInit);
+    pthread_mutex_lock(&simLock);
+}
+
+static void simWait(pthread_cond_t *cond, uint64_t until)
+{
+    struct timespec ts = {
+        .tv_sec = until / 1000000000ull,
+        .tv_nsec = until % 1000000000ull
+    };
+    pthread_cond_timedwait(cond, &simLock, &ts);
+}
+
+static uint32_t simBaud(unsigned uart)
+{
+    uint32_t mode = sim_uartSfr[uart].mode.reg;
+    uint32_t div = (mode & MODE_BRGH) ? 4 : 16;
+    return PB_CLK_FREQ / (div * ((sim_uartSfr[uart].brg.reg & 0xffff) + 1));
+}
+
+static uint64_t simCharNs(unsigned uart)
+{
+    uint32_t mode = sim_uartSfr[uart].mode.reg;
+    uint32_t pdsel = (mode & MODE_PDSEL) >> 1;
+    uint32_t bits = 1 + (pdsel == 3 ? 9 : 8) + (pdsel == 1 || pdsel == 2) +
+            ((mode & MODE_STSEL) ? 2 : 1);
+    return (uint64_t)bits * 1000000000ull / simBaud(uart);
+}
+
+static uint32_t simStatus(unsigned uart)
+{
+    simUart_t *s = &sims[uart];
+    uint32_t status = 0;
+    if (s->rxCount) {
+        uint16_t top = s->rxFifo[s->rxHead];
+        status |= STA_URXDA;
+        if (top & SIM_RX_FERR)
+            status |= STA_FERR;
+        if (top & SIM_RX_PERR)
+            status |= STA_PERR;
+    }
+    if (s->oerr)
+        status |= STA_OERR;
+    if (!s->rxDue)
+        status |= STA_RIDLE;
+    if (!s->txCount && !s->txShifting)
+        status |= STA_TRMT;
+    if (s->txCount == SIM_UART_TX_FIFO_DEPTH)
+        status |= STA_UTXBF;
+    return status;
+}
+
+static void simClearOerr(unsigned uart)
+{
+    // Clearing OERR also empties the receive FIFO
+    sims[uart].oerr = false;
+    sims[uart].rxCount = 0;
+}
+
+static void simRefreshSta(unsigned uart)
+{
+    simUart_t *s = &sims[uart];
+    volatile uint32_t *sta = &sim_uartSfr[uart].sta.reg;
+    uint32_t old = *sta;
+    uint32_t status;
+
+    // A bitfield write may have cleared OERR behind our back
+    if (s->oerr && s->oerrShown && !(old & STA_OERR))
+        simClearOerr(uart);
+    status = (old & ~STA_STATUS) | simStatus(uart);
+    if (status != old)
+        *sta = status;
+    s->oerrShown = s->oerr;
+}
+
+/**
+ * Check the receive interrupt condition set by URXISEL.
+ */
+static bool simRxReady(unsigned uart)
+{
+    static const unsigned thresholds[4] = {1, SIM_UART_RX_FIFO_DEPTH / 2,
+            SIM_UART_RX_FIFO_DEPTH * 3 / 4, SIM_UART_RX_FIFO_DEPTH};
+    uint32_t urxisel = (sim_uartSfr[uart].sta.reg >> 6) & 3;
+    unsigned threshold = thresholds[urxisel];
+
+    return (sim_uartSfr[uart].mode.reg & MODE_ON) &&
+            sims[uart].rxCount >= threshold;
+}
+
+/**
+ * Check the transmit interrupt condition set by UTXISEL.
+ */
+static bool simTxReady(unsigned uart)
+{
+    simUart_t *s = &sims[uart];
+    uint32_t sta = sim_uartSfr[uart].sta.reg;
+
+    if (!(sim_uartSfr[uart].mode.reg & MODE_ON) || !(sta & STA_UTXEN))
+        return false;
+    switch ((sta >> 14) & 3) {
+        case 1:
+            return !s->txCount && !s->txShifting;
+        case 2:
+            return !s->txCount;
+        default:
+            return s->txCount < SIM_UART_TX_FIFO_DEPTH;
+    }
+}
+
+static void simFlags(unsigned uart)
+{
+    simUart_t *s = &sims[uart];
+    const simIrq_t *irq = &simIrqs[uart];
+
+    if (!(sim_uartSfr[uart].mode.reg & MODE_ON))
+        return;
+    if (simRxReady(uart))
+        sim_ifs[irq->rxReg].reg |= irq->rxMask;
+    if (s->oerr || (s->rxCount &&
+            (s->rxFifo[s->rxHead] & (SIM_RX_FERR | SIM_RX_PERR))))
+        sim_ifs[irq->errReg].reg |= irq->errMask;
+    if (simTxReady(uart))
+        sim_ifs[irq->txReg].reg |= irq->txMask;
+}
+
+static uint32_t simPending(unsigned uart)
+{
+    const simIrq_t *irq = &simIrqs[uart];
+    uint32_t pending = 0;
+    if (sim_ifs[irq->errReg].reg & sim_iec[irq->errReg].reg & irq->errMask)
+        pending |= 1;
+    if (sim_ifs[irq->rxReg].reg & sim_iec[irq->rxReg].reg & irq->rxMask)
+        pending |= 2;
+    if (sim_ifs[irq->txReg].reg & sim_iec[irq->txReg].reg & irq->txMask)
+        pending |= 4;
+    return pending;
+}
+
+static void simDmaRun(void);
+
+static bool simDmaPending(unsigned ch)
+{
+    uint32_t mask = _IFS1_DMA0IF_MASK << ch;
+    return sim_ifs[1].reg & sim_iec[1].reg & mask;
+}
+
+static bool simTimerPending(unsigned timer)
+{
+    uint32_t mask = _IFS0_T2IF_MASK << (4 * timer);
+    return sim_ifs[0].reg & sim_iec[0].reg & mask;
+}
+
+/**
+ * Duration of a number of counts of timer 2 - 5 at its prescaler.
+ * @param timer Timer index, 0 for timer 2.
+ * @param counts Number of counts.
+ */
+static uint64_t simTimerNs(unsigned timer, uint64_t counts)
+{
+    static const uint32_t prescale[8] = {1, 2, 4, 8, 16, 32, 64, 256};
+    uint32_t tckps = (sim_timerSfr[timer].con.reg & _T2CON_TCKPS_MASK) >>
+            _T2CON_TCKPS_POSITION;
+    return counts * prescale[tckps] * 1000000000ull / PB_CLK_FREQ;
+}
+
+static uint32_t simTimerCount(unsigned timer, uint64_t now)
+{
+    uint64_t one = simTimerNs(timer, 1000);
+    return (uint32_t)((now - timerBase[timer]) * 1000 / one) & 0xffff;
+}
+
+static void simUpdate(void)
+{
+    unsigned i;
+    bool pending = false;
+    for (i = 0; i < SIM_NUM_UARTS; i++)
+        simFlags(i);
+    simDmaRun();
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        if (simPending(i))
+            pending = true;
+    }
+    for (i = 0; i < SIM_NUM_DMA; i++) {
+        uint32_t intr = sim_dmaSfr[i].intr.reg;
+        if (intr & (intr >> 16) & 0xff)
+            sim_ifs[1].reg |= _IFS1_DMA0IF_MASK << i;
+        if (simDmaPending(i))
+            pending = true;
+    }
+    for (i = 0; i < SIM_NUM_TIMERS; i++) {
+        if (simTimerPending(i))
+            pending = true;
+    }
+    if (pending)
+        pthread_cond_signal(&irqWake);
+    pthread_cond_signal(&simWake);
+}
+
+static void simTxPush(unsigned uart, uint32_t value)
+{
+    simUart_t *s = &sims[uart];
+    s->stats.txWritten++;
+    if (s->txCount == SIM_UART_TX_FIFO_DEPTH) {
+        s->stats.txDropped++;
+        return;
+    }
+    s->txFifo[(s->txHead + s->txCount++) % SIM_UART_TX_FIFO_DEPTH] =
+            value & 0x1ff;
+}
+
+static uint32_t simRxPop(unsigned uart)
+{
+    simUart_t *s = &sims[uart];
+    uint16_t word;
+    if (!s->rxCount) {
+        s->stats.rxEmptyReads++;
+        return 0;
+    }
+    word = s->rxFifo[s->rxHead];
+    s->rxHead = (s->rxHead + 1) % SIM_UART_RX_FIFO_DEPTH;
+    s->rxCount--;
+    s->stats.rxRead++;
+    return word & 0x1ff;
+}
+
+static void simRxPush(unsigned uart, uint16_t word)
+{
+    simUart_t *s = &sims[uart];
+    if (s->oerr || s->rxCount == SIM_UART_RX_FIFO_DEPTH) {
+        s->oerr = true;
+        s->stats.rxOverrun++;
+        return;
+    }
+    s->rxFifo[(s->rxHead + s->rxCount++) % SIM_UART_RX_FIFO_DEPTH] = word;
+    s->stats.rxReceived++;
+}
+
+uint32_t sim_kvaToPa(const volatile void *kva)
+{
+    uintptr_t addr = (uintptr_t)kva;
+    uint32_t pa;
+    unsigned i;
+
+    simLock_();
+    for (i = 0; i < numPaRegions; i++) {
+        if (addr >= paRegions[i] && addr - paRegions[i] < SIM_PA_SPAN)
+            break;
+    }
+    if (i == numPaRegions) {
+        if (numPaRegions == SIM_PA_REGIONS) {
+            fprintf(stderr, "sim: out of physical address regions\n");
+            abort();
+        }
+        paRegions[numPaRegions++] = addr;
+    }
+    pa = (i + 1) * SIM_PA_SPAN + (uint32_t)(addr - paRegions[i]);
+    pthread_mutex_unlock(&simLock);
+    return pa;
+}
+
+static volatile uint8_t *simPaToKva(uint32_t pa)
+{
+    unsigned region = pa / SIM_PA_SPAN;
+    if (!region || region > numPaRegions)
+        return NULL;
+    return (volatile uint8_t *)(paRegions[region - 1] + pa % SIM_PA_SPAN);
+}
+
+static bool simDmaRead(uint32_t pa, uint8_t *value)
+{
+    volatile uint8_t *kva = simPaToKva(pa);
+    unsigned i;
+
+    if (!kva)
+        return false;
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        if (kva == (volatile uint8_t *)&sim_uartSfr[i].rx.reg) {
+            *value = (uint8_t)simRxPop(i);
+            simRefreshSta(i);
+            return true;
+        }
+    }
+    *value = *kva;
+    return true;
+}
+
+static bool simDmaWrite(uint32_t pa, uint8_t value)
+{
+    volatile uint8_t *kva = simPaToKva(pa);
+    unsigned i;
+
+    if (!kva)
+        return false;
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        if (kva == (volatile uint8_t *)&sim_uartSfr[i].tx.reg) {
+            simTxPush(i, value);
+            simRefreshSta(i);
+            return true;
+        }
+    }
+    *kva = value;
+    return true;
+}
+
+static uint32_t simDmaSize(uint32_t size)
+{
+    size &= 0xffff;
+    return size ? size : 0x10000;
+}
+
+/**
+ * Move one cell on a DMA channel and raise the matching event flags. Only
+ * byte wide transfers without pattern matching are modelled.
+ * @param ch    DMA channel.
+ */
+static void simDmaCell(unsigned ch)
+{
+    sim_dmaSfr_t *d = &sim_dmaSfr[ch];
+    uint32_t ssiz = simDmaSize(d->ssiz.reg);
+    uint32_t dsiz = simDmaSize(d->dsiz.reg);
+    uint32_t csiz = simDmaSize(d->csiz.reg);
+    uint32_t flags = DMA_CHCCIF;
+    bool done = false;
+    uint32_t n;
+    uint8_t value;
+
+    for (n = 0; n < csiz && !done; n++) {
+        if (!simDmaRead(d->ssa.reg + d->sptr.reg, &value) ||
+                !simDmaWrite(d->dsa.reg + d->dptr.reg, value)) {
+            flags = DMA_CHERIF;
+            d->con.reg &= ~DMA_CHEN;
+            break;
+        }
+        d->sptr.reg++;
+        d->dptr.reg++;
+        if (ssiz > 1 && d->sptr.reg == ssiz / 2)
+            flags |= DMA_CHSHIF;
+        if (dsiz > 1 && d->dptr.reg == dsiz / 2)
+            flags |= DMA_CHDHIF;
+        if (d->sptr.reg == ssiz) {
+            flags |= DMA_CHSDIF;
+            d->sptr.reg = 0;
+            done = ssiz >= dsiz;
+        }
+        if (d->dptr.reg == dsiz) {
+            flags |= DMA_CHDDIF;
+            d->dptr.reg = 0;
+            done = done || dsiz >= ssiz;
+        }
+    }
+    if (done) {
+        // The block ends when the larger of source and destination is done
+        flags |= DMA_CHBCIF;
+        d->sptr.reg = 0;
+        d->dptr.reg = 0;
+        if (!(d->con.reg & DMA_CHAEN))
+            d->con.reg &= ~DMA_CHEN;
+    }
+    d->intr.reg |= flags;
+}
+
+/**
+ * Check the request line behind a DMA start interrupt. UART requests follow
+ * the FIFO state rather than the sticky interrupt flag, so a channel and the
+ * CPU can both serve the same source.
+ * @param irq   Interrupt request number.
+ * @return True if the request is active.
+ */
+static bool simDmaRequest(uint32_t irq)
+{
+    sim_sfr_t *ifs = &sim_ifs[irq / 32];
+    uint32_t mask = 1u << (irq % 32);
+    unsigned i;
+
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        const simIrq_t *u = &simIrqs[i];
+        if (irq == u->rxReg * 32u + __builtin_ctz(u->rxMask))
+            return simRxReady(i);
+        if (irq == u->txReg * 32u + __builtin_ctz(u->txMask))
+            return simTxReady(i);
+    }
+    // Other sources only have their flag, which the channel consumes
+    if (!(ifs->reg & mask))
+        return false;
+    ifs->reg &= ~mask;
+    return true;
+}
+
+/**
+ * Run every enabled DMA channel whose start request is active, so a receive
+ * channel keeps moving characters until the FIFO is empty and a transmit
+ * channel until the FIFO is full.
+ */
+static void simDmaRun(void)
+{
+    unsigned ch, i;
+
+    if (!(sim_dmacon.reg & _DMACON_ON_MASK))
+        return;
+    for (ch = 0; ch < SIM_NUM_DMA; ch++) {
+        sim_dmaSfr_t *d = &sim_dmaSfr[ch];
+        uint32_t irq = (d->econ.reg >> 8) & 0xff;
+
+        if (!(d->econ.reg & DMA_SIRQEN) || irq >= 32 * 3)
+            continue;
+        while ((d->con.reg & DMA_CHEN) && simDmaRequest(irq)) {
+            simDmaCell(ch);
+            for (i = 0; i < SIM_NUM_UARTS; i++)
+                simFlags(i);
+        }
+    }
+}
+
+/**
+ * Find the UART that starts a DMA channel, so its handler time is booked on
+ * that UART.
+ * @return UART index, or -1 if the channel is not started by a UART.
+ */
+static int simDmaUart(unsigned ch)
+{
+    uint32_t irq = (sim_dmaSfr[ch].econ.reg >> 8) & 0xff;
+    unsigned i;
+
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        const simIrq_t *u = &simIrqs[i];
+        if (irq == u->rxReg * 32u + __builtin_ctz(u->rxMask) ||
+                irq == u->txReg * 32u + __builtin_ctz(u->txMask))
+            return i;
+    }
+    return -1;
+}
+
+static uint32_t simApplyOp(uint32_t reg, unsigned op, uint32_t value)
+{
+    switch (op) {
+        case 1:
+            return reg & ~value;
+        case 2:
+            return reg | value;
+        case 3:
+            return reg ^ value;
+        default:
+            return value;
+    }
+}
+
+static void simApply(volatile uint32_t *sfr, uint32_t value)
+{
+    sim_sfr_t *block = (sim_sfr_t *)((uintptr_t)sfr & ~(uintptr_t)15);
+    unsigned op = ((uintptr_t)sfr & 15) / sizeof (uint32_t);
+    unsigned i;
+
+    for (i = 0; i < SIM_NUM_TIMERS; i++) {
+        sim_timerSfr_t *timer = &sim_timerSfr[i];
+        uint64_t now = sim_nowNs();
+        if (block == &timer->tmr) {
+            timer->tmr.reg = simApplyOp(timer->tmr.reg, op, value) & 0xffff;
+            timerBase[i] = now - simTimerNs(i, timer->tmr.reg);
+            return;
+        }
+        if (block == &timer->con) {
+            uint32_t old = timer->con.reg;
+            uint32_t con = simApplyOp(old, op, value);
+            if (!(old & _T2CON_ON_MASK) && (con & _T2CON_ON_MASK))
+                timerBase[i] = now - simTimerNs(i, timer->tmr.reg);
+            if ((old & _T2CON_ON_MASK) && !(con & _T2CON_ON_MASK))
+                timer->tmr.reg = simTimerCount(i, now);
+            timer->con.reg = con;
+            return;
+        }
+    }
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        sim_uartSfr_t *uart = &sim_uartSfr[i];
+        if (block == &uart->tx) {
+            if (op == 0)
+                simTxPush(i, value);
+            return;
+        }
+        if (block == &uart->rx)
+            return;
+        if (block == &uart->sta) {
+            uint32_t old, sta;
+            simRefreshSta(i);
+            old = uart->sta.reg;
+            sta = simApplyOp(old, op, value);
+            if ((old & STA_OERR) && !(sta & STA_OERR))
+                simClearOerr(i);
+            uart->sta.reg = (sta & ~STA_STATUS) | (old & STA_STATUS);
+            simRefreshSta(i);
+            return;
+        }
+    }
+    block->reg = simApplyOp(block->reg, op, value);
+}
+
+static bool simFlush(void)
+{
+    uint64_t now = 0;
+    while (logTail != logHead) {
+        simLogEntry_t *e = &simLog[logTail % SIM_LOG_SIZE];
+        int64_t value = atomic_load(&e->value);
+        if (value < 0) {
+            // Slots that are never stored to come from reading a write-only
+            // register, drop them after a while so the log keeps moving.
+            if (!now)
+                now = sim_nowNs();
+            if (now - e->issued < SIM_LOG_EXPIRE_NS)
+                return true;
+        } else {
+            simApply(e->sfr, (uint32_t)value);
+        }
+        logTail++;
+    }
+    return false;
+}
+
+_Atomic int64_t *sim_sfrLog(volatile uint32_t *sfr)
+{
+    simLogEntry_t *e;
+    simLock_();
+    simFlush();
+    while (logHead - logTail == SIM_LOG_SIZE) {
+        pthread_mutex_unlock(&simLock);
+        sched_yield();
+        pthread_mutex_lock(&simLock);
+        simFlush();
+    }
+    simUpdate();
+    e = &simLog[logHead++ % SIM_LOG_SIZE];
+    e->sfr = sfr;
+    e->issued = sim_nowNs();
+    atomic_store(&e->value, -1);
+    pthread_mutex_unlock(&simLock);
+    return &e->value;
+}
+
+void sim_sfrStore(volatile uint32_t *sfr, uint32_t value)
+{
+    simLock_();
+    simFlush();
+    simApply(sfr, value);
+    simUpdate();
+    pthread_mutex_unlock(&simLock);
+}
+
+uint32_t sim_sfrLoad(volatile uint32_t *sfr)
+{
+    sim_sfr_t *block = (sim_sfr_t *)((uintptr_t)sfr & ~(uintptr_t)15);
+    uint32_t value;
+    unsigned i;
+
+    simLock_();
+    simFlush();
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        if (sfr == &sim_uartSfr[i].rx.reg) {
+            value = simRxPop(i);
+            simRefreshSta(i);
+            simUpdate();
+            pthread_mutex_unlock(&simLock);
+            return value;
+        }
+        if (block == &sim_uartSfr[i].sta)
+            simRefreshSta(i);
+    }
+    value = *sfr;
+    simUpdate();
+    pthread_mutex_unlock(&simLock);
+    return value;
+}
+
+volatile __UxSTAbits_t *sim_uartStaBits(unsigned uart)
+{
+    sim_sfrLoad(&sim_uartSfr[uart].sta.reg);
+    return (volatile __UxSTAbits_t *)&sim_uartSfr[uart].sta.reg;
+}
+
+volatile __UxMODEbits_t *sim_uartModeBits(unsigned uart)
+{
+    sim_sfrLoad(&sim_uartSfr[uart].mode.reg);
+    return (volatile __UxMODEbits_t *)&sim_uartSfr[uart].mode.reg;
+}
+
+/**
+ * Advance the line state of every UART to the current time.
+ * @param now       Current time.
+ * @param emitted   Characters that left a transmitter, per UART.
+ * @param numEmitted Number of characters in emitted, per UART.
+ * @return Time of the next line event.
+ */
+static uint64_t simTick(uint64_t now, uint16_t emitted[][SIM_EMIT_MAX],
+        unsigned *numEmitted)
+{
+    uint64_t next = UINT64_MAX;
+    unsigned i;
+
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        simUart_t *s = &sims[i];
+        uint32_t sta = sim_uartSfr[i].sta.reg;
+        uint64_t charNs;
+
+        numEmitted[i] = 0;
+        if (!(sim_uartSfr[i].mode.reg & MODE_ON))
+            continue;
+        charNs = simCharNs(i);
+
+        if (s->wireHead < s->wireLen && !s->rxDue)
+            s->rxDue = now + charNs;
+        while (s->rxDue && s->rxDue <= now) {
+            uint16_t word;
+            // Like a sender stopped by flow control, for a character time
+            if (s->paced && (sta & STA_URXEN) &&
+                    s->rxCount == SIM_UART_RX_FIFO_DEPTH) {
+                s->rxDue = now + charNs;
+                break;
+            }
+            word = s->wire[s->wireHead++];
+            if (sta & STA_URXEN) {
+                simRxPush(i, word);
+                // DMA keeps up with the line even if this thread ran late
+                simFlags(i);
+                simDmaRun();
+            }
+            if (s->wireHead < s->wireLen) {
+                s->rxDue += charNs;
+            } else {
+                s->rxDue = 0;
+                s->wireHead = s->wireLen = 0;
+            }
+        }
+        if (s->rxDue && s->rxDue < next)
+            next = s->rxDue;
+
+        if (!s->txShifting && s->txCount && (sta & STA_UTXEN)) {
+            s->txShift = s->txFifo[s->txHead];
+            s->txHead = (s->txHead + 1) % SIM_UART_TX_FIFO_DEPTH;
+            s->txCount--;
+            s->txShifting = true;
+            s->txDue = now + charNs;
+        }
+        while (s->txShifting && s->txDue <= now &&
+                numEmitted[i] < SIM_EMIT_MAX) {
+            if (s->outLen == s->outCap) {
+                s->outCap = s->outCap ? s->outCap * 2 : 256;
+                s->out = realloc(s->out, s->outCap);
+            }
+            s->out[s->outLen++] = (uint8_t)s->txShift;
+            emitted[i][numEmitted[i]++] = s->txShift;
+            s->stats.txSent++;
+            s->txShifting = false;
+            if (s->txCount) {
+                s->txShift = s->txFifo[s->txHead];
+                s->txHead = (s->txHead + 1) % SIM_UART_TX_FIFO_DEPTH;
+                s->txCount--;
+                s->txShifting = true;
+                s->txDue += charNs;
+            }
+        }
+        if (s->txShifting && s->txDue < next)
+            next = s->txDue;
+        simRefreshSta(i);
+    }
+    for (i = 0; i < SIM_NUM_TIMERS; i++) {
+        sim_timerSfr_t *timer = &sim_timerSfr[i];
+        uint64_t period;
+
+        if (!(timer->con.reg & _T2CON_ON_MASK))
+            continue;
+        // The timer matches PRx and starts over from 0
+        period = simTimerNs(i, (timer->pr.reg & 0xffff) + 1);
+        if (now - timerBase[i] >= period) {
+            sim_ifs[0].reg |= _IFS0_T2IF_MASK << (4 * i);
+            timerBase[i] += (now - timerBase[i]) / period * period;
+        }
+        timer->tmr.reg = simTimerCount(i, now);
+        if (timerBase[i] + period < next)
+            next = timerBase[i] + period;
+    }
+    return next;
+}
+
+static void *simPeriphMain(void *arg)
+{
+    static uint16_t emitted[SIM_NUM_UARTS][SIM_EMIT_MAX];
+    unsigned numEmitted[SIM_NUM_UARTS];
+    (void)arg;
+
+    pthread_mutex_lock(&simLock);
+    while (running) {
+        uint64_t now = sim_nowNs();
+        bool logPending = simFlush();
+        uint64_t next = simTick(now, emitted, numEmitted);
+        unsigned i, j;
+
+        simUpdate();
+        for (i = 0; i < SIM_NUM_UARTS; i++) {
+            sim_uartTxHook_t hook = sims[i].hook;
+            void *ctx = sims[i].hookCtx;
+            if (!hook || !numEmitted[i])
+                continue;
+            pthread_mutex_unlock(&simLock);
+            for (j = 0; j < numEmitted[i]; j++)
+                hook(ctx, i, emitted[i][j]);
+            pthread_mutex_lock(&simLock);
+        }
+        if (logPending && next > now + SIM_POLL_NS)
+            next = now + SIM_POLL_NS;
+        if (next > now + SIM_IDLE_NS)
+            next = now + SIM_IDLE_NS;
+        if (next > sim_nowNs())
+            simWait(&simWake, next);
+    }
+    pthread_mutex_unlock(&simLock);
+    return NULL;
+}
+
+static bool simVectorPending(unsigned v)
+{
+    if (v >= SIM_VEC_TIMER)
+        return simTimerPending(v - SIM_VEC_TIMER);
+    if (v >= SIM_VEC_DMA)
+        return simDmaPending(v - SIM_VEC_DMA);
+    return simPending(v);
+}
+
+static uint32_t simVectorPriority(unsigned v)
+{
+    uint32_t ipc, shift;
+
+    if (v >= SIM_VEC_TIMER) {
+        ipc = 2 + v - SIM_VEC_TIMER;
+        shift = 0;
+    } else if (v >= SIM_VEC_DMA) {
+        ipc = 9 + (v - SIM_VEC_DMA) / 4;
+        shift = 8 * ((v - SIM_VEC_DMA) % 4);
+    } else {
+        ipc = simIrqs[v].ipc;
+        shift = simIrqs[v].ipcShift;
+    }
+    return (sim_ipc[ipc].reg >> (shift + 2)) & 7;
+}
+
+/**
+ * Mask the sources of a vector without a handler, like a spurious vector.
+ */
+static void simVectorMask(unsigned v)
+{
+    if (v >= SIM_VEC_TIMER) {
+        sim_iec[0].reg &= ~(_IEC0_T2IE_MASK << (4 * (v - SIM_VEC_TIMER)));
+    } else if (v >= SIM_VEC_DMA) {
+        sim_iec[1].reg &= ~(_IEC1_DMA0IE_MASK << (v - SIM_VEC_DMA));
+    } else {
+        sim_iec[simIrqs[v].errReg].reg &= ~simIrqs[v].errMask;
+        sim_iec[simIrqs[v].rxReg].reg &= ~simIrqs[v].rxMask;
+        sim_iec[simIrqs[v].txReg].reg &= ~simIrqs[v].txMask;
+    }
+}
+
+static void *simIrqMain(void *arg)
+{
+    static void (*const vectors[SIM_NUM_VECTORS])(void) = {
+        uart1Handler, uart2Handler, uart3Handler,
+        uart4Handler, uart5Handler, uart6Handler,
+        dma0Handler, dma1Handler, dma2Handler, dma3Handler,
+        dma4Handler, dma5Handler, dma6Handler, dma7Handler,
+        timer2Handler, timer3Handler, timer4Handler, timer5Handler
+    };
+    (void)arg;
+
+    pthread_mutex_lock(&simLock);
+    while (running) {
+        bool logPending = simFlush();
+        int best = -1;
+        uint32_t bestPriority = 0;
+        uint64_t start, elapsed;
+        unsigned i;
+        int uart;
+
+        simUpdate();
+        for (i = 0; i < SIM_NUM_VECTORS; i++) {
+            uint32_t priority = simVectorPriority(i);
+            if (priority > bestPriority && simVectorPending(i)) {
+                best = i;
+                bestPriority = priority;
+            }
+        }
+        if (best < 0) {
+            simWait(&irqWake, sim_nowNs() +
+                    (logPending ? SIM_POLL_NS : SIM_IDLE_NS));
+            continue;
+        }
+        if (!vectors[best]) {
+            simVectorMask(best);
+            continue;
+        }
+        pthread_mutex_unlock(&simLock);
+        sim_enterCritical();
+        start = sim_nowNs();
+        vectors[best]();
+        elapsed = sim_nowNs() - start;
+        sim_exitCritical();
+        pthread_mutex_lock(&simLock);
+        // Timer handlers cannot be tied to a UART and are not booked
+        if (best >= SIM_VEC_TIMER)
+            uart = -1;
+        else if (best >= SIM_VEC_DMA)
+            uart = simDmaUart(best - SIM_VEC_DMA);
+        else
+            uart = best;
+        if (uart < 0)
+            continue;
+        sims[uart].stats.isrCount++;
+        sims[uart].stats.isrNs += elapsed;
+        if (elapsed > sims[uart].stats.isrMaxNs)
+            sims[uart].stats.isrMaxNs = elapsed;
+    }
+    pthread_mutex_unlock(&simLock);
+    return NULL;
+}
+
+void sim_uartStart(void)
+{
+    simLock_();
+    if (running) {
+        pthread_mutex_unlock(&simLock);
+        return;
+    }
+    running = true;
+    pthread_mutex_unlock(&simLock);
+    pthread_create(&periphThread, NULL, simPeriphMain, NULL);
+    pthread_create(&irqThread, NULL, simIrqMain, NULL);
+}
+
+void sim_uartStop(void)
+{
+    simLock_();
+    if (!running) {
+        pthread_mutex_unlock(&simLock);
+        return;
+    }
+    running = false;
+    pthread_cond_broadcast(&simWake);
+    pthread_cond_broadcast(&irqWake);
+    pthread_mutex_unlock(&simLock);
+    pthread_join(periphThread, NULL);
+    pthread_join(irqThread, NULL);
+}
+
+void sim_uartReset(void)
+{
+    unsigned i;
+    simLock_();
+    for (i = 0; i < SIM_NUM_UARTS; i++) {
+        free(sims[i].wire);
+        free(sims[i].out);
+    }
+    memset(sims, 0, sizeof (sims));
+    memset(sim_uartSfr, 0, sizeof (sim_uartSfr));
+    memset(sim_ifs, 0, sizeof (sim_ifs));
+    memset(sim_iec, 0, sizeof (sim_iec));
+    memset(sim_ipc, 0, sizeof (sim_ipc));
+    memset(sim_dmaSfr, 0, sizeof (sim_dmaSfr));
+    memset(&sim_dmacon, 0, sizeof (sim_dmacon));
+    memset(sim_timerSfr, 0, sizeof (sim_timerSfr));
+    numPaRegions = 0;
+    logTail = logHead;
+    for (i = 0; i < SIM_NUM_UARTS; i++)
+        simRefreshSta(i);
+    pthread_mutex_unlock(&simLock);
+}
+
+void sim_uartInjectWord(unsigned uart, uint16_t word)
+{
+    simUart_t *s = &sims[uart];
+    simLock_();
+    if (s->wireLen == s->wireCap) {
+        s->wireCap = s->wireCap ? s->wireCap * 2 : 256;
+        s->wire = realloc(s->wire, s->wireCap * sizeof (uint16_t));
+    }
+    s->wire[s->wireLen++] = word;
+    s->stats.rxInjected++;
+    if (!s->rxDue && (sim_uartSfr[uart].mode.reg & MODE_ON))
+        s->rxDue = sim_nowNs() + simCharNs(uart);
+    pthread_cond_signal(&simWake);
+    pthread_mutex_unlock(&simLock);
+}
+
+void sim_uartInject(unsigned uart, const uint8_t *data, size_t len)
+{
+    while (len--)
+        sim_uartInjectWord(uart, *(data++));
+}
+
+void sim_uartPace(unsigned uart, bool paced)
+{
+    simLock_();
+    sims[uart].paced = paced;
+    pthread_mutex_unlock(&simLock);
+}
+
+size_t sim_uartTake(unsigned uart, uint8_t *data, size_t len)
+{
+    simUart_t *s = &sims[uart];
+    simLock_();
+    if (len > s->outLen)
+        len = s->outLen;
+    memcpy(data, s->out, len);
+    memmove(s->out, s->out + len, s->outLen - len);
+    s->outLen -= len;
+    pthread_mutex_unlock(&simLock);
+    return len;
+}
+
+void sim_uartSetTxHook(unsigned uart, sim_uartTxHook_t hook, void *ctx)
+{
+    simLock_();
+    sims[uart].hook = hook;
+    sims[uart].hookCtx = ctx;
+    pthread_mutex_unlock(&simLock);
+}
+
+bool sim_uartIsIdle(unsigned uart)
+{
+    simUart_t *s = &sims[uart];
+    bool idle;
+    simLock_();
+    simFlush();
+    idle = s->wireHead == s->wireLen && !s->rxDue && !s->txCount &&
+            !s->txShifting;
+    pthread_mutex_unlock(&simLock);
+    return idle;
+}
+
+uint32_t sim_uartBaud(unsigned uart)
+{
+    uint32_t baud;
+    simLock_();
+    simFlush();
+    baud = simBaud(uart);
+    pthread_mutex_unlock(&simLock);
+    return baud;
+}
+
+uint64_t sim_uartCharNs(unsigned uart)
+{
+    uint64_t ns;
+    simLock_();
+    simFlush();
+    ns = simCharNs(uart);
+    pthread_mutex_unlock(&simLock);
+    return ns;
+}
+
+void sim_uartGetStats(unsigned uart, sim_uartStats_t *stats)
+{
+    simLock_();
+    *stats = sims[uart].stats;
+    pthread_mutex_unlock(&simLock);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for <sys/attribs.h>. Interrupt handlers become plain
+ * functions; sim_uart.c calls them from its interrupt thread.
+ */
+
+#ifndef SIM_SYS_ATTRIBS_H
+#define	SIM_SYS_ATTRIBS_H
+
+#define __ISR(vector, ipl)
+
+#endif	/* SIM_SYS_ATTRIBS_H */
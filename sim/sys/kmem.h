@@ -0,0 +1,40 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for <sys/kmem.h>. Host pointers do not fit the 32 bit DMA
+ * address registers, so sim_uart.c hands out a physical address per memory
+ * region and translates it back when the simulated DMA engine moves data.
+ */
+
+#ifndef SIM_SYS_KMEM_H
+#define	SIM_SYS_KMEM_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+uint32_t sim_kvaToPa(const volatile void *kva);
+
+#define KVA_TO_PA(v)    sim_kvaToPa((const volatile void *)(v))
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SIM_SYS_KMEM_H */
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2015 - 2016 Bart Monhemius.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host stand-in for <xc.h>: pulls in the simulated device header and maps the
+ * MIPS core timer onto the host monotonic clock.
+ */
+
+#ifndef SIM_XC_H
+#define	SIM_XC_H
+
+#include <p32xxxx.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+uint32_t sim_coreTimer(void);
+
+// The core timer counts at half the system clock, as on the PIC32MX
+#define _CP0_GET_COUNT()    sim_coreTimer()
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SIM_XC_H */